@@ -3,7 +3,7 @@
    Program:    QLite
    File:       qlclient.c
    
-   Version:    V1.1
+   Version:    V1.14
    Date:       04.10.00
    Function:   Client routines for querying the qllockd daemon
    
@@ -51,6 +51,27 @@
    Revision History:
    =================
    V1.0  04.10.00  Original   By: ACRM
+   V1.1  18.10.26  GetLock() queues with WAITLOCK rather than polling
+   V1.2  18.10.26  All requests go over one persistent SESSION
+   V1.3  18.10.26  Locks are leases of LEASE_TTL seconds. Added 
+                   RenewLock()
+   V1.4  18.10.26  Added EnqueueJob() and DequeueJob()
+   V1.5  18.10.26  InitLocks() takes the name of the lock to use so
+                   that one qllockd can serve several clusters
+   V1.6  18.10.26  GetLock() can ask for a shared lock
+   V1.7  18.10.26  Added LockStats()
+   V1.8  18.10.26  DequeueJob() can wait for a job to be submitted
+   V1.9  18.10.26  DequeueJob() replaced by DequeueJobs() which can take
+                   several jobs at once
+   V1.10 18.10.26  Added RequestJobs(), ReadJobs() and LockSocket() so
+                   that a job request can be waited for alongside other
+                   events
+   V1.11 18.10.26  EnqueueJob() passes the job priority
+   V1.12 18.10.26  Job arrays. EnqueueJob() passes a range of tasks and
+                   DequeueJobs() and ReadJobs() return task indices
+   V1.13 18.10.26  Added AllocateJobIds()
+   V1.14 18.10.26  Only commands which are safe to repeat are resent
+                   after a reconnect, and a timeout closes the session
 
 *************************************************************************/
 /* Includes
@@ -60,6 +81,9 @@
 #include <time.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <poll.h>
+#include <fcntl.h>
 #define __STRICT_ANSI__
 #include <netdb.h>
 #undef __STRICT_ANSI__
@@ -82,9 +106,14 @@
 /************************************************************************/
 /* Globals
 */
-static int                 sPort;
+static int                 sPort,
+                           sSession = -1,
+                           sReadLen = 0,
+                           sReadPos = 0;
 static struct in_addr      *sAddr;
 static struct sockaddr_in  sAddress;
+static char                sReadBuff[MAXBUFF],
+                           sLockName[MAXLOCKNAME];
 
 
 /************************************************************************/
@@ -92,11 +121,45 @@ static struct sockaddr_in  sAddress;
 */
 static struct in_addr *atoaddr(char *address);
 static int CreateConnection(void);
+static BOOL OpenSession(void);
+static BOOL WriteCommand(char *cmd);
+static int SendCommand(char *cmd, char *line, int timeout, BOOL retry);
+static int ReadReply(char *line, int timeout);
+static int FillReadBuffer(time_t endTime);
+static int CopyBlock(FILE *out, int timeout);
+static void BuildDequeue(char *cmd, int cluster, int wait, int maxjobs);
+static int ParseJobs(char *line, int maxjobs, ULONG *jobnums, 
+                     ULONG *tasks, int *njobs);
 
 
 /************************************************************************/
-BOOL InitLocks(char *service, char *host, int port)
+/*>BOOL InitLocks(char *service, char *host, int port, char *lockName)
+   -------------------------------------------------------------------
+   Input:     char   *service  Service name to look up the port
+              char   *host     Host running qllockd
+              int    port      Port (0 to use the service or default)
+              char   *lockName Name of the lock in qllockd to use. 
+                               Normally the cluster number.
+   Returns:   BOOL             Success?
+
+   Sets up the address of the lock daemon. No connection is made until
+   the first request.
+
+   04.10.00 Original   By: ACRM
+   18.10.26 Added lockName
+*/
+BOOL InitLocks(char *service, char *host, int port, char *lockName)
 {
+   /* Forget any session we may have inherited from a parent process    */
+   if(sSession >= 0)
+   {
+      close(sSession);
+      sSession = -1;
+   }
+
+   strncpy(sLockName, lockName, MAXLOCKNAME-1);
+   sLockName[MAXLOCKNAME-1] = '\0';
+
    /* Set up the port address                                           */
    if(port == 0)
    {
@@ -126,141 +189,400 @@ BOOL InitLocks(char *service, char *host, int port)
 
 
 /************************************************************************/
-int GetLock(int id, int timeout)
+/*>int GetLock(int id, int timeout, int mode)
+   ------------------------------------------
+   Input:     int    id        Instance ID of the caller
+              int    timeout   Max time to wait (seconds)
+              int    mode      LOCK_EXCLUSIVE or LOCK_SHARED
+   Returns:   int              0: Got the lock
+                               1: Timed out
+                               2: Unable to talk to qllockd
+                               3: qllockd reported an error
+
+   Asks qllockd for the lock with WAITLOCK. qllockd queues us and sends
+   OK down the connection as soon as the lock is ours, so there is no
+   need to poll. If we time out SendCommand() closes the session, which
+   makes qllockd forget our request (or release the lock if it had 
+   just been granted).
+
+   The lock is a lease which qllockd will reclaim after LEASE_TTL 
+   seconds unless it is extended with RenewLock().
+
+   Any number of clients may hold a shared lock at once, but not while
+   anyone holds the exclusive lock. Read-only tools take a shared lock
+   while anything which changes the spool takes the exclusive one.
+
+   04.10.00 Original   By: ACRM
+   18.10.26 Uses WAITLOCK rather than retrying every second
+   18.10.26 Uses the persistent session
+   18.10.26 Added mode
+   18.10.26 A timeout closes the session rather than sending CANCEL
+*/
+int GetLock(int id, int timeout, int mode)
 {
-   int    sock,
-          i;
-   char   c, 
-          cmd[MAXBUFF],
+   int    status;
+   char   cmd[MAXBUFF],
           line[MAXBUFF];
-   time_t startTime, nowTime;
 
-   time(&startTime);
-   
-   for(;;)
+   /* Send a WAITLOCK command                                           */
+   sprintf(cmd, "WAITLOCK %d TTL %d MODE %s LOCK %s.\n", id, LEASE_TTL,
+           ((mode == LOCK_SHARED) ? "SHARED" : "EXCLUSIVE"), sLockName); 
+   if((status = SendCommand(cmd, line, timeout, TRUE)) == 1)
    {
-      if((sock = CreateConnection()) < 0)
-         return(2);
+      return(1);
+   }
+   else if(status != 0)
+   {
+      return(2);
+   }
 
-      /* Send a GETLOCK command                                         */
-      sprintf(cmd, "GETLOCK %d.\n", id); 
-      write(sock, cmd, strlen(cmd)+1);
+#ifdef DEBUG
+   printf("Response: %s\n", line);
+#endif            
+               
+   if(!strncmp(line, "OK", 2))
+      return(0);
+   else if(!strncmp(line, "ERROR", 5))
+      return(3);
 
-      /* Read the response                                              */
-      i=0;
-      while(read(sock, &c, 1)) 
-      {
-         if(c)
-         {
-            line[i++] = c;
-            
-            if (c == '.')
-            {
-               shutdown(sock,0); /* We've finished reading              */
+   return(1);
+}
 
-#ifdef REQUIRE_ACK
-               /* Send an acknowledgement                               */
-               write(sock,"ACK.",4);
-#endif
+/************************************************************************/
+/*>BOOL ReleaseLock(int id)
+   ------------------------
+   Input:     int    id        Instance ID of the caller
+   Returns:   BOOL             Success?
+
+   Releases the lock held by this machine/instance
+
+   04.10.00 Original   By: ACRM
+   18.10.26 Uses the persistent session
+*/
+BOOL ReleaseLock(int id)
+{
+   char   cmd[MAXBUFF],
+          line[MAXBUFF];
+   
+   /* Send a RELEASELOCK command                                        */
+   sprintf(cmd, "RELEASELOCK %d LOCK %s.\n", id, sLockName); 
+   if(SendCommand(cmd, line, LOCK_TIMEOUT, TRUE) != 0)
+      return(FALSE);
 
-               line[i-1] = '\0';
-               
 #ifdef DEBUG
-               printf("Response: %s\n", line);
-#endif            
-               
-               if(!strncmp(line, "OK", 2))
-               {
-                  /* Close the socket connection                        */
-                  close(sock);
-                  return(0);
-               }
-               else if(!strncmp(line, "ERROR", 5))
-               {
-                  /* Close the socket connection                        */
-                  close(sock);
-                  return(3);
-               }
-
-               /* Should get here if the lock was denied                */
-               break;
-            }  /* if(c=='.')                                            */
-         }  /* if(c)                                                    */
-      }  /* while we read from socket                                   */
-
-      /* Close the socket                                               */
-      close(sock);
-      sock = 0;
-
-      /* If time out exceeded, then return                              */
-      time(&nowTime);
-      if((nowTime - startTime) > timeout)
-         return(1);
+   printf("Response: %s\n", line);
+#endif
+            
+   if(!strncmp(line, "OK", 2))
+      return(TRUE);
 
-      /* Pause before we try again                                      */
-      sleep(1);
-   }
+   return(FALSE);
+}
 
-   /* Should never get here!!                                           */
-   if(sock!=0)
-      close(sock);
-   return(4);
+/************************************************************************/
+/*>BOOL RenewLock(int id)
+   ----------------------
+   Input:     int    id        Instance ID of the caller
+   Returns:   BOOL             Do we still hold the lock?
+
+   Extends our lease on the lock by another LEASE_TTL seconds
+
+   18.10.26 Original   By: ACRM
+*/
+BOOL RenewLock(int id)
+{
+   char   cmd[MAXBUFF],
+          line[MAXBUFF];
+   
+   sprintf(cmd, "RENEW %d LOCK %s.\n", id, sLockName); 
+   if(SendCommand(cmd, line, LOCK_TIMEOUT, TRUE) != 0)
+      return(FALSE);
+
+   if(!strncmp(line, "OK", 2))
+      return(TRUE);
+
+   return(FALSE);
 }
 
 /************************************************************************/
-BOOL ReleaseLock(int id)
+/*>BOOL EnqueueJob(int cluster, ULONG jobnum, int priority, 
+                    ULONG firstTask, ULONG lastTask)
+   ---------------------------------------------------------
+   Input:     int    cluster   Cluster number
+              ULONG  jobnum    Job number
+              int    priority  Job priority (higher runs first)
+              ULONG  firstTask First task of a job array (0 if the job
+                               is not an array)
+              ULONG  lastTask  Last task of a job array
+   Returns:   BOOL             Success?
+
+   Tells qllockd that a job has been placed in the spool directory for
+   a cluster so that it can be handed out by DequeueJobs()
+
+   18.10.26 Original   By: ACRM
+   18.10.26 Added priority
+   18.10.26 Added firstTask and lastTask
+*/
+BOOL EnqueueJob(int cluster, ULONG jobnum, int priority, 
+                ULONG firstTask, ULONG lastTask)
 {
-   int    sock,
-          i;
-   char   c, 
-          cmd[MAXBUFF],
+   char   cmd[MAXBUFF],
           line[MAXBUFF];
    
-   if((sock = CreateConnection()) < 0)
+   sprintf(cmd, "ENQUEUE %d %lu", cluster, jobnum); 
+   if(priority)
+      sprintf(cmd+strlen(cmd), " PRIORITY %d", priority);
+   if(firstTask)
+      sprintf(cmd+strlen(cmd), " TASKS %lu-%lu", firstTask, lastTask);
+   strcat(cmd, ".\n");
+   if(SendCommand(cmd, line, LOCK_TIMEOUT, FALSE) != 0)
       return(FALSE);
 
-   /* Send a RELEASELOCK command                                        */
-   sprintf(cmd, "RELEASELOCK %d.\n", id); 
-   write(sock, cmd, strlen(cmd)+1);
+   if(!strncmp(line, "OK", 2))
+      return(TRUE);
+
+   return(FALSE);
+}
+
+/************************************************************************/
+/*>BOOL AllocateJobIds(int cluster, ULONG njobs, ULONG *firstJob)
+   --------------------------------------------------------------
+   Input:     int    cluster   Cluster number
+              ULONG  njobs     Number of job numbers wanted
+   Output:    ULONG  *firstJob First of njobs consecutive job numbers
+   Returns:   BOOL             Success?
+
+   Asks qllockd for a block of job numbers with NEXTIDS. qllockd keeps
+   the job counter for each cluster, so no lock is needed. Fails if 
+   qllockd is too old to know NEXTIDS, in which case the caller must 
+   fall back to updating .qllastjob itself under the lock.
+
+   18.10.26 Original   By: ACRM
+*/
+BOOL AllocateJobIds(int cluster, ULONG njobs, ULONG *firstJob)
+{
+   char   cmd[MAXBUFF],
+          line[MAXBUFF];
+   ULONG  lastJob;
+   
+   sprintf(cmd, "NEXTIDS %d %lu.\n", cluster, njobs); 
+   if(SendCommand(cmd, line, LOCK_TIMEOUT, TRUE) != 0)
+      return(FALSE);
+
+   if((sscanf(line, "IDS %lu-%lu", firstJob, &lastJob) != 2) ||
+      (*firstJob == 0) || ((lastJob - *firstJob + 1) != njobs))
+      return(FALSE);
+
+   return(TRUE);
+}
 
-   /* Read the response                                                 */
-   i=0;
-   while(read(sock, &c, 1)) 
+/************************************************************************/
+/*>int DequeueJobs(int cluster, int wait, int maxjobs, ULONG *jobnums,
+                    ULONG *tasks, int *njobs)
+   ----------------------------------------------------------------------
+   Input:     int    cluster   Cluster number
+              int    wait      Max time to wait for a job (seconds)
+              int    maxjobs   Max number of jobs to take (up to MAXBATCH)
+   Output:    ULONG  *jobnums  Job numbers
+              ULONG  *tasks    Task index of each job which is part of a
+                               job array (0 for an ordinary job)
+              int    *njobs    Number of jobs taken
+   Returns:   int              0: Got at least one job
+                               1: No job waiting
+                               2: Unable to talk to qllockd
+
+   Asks qllockd for the next jobs waiting on a cluster. The jobs are 
+   ours as soon as qllockd has told us about them, so no lock is needed
+   to fetch them from the spool directory. qllockd may send fewer than
+   maxjobs even if more are waiting.
+
+   If wait is non-zero and there is nothing waiting, qllockd holds on
+   to the request and sends us the next job submitted to the cluster
+   as soon as it arrives, so an idle qlrun does not need to poll.
+
+   18.10.26 Original   By: ACRM
+   18.10.26 Added wait
+   18.10.26 Takes up to maxjobs jobs. Renamed from DequeueJob()
+   18.10.26 Added tasks
+*/
+int DequeueJobs(int cluster, int wait, int maxjobs, ULONG *jobnums,
+                ULONG *tasks, int *njobs)
+{
+   char   cmd[MAXBUFF],
+          line[MAXBUFF];
+   
+   *njobs = 0;
+   BuildDequeue(cmd, cluster, wait, maxjobs);
+
+   /* qllockd replies when the wait is up, so allow for that            */
+   if(SendCommand(cmd, line, wait + LOCK_TIMEOUT, FALSE) != 0)
+      return(2);
+
+   return(ParseJobs(line, maxjobs, jobnums, tasks, njobs));
+}
+
+/************************************************************************/
+/*>BOOL RequestJobs(int cluster, int wait, int maxjobs)
+   ----------------------------------------------------
+   Input:     int    cluster   Cluster number
+              int    wait      Max time to wait for a job (seconds)
+              int    maxjobs   Max number of jobs to take (up to MAXBATCH)
+   Returns:   BOOL             Was the request sent?
+
+   Sends the same request as DequeueJobs() but does not wait for the
+   reply. This lets a caller which has other things to watch wait for
+   LockSocket() to become readable and then collect the jobs with 
+   ReadJobs().
+
+   18.10.26 Original   By: ACRM
+*/
+BOOL RequestJobs(int cluster, int wait, int maxjobs)
+{
+   char cmd[MAXBUFF];
+   int  tries;
+
+   BuildDequeue(cmd, cluster, wait, maxjobs);
+
+   for(tries=0; tries<2; tries++)
+   {
+      if(!OpenSession())
+         return(FALSE);
+
+      if(WriteCommand(cmd))
+         return(TRUE);
+      
+      CloseLocks();
+   }
+
+   return(FALSE);
+}
+
+/************************************************************************/
+/*>int ReadJobs(int maxjobs, ULONG *jobnums, ULONG *tasks, int *njobs)
+   -------------------------------------------------------------------
+   Input:     int    maxjobs   Max number of jobs asked for
+   Output:    ULONG  *jobnums  Job numbers
+              ULONG  *tasks    Task indices (0 if not a job array)
+              int    *njobs    Number of jobs taken
+   Returns:   int              0: Got at least one job
+                               1: No job waiting
+                               2: Unable to talk to qllockd
+
+   Reads the reply to RequestJobs()
+
+   18.10.26 Original   By: ACRM
+   18.10.26 Added tasks
+*/
+int ReadJobs(int maxjobs, ULONG *jobnums, ULONG *tasks, int *njobs)
+{
+   char line[MAXBUFF];
+
+   *njobs = 0;
+   if(ReadReply(line, LOCK_TIMEOUT) != 0)
+   {
+      /* We can't tell what state the session is in, so start again     */
+      CloseLocks();
+      return(2);
+   }
+
+   return(ParseJobs(line, maxjobs, jobnums, tasks, njobs));
+}
+
+/************************************************************************/
+/*>int LockSocket(void)
+   --------------------
+   Returns:   int              Socket for the session with qllockd 
+                               (-1 if there is none)
+
+   Gives the socket on which the reply to RequestJobs() will arrive. It
+   may change whenever a request is sent.
+
+   18.10.26 Original   By: ACRM
+*/
+int LockSocket(void)
+{
+   return(sSession);
+}
+
+/************************************************************************/
+/*>int LockStatus(void)
+   --------------------
+   Returns:   int              1: Locked, 2: Shared, 0: Unlocked, 
+                               -1: Error
+
+   Asks qllockd whether our lock is currently held
+
+   18.10.26 Original   By: ACRM
+*/
+int LockStatus(void)
+{
+   char cmd[MAXBUFF],
+        line[MAXBUFF];
+   int  status;
+   
+   sprintf(cmd, "STATUS LOCK %s.\n", sLockName);
+   if(SendCommand(cmd, line, LOCK_TIMEOUT, TRUE) != 0)
+      return(-1);
+   if(sscanf(line, "Status = %d", &status) != 1)
+      return(-1);
+
+   return(status);
+}
+
+/************************************************************************/
+/*>BOOL LockStats(FILE *out)
+   -------------------------
+   Input:     FILE   *out      Where to write the statistics
+   Returns:   BOOL             Success?
+
+   Asks qllockd for its statistics and copies them to a file
+
+   18.10.26 Original   By: ACRM
+*/
+BOOL LockStats(FILE *out)
+{
+   int tries;
+
+   for(tries=0; tries<2; tries++)
    {
-      if(c)
+      if(!OpenSession())
+         return(FALSE);
+
+      if(WriteCommand("STATS.\n"))
       {
-         line[i++] = c;
-         
-         if (c == '.')
+         switch(CopyBlock(out, LOCK_TIMEOUT))
          {
-            shutdown(sock,0); /* We've finished reading                 */
-            
-#ifdef REQUIRE_ACK
-            /* Send an acknowledgement                                  */
-            write(sock,"ACK.",4);
-#endif
-
-            line[i-1] = '\0';
-            
-#ifdef DEBUG
-            printf("Response: %s\n", line);
-#endif
-            
-            if(!strncmp(line, "OK", 2))
-            {
-               /* Close the socket connection                           */
-               close(sock);
-               return(TRUE);
-            }
-            break;
+         case 0:
+            return(TRUE);
+         case 1:
+            return(FALSE);
          }
       }
+      
+      CloseLocks();
    }
-   close(sock);
 
    return(FALSE);
 }
 
+/************************************************************************/
+/*>void CloseLocks(void)
+   ---------------------
+   Ends the session with qllockd. If we are still holding the lock, 
+   qllockd will release it.
+
+   18.10.26 Original   By: ACRM
+*/
+void CloseLocks(void)
+{
+   if(sSession >= 0)
+   {
+      send(sSession, "QUIT.\n", 7, MSG_NOSIGNAL);
+      close(sSession);
+      sSession = -1;
+   }
+}
+
 /************************************************************************/
 /*>static struct in_addr *atoaddr(char *address)
    ---------------------------------------------
@@ -306,25 +628,365 @@ static int CreateConnection(void)
 
    /* We have the address already set up, connect it to the socket      */
    if(connect(s, (struct sockaddr *)&sAddress, sizeof(sAddress)) < 0)
+   {
+      close(s);
       return(-1);
+   }
 
    return(s);
 }
 
 
+/************************************************************************/
+/*>static BOOL OpenSession(void)
+   -----------------------------
+   Returns:   BOOL             Success?
+
+   Connects to qllockd (if not already connected) and starts a SESSION
+   so that all further requests can use the same connection. The
+   socket is not inherited by the jobs we run.
+
+   18.10.26 Original   By: ACRM
+*/
+static BOOL OpenSession(void)
+{
+   char line[MAXBUFF];
+   int  on = 1;
+   
+   if(sSession >= 0)
+      return(TRUE);
+   
+   if((sSession = CreateConnection()) < 0)
+      return(FALSE);
+
+   fcntl(sSession, F_SETFD, FD_CLOEXEC);
+   setsockopt(sSession, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+   sReadLen = sReadPos = 0;
+   
+   if(!WriteCommand("SESSION.\n") ||
+      (ReadReply(line, LOCK_TIMEOUT) != 0) ||
+      strncmp(line, "OK", 2))
+   {
+      CloseLocks();
+      return(FALSE);
+   }
+
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>static BOOL WriteCommand(char *cmd)
+   -----------------------------------
+   Input:     char   *cmd      Command to send
+   Returns:   BOOL             Success?
+
+   Sends a command down the session (including the terminating '\0' as
+   qllockd has always been sent)
+
+   18.10.26 Original   By: ACRM
+*/
+static BOOL WriteCommand(char *cmd)
+{
+   int len = strlen(cmd)+1;
+   
+   if(send(sSession, cmd, len, MSG_NOSIGNAL) != len)
+      return(FALSE);
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>static int SendCommand(char *cmd, char *line, int timeout, 
+                           BOOL retry)
+   ----------------------------------------------------------------
+   Input:     char   *cmd      Command to send
+              int    timeout   Max time to wait for the reply (seconds)
+              BOOL   retry     May the command be sent again if the
+                               reply doesn't arrive?
+   Output:    char   *line     The reply without its terminating '.'
+   Returns:   int              0: OK
+                               1: Timed out
+                               2: Unable to talk to qllockd
+
+   Sends a command over the session and reads the reply. If the session
+   has been closed (e.g. qllockd has been restarted) we reconnect and
+   try once more, but only if the command could not be sent at all or
+   retry is set. retry must only be set for commands which do no harm
+   if qllockd acts on them twice: ENQUEUE and DEQUEUE must not be 
+   resent since the first may have queued or handed out jobs.
+
+   If the reply times out the session is closed, so that a late reply
+   can't be taken as the answer to the next command. qllockd releases
+   any lock held or waited for by a session which closes.
+
+   18.10.26 Original   By: ACRM
+   18.10.26 Added retry. Closes the session after a timeout
+*/
+static int SendCommand(char *cmd, char *line, int timeout, BOOL retry)
+{
+   int tries, 
+       status;
+
+   for(tries=0; tries<2; tries++)
+   {
+      if(!OpenSession())
+         return(2);
+
+      if(WriteCommand(cmd))
+      {
+         if((status = ReadReply(line, timeout)) == 0)
+            return(0);
+
+         CloseLocks();
+         if((status == 1) || !retry)
+            return(status);
+      }
+      else
+      {
+         CloseLocks();
+      }
+   }
+
+   return(2);
+}
+
+
+/************************************************************************/
+/*>static int ReadReply(char *line, int timeout)
+   ---------------------------------------------
+   Input:     int    timeout   Max time to wait (seconds)
+   Output:    char   *line     The reply without its terminating '.'
+   Returns:   int              0: OK
+                               1: Timed out
+                               2: Connection closed or failed
+
+   Reads a '.'-terminated reply from the session, waiting at most 
+   timeout seconds for it to arrive. Nulls and line breaks between 
+   replies are skipped.
+
+   18.10.26 Original   By: ACRM (from code in GetLock())
+*/
+static int ReadReply(char *line, int timeout)
+{
+   time_t endTime;
+   int    i = 0,
+          status;
+   char   c;
+
+   time(&endTime);
+   endTime += timeout;
+   
+   for(;;)
+   {
+      /* Refill the buffer when we have used everything in it           */
+      if((sReadPos >= sReadLen) &&
+         ((status = FillReadBuffer(endTime)) != 0))
+         return(status);
+
+      c = sReadBuff[sReadPos++];
+      if(c && (c != '\n') && (c != '\r') && (i < MAXBUFF-1))
+      {
+         line[i++] = c;
+         if(c == '.')
+         {
+            line[i-1] = '\0';
+            return(0);
+         }
+      }
+   }
+}
+
+
+/************************************************************************/
+/*>static int FillReadBuffer(time_t endTime)
+   -----------------------------------------
+   Input:     time_t endTime   Time by which data must arrive
+   Returns:   int              0: OK
+                               1: Timed out
+                               2: Connection closed or failed
+
+   Waits for more data on the session and reads it into the buffer
+
+   18.10.26 Original   By: ACRM (from code in ReadReply())
+*/
+static int FillReadBuffer(time_t endTime)
+{
+   struct pollfd pfd;
+   time_t        nowTime;
+   int           nready;
+
+   for(;;)
+   {
+      time(&nowTime);
+      if(nowTime > endTime)
+         return(1);
+      
+      pfd.fd     = sSession;
+      pfd.events = POLLIN;
+      if((nready = poll(&pfd, 1, (int)(endTime - nowTime) * 1000)) < 0)
+      {
+         if(errno == EINTR)
+            continue;
+         return(2);
+      }
+      else if(nready == 0)
+      {
+         return(1);
+      }
+      
+      if((sReadLen = read(sSession, sReadBuff, MAXBUFF)) <= 0)
+      {
+         sReadLen = sReadPos = 0;
+         return(2);
+      }
+      sReadPos = 0;
+      return(0);
+   }
+}
+
+
+/************************************************************************/
+/*>static void BuildDequeue(char *cmd, int cluster, int wait, 
+                            int maxjobs)
+   -------------------------------------------------------------
+   Input:     int    cluster   Cluster number
+              int    wait      Max time to wait for a job (seconds)
+              int    maxjobs   Max number of jobs to take
+   Output:    char   *cmd      DEQUEUE command
+
+   Builds a DEQUEUE command
+
+   18.10.26 Original   By: ACRM (from code in DequeueJobs())
+*/
+static void BuildDequeue(char *cmd, int cluster, int wait, int maxjobs)
+{
+   if(maxjobs > MAXBATCH)
+      maxjobs = MAXBATCH;
+
+   sprintf(cmd, "DEQUEUE %d", cluster);
+   if(wait > 0)
+      sprintf(cmd+strlen(cmd), " WAIT %d", wait);
+   if(maxjobs > 1)
+      sprintf(cmd+strlen(cmd), " MAX %d", maxjobs);
+   strcat(cmd, ".\n");
+}
+
+
+/************************************************************************/
+/*>static int ParseJobs(char *line, int maxjobs, ULONG *jobnums, 
+                        ULONG *tasks, int *njobs)
+   -------------------------------------------------------------
+   Input:     char   *line     Reply to DEQUEUE
+              int    maxjobs   Max number of jobs asked for
+   Output:    ULONG  *jobnums  Job numbers
+              ULONG  *tasks    Task indices (0 if not a job array)
+              int    *njobs    Number of jobs taken
+   Returns:   int              0: Got at least one job
+                               1: No job waiting
+                               2: Bad reply
+
+   Reads the job numbers from a JOB n1 n2 ... reply. A task of a job
+   array is sent as job:task.
+
+   18.10.26 Original   By: ACRM (from code in DequeueJobs())
+   18.10.26 Added tasks
+*/
+static int ParseJobs(char *line, int maxjobs, ULONG *jobnums, 
+                     ULONG *tasks, int *njobs)
+{
+   char *chp;
+   int  offset;
+
+   *njobs = 0;
+   if(maxjobs > MAXBATCH)
+      maxjobs = MAXBATCH;
+
+   if(!strncmp(line, "JOB ", 4))
+   {
+      for(chp=line+4; 
+          (*njobs < maxjobs) && 
+          (sscanf(chp, "%lu%n", &(jobnums[*njobs]), &offset) == 1);
+          chp += offset)
+      {
+         tasks[*njobs] = 0;
+         if(chp[offset] == ':')
+         {
+            chp += offset + 1;
+            if(sscanf(chp, "%lu%n", &(tasks[*njobs]), &offset) != 1)
+               return(2);
+         }
+         (*njobs)++;
+      }
+      if(*njobs)
+         return(0);
+   }
+   else if(!strncmp(line, "NONE", 4))
+   {
+      return(1);
+   }
+
+   return(2);
+}
+
+
+/************************************************************************/
+/*>static int CopyBlock(FILE *out, int timeout)
+   --------------------------------------------
+   Input:     FILE   *out      Where to copy the reply
+              int    timeout   Max time to wait (seconds)
+   Returns:   int              0: OK
+                               1: Timed out
+                               2: Connection closed or failed
+
+   Copies a multi-line reply (as sent for STATS) which is terminated by
+   a '\0' rather than a '.'. The end of any earlier reply is skipped.
+
+   18.10.26 Original   By: ACRM
+*/
+static int CopyBlock(FILE *out, int timeout)
+{
+   time_t endTime;
+   BOOL   started = FALSE;
+   int    status;
+   char   c;
+
+   time(&endTime);
+   endTime += timeout;
+   
+   for(;;)
+   {
+      if((sReadPos >= sReadLen) &&
+         ((status = FillReadBuffer(endTime)) != 0))
+         return(status);
+
+      c = sReadBuff[sReadPos++];
+      if(!started)
+      {
+         if(!c || (c == '\n') || (c == '\r'))
+            continue;
+         started = TRUE;
+      }
+      if(!c)
+         return(0);
+      putc(c, out);
+   }
+}
+
+
 /************************************************************************/
 #ifdef DEMO
 int main(int argc, char **argv)
 {
-   if(InitLocks("qlite", "sapc13", 5468))
+   if(InitLocks("qlite", "sapc13", 5468, "0"))
    {
-      if(GetLock(1, 5)==0)
+      if(GetLock(1, 5, LOCK_EXCLUSIVE)==0)
          printf("Got lock!\n");
       else
          printf("Lock denied!\n");
 
 /*
-      if(GetLock(1, 5)==0)
+      if(GetLock(1, 5, LOCK_EXCLUSIVE)==0)
          printf("Got lock!\n");
       else
          printf("Lock denied!\n");
@@ -334,7 +996,7 @@ int main(int argc, char **argv)
       else
          printf("Couldn't release lock!\n");
 
-      if(GetLock(1, 5)==0)
+      if(GetLock(1, 5, LOCK_EXCLUSIVE)==0)
          printf("Got lock!\n");
       else
          printf("Lock denied!\n");
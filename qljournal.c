@@ -0,0 +1,930 @@
+/*************************************************************************
+
+   Program:    QLite
+   File:       qljournal.c
+
+   Version:    V1.3
+   Date:       18.10.26
+   Function:   Log-structured spool: job records appended to segment
+               files and found through a memory-mapped index
+
+   Copyright:  (c) University of Reading / Dr. Andrew C. R. Martin 2000
+   Author:     Dr. Andrew C. R. Martin
+   Address:    School of Animal and Microbial Sciences,
+               The University of Reading,
+               Whiteknights,
+               P.O. Box 228,
+               Reading RG6 6AJ.
+               England.
+   Phone:      +44 (0)118 987 5123 Extn. 7022
+   Fax:        +44 (0)118 931 0180
+   EMail:      andrew@bioinf.org.uk
+               andrew@stagleys.demon.co.uk
+
+**************************************************************************
+
+   This program is not in the public domain.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+   See the file COPYING.DOC for details of what you may and may not
+   do with this program.
+
+   In particular, you may not distribute this code without express
+   permission from the author; it must be obtained directly from the
+   author.
+
+**************************************************************************
+
+   Description:
+   ============
+   With many thousands of jobs queued, reading the spool directory
+   becomes the bottleneck. If a spool (or cluster) directory contains
+   a .journal subdirectory, jobs are kept there instead of as one
+   N.job file each:
+
+   seg.N   Segment files (readable only by root). Job records, exactly
+           as WriteJobRecord() would write them, are appended one after
+           another. A new segment is started once one reaches
+           JNL_SEGSIZE.
+   index   A header followed by one JNLENTRY for each job, sorted by
+           job number, giving where its record is, whether it is still
+           waiting and the details qllist and qllockd need. It is
+           mapped into memory and locked with fcntl() while in use.
+
+   Taking a job marks its entry done rather than removing anything, so
+   submitting, taking and listing jobs cost the same however many jobs
+   there are. Once at least as many entries are done as are waiting,
+   the index is rewritten without them and segments which no longer
+   hold a waiting job are removed.
+
+**************************************************************************
+
+   Usage:
+   ======
+   mkdir .journal in the spool directory, as root, while no jobs are
+   queued there. All machines sharing the spool must have the same
+   word size since the index is binary.
+
+**************************************************************************
+
+   Revision History:
+   =================
+   V1.0  18.10.26  Original   By: ACRM
+   V1.1  18.10.26  Only moves to a new segment once a record is in it
+                   and reports a failure to cut back a segment
+   V1.2  18.10.26  Opens the submitted script as the real user
+   V1.3  18.10.26  CopyRecord() always creates the script afresh
+
+*************************************************************************/
+/* Includes
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#  include <linux/limits.h>
+#else
+#  include <limits.h>
+#endif
+
+#include "qlutil.h"
+
+/************************************************************************/
+/* Defines and macros
+*/
+#define JNL_MAGIC    "QLJNL 1"   /* Start of the index                  */
+#define JNL_INDEX    "index"     /* Name of the index in JOURNAL_DIR    */
+#define JNL_SEGSIZE  (16L*1024L*1024L) /* Size at which to start a new
+                                          segment                       */
+#define JNL_GROW     1024        /* Index grows by this many entries    */
+#define JNL_MINDEAD  1024        /* Fewest finished entries worth
+                                    compacting                          */
+
+typedef struct
+{
+   char  magic[8];
+   ULONG entrySize,           /* sizeof(JNLENTRY) when it was made      */
+         nslots,              /* Entries in use                         */
+         nlive,               /* of which still waiting                 */
+         firstLive,           /* No waiting entry comes before this     */
+         segment,             /* Segment being appended to              */
+         oldest;              /* Oldest segment which may still exist   */
+}  JNLHEADER;
+
+typedef struct
+{
+   char      dir[PATH_MAX],
+             index[PATH_MAX+MAXBUFF];
+   JNLHEADER *hdr;
+   JNLENTRY  *entries;
+   size_t    size;
+   int       fd;
+   BOOL      exclusive;
+}  JOURNAL;
+
+
+/************************************************************************/
+/* Prototypes
+*/
+static BOOL OpenJournal(char *spoolDir, BOOL exclusive, JOURNAL *jnl);
+static BOOL MapJournal(JOURNAL *jnl, size_t size);
+static BOOL GrowJournal(JOURNAL *jnl);
+static void CloseJournal(JOURNAL *jnl, int durability);
+static long FindEntry(JOURNAL *jnl, ULONG jobnum);
+static BOOL AppendRecord(JOURNAL *jnl, int in, JOBRECORD *rec,
+                         int durability, JNLENTRY *entry);
+static BOOL CopyRecord(JOURNAL *jnl, JNLENTRY *entry, char *runFile,
+                       char *statFile);
+static void RetireEntry(JOURNAL *jnl, long slot);
+static void CompactJournal(JOURNAL *jnl);
+
+
+/************************************************************************/
+/*>BOOL JournalEnabled(char *spoolDir)
+   -----------------------------------
+   Input:   char   *spoolDir    Spool directory (with any cluster)
+   Returns: BOOL                Does it keep its jobs in a journal?
+
+   18.10.26 Original   By: ACRM
+*/
+BOOL JournalEnabled(char *spoolDir)
+{
+   struct stat statbuff;
+   char        dir[PATH_MAX+MAXBUFF];
+
+   sprintf(dir, "%s/%s", spoolDir, JOURNAL_DIR);
+   return((stat(dir, &statbuff) == 0) && S_ISDIR(statbuff.st_mode));
+}
+
+
+/************************************************************************/
+/*>BOOL JournalAppend(char *spoolDir, ULONG jobnum, JOBRECORD *rec,
+                      char *script, int durability)
+   -----------------------------------------------------------------
+   Input:   char      *spoolDir   Spool directory
+            ULONG     jobnum      Job number
+            JOBRECORD *rec        Details of the job
+            char      *script     Script to be run
+            int       durability  From ReadDurability()
+   Returns: BOOL                  Success?
+
+   The journal's equivalent of WriteJobRecord(). The record is appended
+   to the current segment and then added to the index, so the job
+   appears complete or not at all. With DURABLE_DATA the segment and
+   index are flushed to disk before we return; with DURABLE_FULL so is
+   the directory entry of a new segment.
+
+   As with WriteJobRecord(), the job file is only shown to qllist if
+   the script was readable by everyone. The script is opened with the
+   submitter's permissions by OpenUserFile().
+
+   18.10.26 Original   By: ACRM
+   18.10.26 Opens the script with OpenUserFile()
+*/
+BOOL JournalAppend(char *spoolDir, ULONG jobnum, JOBRECORD *rec,
+                   char *script, int durability)
+{
+   struct stat statbuff;
+   JOURNAL     jnl;
+   JNLENTRY    entry;
+   long        slot;
+   size_t      len;
+   int         in;
+   BOOL        ok = FALSE;
+
+   if((in = OpenUserFile(script)) < 0)
+      return(FALSE);
+   if(fstat(in, &statbuff) || !OpenJournal(spoolDir, TRUE, &jnl))
+   {
+      close(in);
+      return(FALSE);
+   }
+
+   memset(&entry, 0, sizeof(JNLENTRY));
+   entry.jobnum    = jobnum;
+   entry.firstTask = rec->firstTask;
+   entry.lastTask  = rec->lastTask;
+   entry.uid       = rec->uid;
+   entry.gid       = rec->gid;
+   entry.nice      = rec->nice;
+   entry.priority  = rec->priority;
+   entry.state     = JNL_WAITING;
+   if(!(statbuff.st_mode & S_IROTH))
+   {
+      entry.flags |= JNL_PRIVATE;
+   }
+   else if((len = strlen(rec->jobfile)) < JNL_NAMELEN)
+   {
+      strcpy(entry.jobfile, rec->jobfile);
+   }
+   else
+   {
+      sprintf(entry.jobfile, "...%s",
+              rec->jobfile + len - (JNL_NAMELEN - 4));
+   }
+
+   /* Job numbers usually arrive in order, so the entry almost always
+      goes at the end
+   */
+   slot = (long)jnl.hdr->nslots;
+   while((slot > 0) && (jnl.entries[slot-1].jobnum > jobnum))
+      slot--;
+
+   if(((slot == 0) || (jnl.entries[slot-1].jobnum != jobnum)) &&
+      GrowJournal(&jnl) &&
+      AppendRecord(&jnl, in, rec, durability, &entry))
+   {
+      memmove(jnl.entries+slot+1, jnl.entries+slot,
+              (jnl.hdr->nslots - slot) * sizeof(JNLENTRY));
+      jnl.entries[slot] = entry;
+      jnl.hdr->nslots++;
+      jnl.hdr->nlive++;
+      if((ULONG)slot < jnl.hdr->firstLive)
+         jnl.hdr->firstLive = (ULONG)slot;
+      ok = TRUE;
+   }
+
+   close(in);
+   CloseJournal(&jnl, durability);
+   return(ok);
+}
+
+
+/************************************************************************/
+/*>BOOL JournalFindJob(char *spoolDir, ULONG jobnum, JOBRECORD *rec)
+   -----------------------------------------------------------------
+   Input:   char      *spoolDir   Spool directory
+            ULONG     jobnum      Job number
+   Output:  JOBRECORD *rec        Details of the job from the index
+   Returns: BOOL                  Is the job waiting?
+
+   rec->jobfile is as kept in the index, so it may be shortened or
+   empty. Use JournalCopyJob() to get the record itself.
+
+   18.10.26 Original   By: ACRM
+*/
+BOOL JournalFindJob(char *spoolDir, ULONG jobnum, JOBRECORD *rec)
+{
+   JOURNAL  jnl;
+   JNLENTRY *entry;
+   long     slot;
+   BOOL     ok = FALSE;
+
+   if(!OpenJournal(spoolDir, FALSE, &jnl))
+      return(FALSE);
+
+   if((slot = FindEntry(&jnl, jobnum)) >= 0)
+   {
+      entry = jnl.entries + slot;
+      memset(rec, 0, sizeof(JOBRECORD));
+      strcpy(rec->jobfile, entry->jobfile);
+      rec->uid       = entry->uid;
+      rec->gid       = entry->gid;
+      rec->nice      = entry->nice;
+      rec->priority  = entry->priority;
+      rec->firstTask = entry->firstTask;
+      rec->lastTask  = entry->lastTask;
+      ok = TRUE;
+   }
+
+   CloseJournal(&jnl, DURABLE_NONE);
+   return(ok);
+}
+
+
+/************************************************************************/
+/*>ULONG JournalNextJob(char *spoolDir)
+   ------------------------------------
+   Input:   char   *spoolDir    Spool directory
+   Returns: ULONG               Lowest waiting job number (0 if none)
+
+   The journal's equivalent of reading the spool directory for the
+   first job. The index keeps track of it so this is immediate.
+
+   18.10.26 Original   By: ACRM
+*/
+ULONG JournalNextJob(char *spoolDir)
+{
+   JOURNAL jnl;
+   ULONG   jobnum = 0;
+
+   if(!OpenJournal(spoolDir, FALSE, &jnl))
+      return(0);
+
+   if(jnl.hdr->firstLive < jnl.hdr->nslots)
+      jobnum = jnl.entries[jnl.hdr->firstLive].jobnum;
+
+   CloseJournal(&jnl, DURABLE_NONE);
+   return(jobnum);
+}
+
+
+/************************************************************************/
+/*>JNLENTRY *JournalWaitingJobs(char *spoolDir, ULONG *njobs)
+   ----------------------------------------------------------
+   Input:   char     *spoolDir  Spool directory
+   Output:  ULONG    *njobs     Number of jobs waiting
+   Returns: JNLENTRY *          malloc()'d copies of their index
+                                entries in job order (NULL if none)
+
+   18.10.26 Original   By: ACRM
+*/
+JNLENTRY *JournalWaitingJobs(char *spoolDir, ULONG *njobs)
+{
+   JOURNAL  jnl;
+   JNLENTRY *jobs = NULL;
+   ULONG    slot;
+
+   *njobs = 0;
+   if(!OpenJournal(spoolDir, FALSE, &jnl))
+      return(NULL);
+
+   if(jnl.hdr->nlive &&
+      ((jobs = (JNLENTRY *)malloc(jnl.hdr->nlive * sizeof(JNLENTRY)))
+       != NULL))
+   {
+      for(slot=jnl.hdr->firstLive;
+          (slot < jnl.hdr->nslots) && (*njobs < jnl.hdr->nlive);
+          slot++)
+      {
+         if(jnl.entries[slot].state == JNL_WAITING)
+            jobs[(*njobs)++] = jnl.entries[slot];
+      }
+   }
+
+   CloseJournal(&jnl, DURABLE_NONE);
+   return(jobs);
+}
+
+
+/************************************************************************/
+/*>BOOL JournalCopyJob(char *spoolDir, ULONG jobnum, char *runFile,
+                       char *statFile, BOOL take)
+   ----------------------------------------------------------------
+   Input:   char   *spoolDir    Spool directory
+            ULONG  jobnum       Job number
+            char   *runFile     File to create for the script
+            char   *statFile    File to create for the header
+            BOOL   take         Take the job out of the queue
+   Returns: BOOL                Success?
+
+   Copies a waiting job out of the journal as CopyJobScript() and
+   WriteJobHeader() do for a job record. With take, the job is marked
+   done while we still hold the index, so only one node can have it;
+   this takes the place of ClaimJob(). If we die part way through the
+   job is still waiting.
+
+   18.10.26 Original   By: ACRM
+*/
+BOOL JournalCopyJob(char *spoolDir, ULONG jobnum, char *runFile,
+                    char *statFile, BOOL take)
+{
+   JOURNAL jnl;
+   long    slot;
+   BOOL    ok = FALSE;
+
+   if(!OpenJournal(spoolDir, take, &jnl))
+      return(FALSE);
+
+   if(((slot = FindEntry(&jnl, jobnum)) >= 0) &&
+      CopyRecord(&jnl, jnl.entries+slot, runFile, statFile))
+   {
+      if(take)
+      {
+         RetireEntry(&jnl, slot);
+         CompactJournal(&jnl);
+      }
+      ok = TRUE;
+   }
+
+   CloseJournal(&jnl, DURABLE_NONE);
+   return(ok);
+}
+
+
+/************************************************************************/
+/*>BOOL JournalFinishJob(char *spoolDir, ULONG jobnum)
+   ---------------------------------------------------
+   Input:   char   *spoolDir    Spool directory
+            ULONG  jobnum       Job number
+   Returns: BOOL                Was it waiting?
+
+   Marks a job done without copying it out. Used once every task of a
+   job array has finished.
+
+   18.10.26 Original   By: ACRM
+*/
+BOOL JournalFinishJob(char *spoolDir, ULONG jobnum)
+{
+   JOURNAL jnl;
+   long    slot;
+
+   if(!OpenJournal(spoolDir, TRUE, &jnl))
+      return(FALSE);
+
+   if((slot = FindEntry(&jnl, jobnum)) >= 0)
+   {
+      RetireEntry(&jnl, slot);
+      CompactJournal(&jnl);
+   }
+
+   CloseJournal(&jnl, DURABLE_NONE);
+   return(slot >= 0);
+}
+
+
+/************************************************************************/
+/*>static BOOL OpenJournal(char *spoolDir, BOOL exclusive, JOURNAL *jnl)
+   ---------------------------------------------------------------------
+   Input:   char    *spoolDir   Spool directory
+            BOOL    exclusive   Lock for writing rather than reading
+   Output:  JOURNAL *jnl        The open index
+   Returns: BOOL                Success?
+
+   Opens, locks and maps the index, creating it if we are to write.
+   Since CompactJournal() replaces the index by renaming a new one over
+   it, once we have the lock we check that the file we locked is still
+   the index and start again if not. Closing the file (CloseJournal())
+   releases the lock.
+
+   18.10.26 Original   By: ACRM
+*/
+static BOOL OpenJournal(char *spoolDir, BOOL exclusive, JOURNAL *jnl)
+{
+   struct flock lk;
+   struct stat  fdStat,
+                pathStat;
+   JNLHEADER    hdr;
+
+   sprintf(jnl->dir,   "%s/%s", spoolDir, JOURNAL_DIR);
+   sprintf(jnl->index, "%s/%s", jnl->dir, JNL_INDEX);
+   jnl->exclusive = exclusive;
+   jnl->hdr       = NULL;
+
+   for(;;)
+   {
+      if((jnl->fd = open(jnl->index,
+                         (exclusive ? (O_RDWR | O_CREAT) : O_RDONLY),
+                         0644)) < 0)
+         return(FALSE);
+
+      memset(&lk, 0, sizeof(lk));
+      lk.l_type   = (exclusive ? F_WRLCK : F_RDLCK);
+      lk.l_whence = SEEK_SET;
+      if((fcntl(jnl->fd, F_SETLKW, &lk) < 0) ||
+         fstat(jnl->fd, &fdStat) || stat(jnl->index, &pathStat))
+      {
+         close(jnl->fd);
+         return(FALSE);
+      }
+
+      if((fdStat.st_ino == pathStat.st_ino) &&
+         (fdStat.st_dev == pathStat.st_dev))
+         break;
+      close(jnl->fd);
+   }
+
+   /* A new index just has a header                                     */
+   if(fdStat.st_size == 0)
+   {
+      memset(&hdr, 0, sizeof(JNLHEADER));
+      strcpy(hdr.magic, JNL_MAGIC);
+      hdr.entrySize = sizeof(JNLENTRY);
+      hdr.segment   = hdr.oldest = 1;
+      if(!exclusive ||
+         (write(jnl->fd, &hdr, sizeof(JNLHEADER)) != sizeof(JNLHEADER)))
+      {
+         close(jnl->fd);
+         return(FALSE);
+      }
+      fdStat.st_size = sizeof(JNLHEADER);
+   }
+
+   if(((size_t)fdStat.st_size < sizeof(JNLHEADER)) ||
+      !MapJournal(jnl, (size_t)fdStat.st_size))
+   {
+      close(jnl->fd);
+      return(FALSE);
+   }
+
+   if(strcmp(jnl->hdr->magic, JNL_MAGIC) ||
+      (jnl->hdr->entrySize != sizeof(JNLENTRY)) ||
+      (jnl->size < sizeof(JNLHEADER) +
+                   jnl->hdr->nslots * sizeof(JNLENTRY)))
+   {
+      fprintf(stderr,"Journal index %s is damaged or from another \
+type of machine\n", jnl->index);
+      CloseJournal(jnl, DURABLE_NONE);
+      return(FALSE);
+   }
+
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>static BOOL MapJournal(JOURNAL *jnl, size_t size)
+   -------------------------------------------------
+   I/O:     JOURNAL *jnl       An open index
+   Input:   size_t  size       Its size
+   Returns: BOOL               Success?
+
+   (Re)maps the index into memory
+
+   18.10.26 Original   By: ACRM
+*/
+static BOOL MapJournal(JOURNAL *jnl, size_t size)
+{
+   void *map;
+
+   if(jnl->hdr != NULL)
+      munmap(jnl->hdr, jnl->size);
+   jnl->hdr = NULL;
+
+   if((map = mmap(NULL, size,
+                  (jnl->exclusive ? (PROT_READ | PROT_WRITE) : PROT_READ),
+                  MAP_SHARED, jnl->fd, 0)) == MAP_FAILED)
+      return(FALSE);
+
+   jnl->hdr     = (JNLHEADER *)map;
+   jnl->entries = (JNLENTRY *)((char *)map + sizeof(JNLHEADER));
+   jnl->size    = size;
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>static BOOL GrowJournal(JOURNAL *jnl)
+   -------------------------------------
+   I/O:     JOURNAL *jnl       An index open for writing
+   Returns: BOOL               Success?
+
+   Makes sure there is room in the index for another entry, growing it
+   by JNL_GROW entries at a time
+
+   18.10.26 Original   By: ACRM
+*/
+static BOOL GrowJournal(JOURNAL *jnl)
+{
+   size_t size;
+
+   if(sizeof(JNLHEADER) + (jnl->hdr->nslots + 1) * sizeof(JNLENTRY) <=
+      jnl->size)
+      return(TRUE);
+
+   size = sizeof(JNLHEADER) +
+          (jnl->hdr->nslots + JNL_GROW) * sizeof(JNLENTRY);
+   if(ftruncate(jnl->fd, (off_t)size))
+      return(FALSE);
+
+   return(MapJournal(jnl, size));
+}
+
+
+/************************************************************************/
+/*>static void CloseJournal(JOURNAL *jnl, int durability)
+   ------------------------------------------------------
+   Input:   JOURNAL *jnl        An open index
+            int     durability  Flush changes to disk if DURABLE_DATA or
+                                DURABLE_FULL
+
+   Unmaps and closes the index, which releases the lock
+
+   18.10.26 Original   By: ACRM
+*/
+static void CloseJournal(JOURNAL *jnl, int durability)
+{
+   if(jnl->hdr != NULL)
+   {
+      if(jnl->exclusive && (durability >= DURABLE_DATA))
+         msync(jnl->hdr, jnl->size, MS_SYNC);
+      munmap(jnl->hdr, jnl->size);
+      jnl->hdr = NULL;
+   }
+   close(jnl->fd);
+}
+
+
+/************************************************************************/
+/*>static long FindEntry(JOURNAL *jnl, ULONG jobnum)
+   -------------------------------------------------
+   Input:   JOURNAL *jnl       An open index
+            ULONG   jobnum     Job number
+   Returns: long               Slot of the job's entry (-1 if it isn't
+                               waiting)
+
+   Binary search of the index, which is kept in job order
+
+   18.10.26 Original   By: ACRM
+*/
+static long FindEntry(JOURNAL *jnl, ULONG jobnum)
+{
+   long low  = (long)jnl->hdr->firstLive,
+        high = (long)jnl->hdr->nslots - 1,
+        mid;
+
+   while(low <= high)
+   {
+      mid = (low + high) / 2;
+      if(jnl->entries[mid].jobnum == jobnum)
+         return((jnl->entries[mid].state == JNL_WAITING) ? mid : -1);
+      else if(jnl->entries[mid].jobnum < jobnum)
+         low = mid + 1;
+      else
+         high = mid - 1;
+   }
+
+   return(-1);
+}
+
+
+/************************************************************************/
+/*>static BOOL AppendRecord(JOURNAL *jnl, int in, JOBRECORD *rec,
+                            int durability, JNLENTRY *entry)
+   ----------------------------------------------------------------
+   Input:   JOURNAL   *jnl        An index open for writing
+            int       in          The script
+            JOBRECORD *rec        Details of the job
+            int       durability  From ReadDurability()
+   I/O:     JNLENTRY  *entry      Segment, offset and length are filled
+                                  in
+   Returns: BOOL                  Success?
+
+   Appends a job record to the current segment, starting a new one if
+   it is full. Only the holder of the index lock appends, so if
+   anything goes wrong the segment is cut back to where it was. The 
+   index only moves on to a new segment once the record is safely in
+   it.
+
+   18.10.26 Original   By: ACRM
+   18.10.26 Checks truncate() and only then advances the segment
+*/
+static BOOL AppendRecord(JOURNAL *jnl, int in, JOBRECORD *rec,
+                         int durability, JNLENTRY *entry)
+{
+   struct stat statbuff;
+   char        segFile[PATH_MAX+2*MAXBUFF],
+               header[MAXJOBHEADER];
+   ULONG       segment = jnl->hdr->segment;
+   int         out,
+               len,
+               dirfd;
+   BOOL        ok;
+
+   sprintf(segFile, "%s/seg.%lu", jnl->dir, segment);
+   if((out = open(segFile, O_WRONLY | O_APPEND | O_CREAT, 0600)) < 0)
+      return(FALSE);
+   if(fstat(out, &statbuff))
+   {
+      close(out);
+      return(FALSE);
+   }
+
+   if(statbuff.st_size >= JNL_SEGSIZE)
+   {
+      close(out);
+      segment++;
+      sprintf(segFile, "%s/seg.%lu", jnl->dir, segment);
+      if(((out = open(segFile, O_WRONLY | O_APPEND | O_CREAT, 0600))
+          < 0) || fstat(out, &statbuff))
+      {
+         if(out >= 0)
+            close(out);
+         return(FALSE);
+      }
+   }
+
+   len = FormatJobHeader(header, rec);
+   ok  = ((write(out, header, len) == len) && CopyData(in, out));
+   if(ok && (durability >= DURABLE_DATA) && fsync(out))
+      ok = FALSE;
+
+   entry->segment = segment;
+   entry->offset  = (ULONG)statbuff.st_size;
+   if(fstat(out, &statbuff))
+      ok = FALSE;
+   entry->length  = (ULONG)statbuff.st_size - entry->offset;
+
+   /* Errors writing to NFS may only be reported by close()             */
+   if(close(out))
+      ok = FALSE;
+   if(!ok)
+   {
+      /* Harmless if it fails, since nothing in the index refers past 
+         the offset, but the space is lost until the segment goes
+      */
+      if(truncate(segFile, (off_t)entry->offset))
+         fprintf(stderr,"Unable to remove a partial job record from \
+%s\n", segFile);
+      return(FALSE);
+   }
+
+   if((segment != jnl->hdr->segment) && (durability >= DURABLE_FULL) &&
+      ((dirfd = open(jnl->dir, O_RDONLY)) >= 0))
+   {
+      fsync(dirfd);
+      close(dirfd);
+   }
+
+   jnl->hdr->segment = segment;
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>static BOOL CopyRecord(JOURNAL *jnl, JNLENTRY *entry, char *runFile,
+                          char *statFile)
+   --------------------------------------------------------------------
+   Input:   JOURNAL  *jnl       An open index
+            JNLENTRY *entry     A waiting job
+            char     *runFile   File to create for the script
+            char     *statFile  File to create for the header
+   Returns: BOOL                Success?
+
+   Reads a job record from its segment and splits it into the script
+   and header files which qlrun runs the job from. As with 
+   CopyJobScript(), any old file is removed and the script is created
+   afresh so that a planted link is never written through.
+
+   18.10.26 Original   By: ACRM
+   18.10.26 Creates the script with O_EXCL and O_NOFOLLOW
+*/
+static BOOL CopyRecord(JOURNAL *jnl, JNLENTRY *entry, char *runFile,
+                       char *statFile)
+{
+   JOBRECORD rec;
+   FILE      *fp;
+   char      segFile[PATH_MAX+2*MAXBUFF],
+             buffer[BUFSIZ];
+   long      remaining;
+   size_t    nread;
+   int       out;
+   BOOL      ok;
+
+   sprintf(segFile, "%s/seg.%lu", jnl->dir, entry->segment);
+   if((fp = fopen(segFile, "r")) == NULL)
+      return(FALSE);
+   unlink(runFile);
+   if(fseek(fp, (long)entry->offset, SEEK_SET) ||
+      !ReadJobHeader(fp, &rec) ||
+      ((out = open(runFile, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW,
+                   0640)) < 0))
+   {
+      fclose(fp);
+      return(FALSE);
+   }
+   fchown(out, (uid_t)(-1), rec.gid);
+   fchmod(out, 0640);
+
+   /* The script runs from the end of the header to the end of the
+      record
+   */
+   ok        = TRUE;
+   remaining = (long)(entry->offset + entry->length) - rec.bodyOffset;
+   while(ok && (remaining > 0))
+   {
+      nread = fread(buffer, 1,
+                    ((remaining < BUFSIZ) ? (size_t)remaining : BUFSIZ),
+                    fp);
+      if((nread == 0) || (write(out, buffer, nread) != (ssize_t)nread))
+         ok = FALSE;
+      remaining -= (long)nread;
+   }
+   fclose(fp);
+
+   if(close(out))
+      ok = FALSE;
+   if(ok)
+      ok = WriteJobHeader(statFile, &rec);
+   if(!ok)
+      unlink(runFile);
+
+   return(ok);
+}
+
+
+/************************************************************************/
+/*>static void RetireEntry(JOURNAL *jnl, long slot)
+   ------------------------------------------------
+   I/O:     JOURNAL *jnl       An index open for writing
+   Input:   long    slot       A waiting entry
+
+   Marks an entry done and moves firstLive on past any finished entries
+
+   18.10.26 Original   By: ACRM
+*/
+static void RetireEntry(JOURNAL *jnl, long slot)
+{
+   JNLHEADER *hdr = jnl->hdr;
+
+   jnl->entries[slot].state = JNL_DONE;
+   hdr->nlive--;
+   while((hdr->firstLive < hdr->nslots) &&
+         (jnl->entries[hdr->firstLive].state == JNL_DONE))
+      hdr->firstLive++;
+}
+
+
+/************************************************************************/
+/*>static void CompactJournal(JOURNAL *jnl)
+   ----------------------------------------
+   I/O:     JOURNAL *jnl       An index open for writing
+
+   Once at least JNL_MINDEAD entries, and as many as are still waiting,
+   are done (or the queue is empty), writes a new index holding only 
+   the waiting entries and renames it over the old one. Segments which
+   no longer hold a waiting job are then removed. Since this only 
+   happens after as many jobs have finished as it copies, it adds a 
+   constant cost per job.
+
+   Must be the last change made before CloseJournal() since others may
+   use the new index as soon as it has been renamed.
+
+   18.10.26 Original   By: ACRM
+*/
+static void CompactJournal(JOURNAL *jnl)
+{
+   JNLHEADER hdr = *(jnl->hdr);
+   char      tmpName[PATH_MAX+2*MAXBUFF],
+             segFile[PATH_MAX+2*MAXBUFF],
+             *inUse = NULL;
+   ULONG     slot,
+             run,
+             seg,
+             dead  = hdr.nslots - hdr.nlive;
+   int       fd;
+   BOOL      ok;
+
+   if((hdr.nlive || !dead) && ((dead < JNL_MINDEAD) || (dead < hdr.nlive)))
+      return;
+
+   /* Note which of the older segments still hold waiting jobs          */
+   if((hdr.segment > hdr.oldest) &&
+      ((inUse = (char *)calloc(hdr.segment - hdr.oldest, 1)) == NULL))
+      return;
+   for(slot=hdr.firstLive; slot<hdr.nslots; slot++)
+   {
+      seg = jnl->entries[slot].segment;
+      if((jnl->entries[slot].state == JNL_WAITING) && (seg < hdr.segment))
+         inUse[seg - hdr.oldest] = 1;
+   }
+
+   hdr.nslots    = hdr.nlive;
+   hdr.firstLive = 0;
+   for(hdr.oldest=jnl->hdr->oldest; hdr.oldest<hdr.segment; hdr.oldest++)
+   {
+      if(inUse[hdr.oldest - jnl->hdr->oldest])
+         break;
+   }
+
+   /* Write the new index, copying runs of waiting entries in one go    */
+   sprintf(tmpName, "%s/.%s.%ld", jnl->dir, JNL_INDEX, (long)getpid());
+   if((fd = open(tmpName, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+   {
+      free(inUse);
+      return;
+   }
+   ok = (write(fd, &hdr, sizeof(JNLHEADER)) == sizeof(JNLHEADER));
+   for(slot=jnl->hdr->firstLive; ok && (slot<jnl->hdr->nslots); )
+   {
+      for(run=0;
+          (slot+run < jnl->hdr->nslots) &&
+          (jnl->entries[slot+run].state == JNL_WAITING);
+          run++);
+      if(run && (write(fd, jnl->entries+slot, run * sizeof(JNLENTRY)) !=
+                 (ssize_t)(run * sizeof(JNLENTRY))))
+         ok = FALSE;
+      slot += run + 1;
+   }
+
+   /* The old index must not be lost before the new one is on disk      */
+   if(ok && fsync(fd))
+      ok = FALSE;
+   if(close(fd))
+      ok = FALSE;
+   if(!ok || rename(tmpName, jnl->index))
+   {
+      unlink(tmpName);
+      free(inUse);
+      return;
+   }
+
+   for(seg=jnl->hdr->oldest; seg<hdr.segment; seg++)
+   {
+      if(!inUse[seg - jnl->hdr->oldest])
+      {
+         sprintf(segFile, "%s/seg.%lu", jnl->dir, seg);
+         unlink(segFile);
+      }
+   }
+
+   free(inUse);
+}
@@ -3,8 +3,8 @@
    Program:    qllist
    File:       qllist.c
    
-   Version:    V1.1
-   Date:       18.09.00
+   Version:    V1.2
+   Date:       18.10.26
    Function:   List queued jobs on farm machines
    
    Copyright:  (c) University of Reading / Dr. Andrew C. R. Martin 2000
@@ -58,6 +58,7 @@
 
    Revision History:
    =================
+   V1.2  18.10.26  Added -r and -l to show qllockd's statistics
 
 *************************************************************************/
 /* Includes
@@ -67,6 +68,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <errno.h>
 #ifdef __linux__
 #  include <linux/limits.h>
 #else
@@ -93,13 +95,19 @@
 void  Usage(void);
 int DisplayAllClusters(char *spoolDir, BOOL totalOnly);
 int DisplayJobs(char *spoolDir, BOOL totalOnly);
+int DisplayJournalJobs(char *spoolDir, BOOL quiet);
+void UserGroupName(uid_t uid, gid_t gid, char *username);
 void PrintJob(ULONG jobnum, char *jobfile, uid_t uid, gid_t gid, 
-              int nice, char *username);
+              int nice, char *username, int priority);
+void PrintTasks(char *spoolDir, ULONG jobnum, ULONG firstTask, 
+                ULONG lastTask);
 BOOL ParseCmdLine(int argc, char **argv, char *spoolDir, int *cluster,
-                  BOOL *totalOnly, BOOL *runningOnly);
+                  BOOL *totalOnly, BOOL *runningOnly, BOOL *lockStats);
+BOOL PrintLockStats(char *spoolDir);
 BOOL GetJobDetails(char *spoolDir, ULONG jobnum, char *jobfile,
                    uid_t *uid, gid_t *gid, int *nice,
-                   char *username);
+                   char *username, int *priority, ULONG *firstTask,
+                   ULONG *lastTask);
 void PrintRunningJobs(FILE *out, RUNFILE *runfiles);
 
 
@@ -120,7 +128,8 @@ int main(int argc, char **argv)
            spoolDirOrig[PATH_MAX],
            *env;
    BOOL    totalOnly   = FALSE,
-           runningOnly = FALSE;
+           runningOnly = FALSE,
+           lockStats   = FALSE;
    RUNFILE *runfiles;
    int     cluster = (-1), njobs;
 
@@ -133,8 +142,15 @@ int main(int argc, char **argv)
       strcpy(spoolDir, DEF_SPOOLDIR);
 
    if(ParseCmdLine(argc, argv, spoolDir, &cluster, &totalOnly,
-                   &runningOnly))
+                   &runningOnly, &lockStats))
    {
+      if(lockStats)
+      {
+         if(cluster > 0)
+            UpdateSpoolDir(spoolDir, cluster);
+         return(PrintLockStats(spoolDir) ? 0 : 1);
+      }
+      
       if(!runningOnly)
       {
          strcpy(spoolDirOrig, spoolDir);
@@ -218,7 +234,7 @@ int DisplayAllClusters(char *spoolDir, BOOL quiet)
 
 /************************************************************************/
 /*>int DisplayJobs(char *spoolDir, BOOL quiet)
-   -------------------------------------------
+   --------------------------------------------
    Input:   char   *spoolDir    Spool directory
             BOOL   quiet        Run quietly
    Returns: int                 Number of waiting jobs
@@ -227,6 +243,11 @@ int DisplayAllClusters(char *spoolDir, BOOL quiet)
    actually print anything, but just returns the number of jobs waiting
 
    18.09.00 Original   By: ACRM
+   18.10.26 Holds a shared lock on the cluster while reading the spool
+   18.10.26 No lock as jobs now appear in the spool atomically
+   18.10.26 Looks for job records. Those the user may not read are
+            counted and listed by number only
+   18.10.26 Jobs in a journal are listed by DisplayJournalJobs()
 */
 int DisplayJobs(char *spoolDir, BOOL quiet)
 {
@@ -236,9 +257,12 @@ int DisplayJobs(char *spoolDir, BOOL quiet)
                  jobfile[PATH_MAX],
                  username[MAXBUFF],
                  *chp;
-   ULONG         jobnum = 0;
+   ULONG         jobnum = 0,
+                 firstTask,
+                 lastTask;
    int           njobs = 0,
-                 nice;
+                 nice,
+                 priority;
    uid_t         uid;
    gid_t         gid;
    
@@ -248,6 +272,10 @@ int DisplayJobs(char *spoolDir, BOOL quiet)
       fprintf(stderr,"Spool directory, %s, does not exist!\n",
               spoolDir);
    }
+   else if(JournalEnabled(spoolDir))
+   {
+      njobs = DisplayJournalJobs(spoolDir, quiet);
+   }
    else
    {
       if((dp=opendir(spoolDir)) == NULL)
@@ -262,19 +290,34 @@ int DisplayJobs(char *spoolDir, BOOL quiet)
          /* Ignore files starting with a .                              */
          if(dirp->d_name[0] != '.')
          {
-            /* See if it's a .ctrl file                                 */
+            /* See if it's a .job file                                  */
             strcpy(buffer, dirp->d_name);
-            if((chp=strstr(buffer, ".ctrl"))!=NULL)
+            if(((chp=strstr(buffer, ".job"))!=NULL) && !strcmp(chp, ".job"))
             {
                /* Extract the job number from the name                  */
                *chp = '\0';;
                sscanf(buffer,"%lu",&jobnum);
                
+               errno = 0;
                if(GetJobDetails(spoolDir, jobnum, jobfile, &uid, &gid, 
-                                &nice, username))
+                                &nice, username, &priority, 
+                                &firstTask, &lastTask))
                {
                   if(!quiet)
-                     PrintJob(jobnum, jobfile, uid, gid, nice, username);
+                  {
+                     PrintJob(jobnum, jobfile, uid, gid, nice, username,
+                              priority);
+                     if(firstTask)
+                        PrintTasks(spoolDir, jobnum, firstTask, 
+                                   lastTask);
+                     printf("\n");
+                  }
+                  njobs++;
+               }
+               else if(errno == EACCES)
+               {
+                  if(!quiet)
+                     printf("Job number: %ld : (private)\n\n", jobnum);
                   njobs++;
                }
             }
@@ -285,11 +328,125 @@ int DisplayJobs(char *spoolDir, BOOL quiet)
    
    return(njobs);
 }
+
+
+/************************************************************************/
+/*>int DisplayJournalJobs(char *spoolDir, BOOL quiet)
+   --------------------------------------------------
+   Input:   char   *spoolDir    Spool directory with a journal
+            BOOL   quiet        Run quietly
+   Returns: int                 Number of waiting jobs
+
+   Shows the jobs waiting in a journal, in job order. Everything needed
+   is in the journal's index so the job records are not read. Jobs 
+   whose script was private are listed by number only, except to root.
+
+   18.10.26 Original   By: ACRM
+*/
+int DisplayJournalJobs(char *spoolDir, BOOL quiet)
+{
+   JNLENTRY *jobs;
+   ULONG    njobs,
+            i;
+   char     username[MAXBUFF];
+   BOOL     root = RootUser();
+
+   if(((jobs = JournalWaitingJobs(spoolDir, &njobs)) == NULL) || quiet)
+   {
+      if(jobs != NULL)
+         free(jobs);
+      return((int)njobs);
+   }
+
+   for(i=0; i<njobs; i++)
+   {
+      if((jobs[i].flags & JNL_PRIVATE) && !root)
+      {
+         printf("Job number: %ld : (private)\n\n", jobs[i].jobnum);
+         continue;
+      }
+
+      UserGroupName(jobs[i].uid, jobs[i].gid, username);
+      PrintJob(jobs[i].jobnum, 
+               ((jobs[i].flags & JNL_PRIVATE) ? "(private)" : 
+                jobs[i].jobfile),
+               jobs[i].uid, jobs[i].gid, jobs[i].nice, username,
+               jobs[i].priority);
+      if(jobs[i].firstTask)
+         PrintTasks(spoolDir, jobs[i].jobnum, jobs[i].firstTask,
+                    jobs[i].lastTask);
+      printf("\n");
+   }
+
+   free(jobs);
+   return((int)njobs);
+}
+
+
+/************************************************************************/
+/*>void UserGroupName(uid_t uid, gid_t gid, char *username)
+   --------------------------------------------------------
+   Input:   uid_t  uid          A UID
+            gid_t  gid          A GID
+   Output:  char   *username    username:groupname
+
+   18.10.26 Original   By: ACRM (from GetJobDetails())
+*/
+void UserGroupName(uid_t uid, gid_t gid, char *username)
+{
+   struct passwd *pwd;
+   struct group  *grp;
+
+   pwd = getpwuid(uid);
+   grp = getgrgid(gid);
+   sprintf(username,"%s:%s", pwd->pw_name, grp->gr_name);
+}
+
+
+/************************************************************************/
+/*>BOOL PrintLockStats(char *spoolDir)
+   -----------------------------------
+   Input:   char   *spoolDir    Spool directory
+   Returns: BOOL                Success?
+
+   Prints the statistics kept by the lock daemon named in the 
+   .qllockdaemon file
+
+   18.10.26 Original   By: ACRM
+*/
+BOOL PrintLockStats(char *spoolDir)
+{
+#ifdef FILE_BASED_LOCKING
+   fprintf(stderr,"qllist was built to use file based locking\n");
+   return(FALSE);
+#else
+   char lockhost[MAXBUFF];
+   int  port = 0;
+
+   lockhost[0] = '\0';
+   GetPortAndLockHost(spoolDir, &port, lockhost);
+   if(!lockhost[0])
+   {
+      fprintf(stderr,"No .qllockdaemon file in %s\n", spoolDir);
+      return(FALSE);
+   }
+
+   if(!InitLocks("qlite", lockhost, port, "0") || !LockStats(stdout))
+   {
+      fprintf(stderr,"Unable to get statistics from qllockd on %s\n",
+              lockhost);
+      return(FALSE);
+   }
+   CloseLocks();
    
+   return(TRUE);
+#endif
+}
+
 
 /************************************************************************/
 /*>void PrintJob(ULONG jobnum, char *jobfile, uid_t uid, gid_t gid, 
-                 int nice, char *username)
+                 int nice, char *username, int priority)
    -----------------------------------------------------------------
    Input:   ULONG   jobnum    The job number
             char    *jobfile  The name of the original file submitted
@@ -297,22 +454,63 @@ int DisplayJobs(char *spoolDir, BOOL quiet)
             gid_t   gid       The GID
             int     nice      Nice value at which the job is to run
             char    *username Username:groupname of submitter
+            int     priority  Dispatch priority
 
    Prints information about a queued job
 
    18.09.00 Original   By: ACRM
+   18.10.26 Prints the priority if it is not the default
+   18.10.26 The blank line after the job is left to the caller
 */
 void PrintJob(ULONG jobnum, char *jobfile, uid_t uid, gid_t gid, 
-              int nice, char *username)
+              int nice, char *username, int priority)
 {
    printf("Job number: %ld : %s\n", jobnum, jobfile);
    printf("Run for:    %s (%ld:%ld)\n", username, (ULONG)uid, (ULONG)gid);
-   printf("Nice value: %d\n\n", nice);
+   if(priority)
+      printf("Priority:   %d\n", priority);
+   printf("Nice value: %d\n", nice);
+}
+
+
+/************************************************************************/
+/*>void PrintTasks(char *spoolDir, ULONG jobnum, ULONG firstTask, 
+                   ULONG lastTask)
+   ----------------------------------------------------------------
+   Input:   char    *spoolDir  The spool directory
+            ULONG   jobnum     Job number of a job array
+            ULONG   firstTask  First task
+            ULONG   lastTask   Last task
+
+   Prints one line summarising the tasks of a job array: how many are
+   waiting, running and done
+
+   18.10.26 Original   By: ACRM
+*/
+void PrintTasks(char *spoolDir, ULONG jobnum, ULONG firstTask, 
+                ULONG lastTask)
+{
+   ULONG nextTask,
+         nDone,
+         started;
+
+   if(!ReadTaskProgress(spoolDir, jobnum, &nextTask, &nDone) ||
+      (nextTask < firstTask))
+      nextTask = firstTask;
+   if(nextTask > lastTask + 1)
+      nextTask = lastTask + 1;
+   started = nextTask - firstTask;
+   if(nDone > started)
+      nDone = started;
+
+   printf("Tasks:      %lu-%lu (%lu waiting, %lu running, %lu done)\n",
+          firstTask, lastTask, lastTask + 1 - nextTask, started - nDone,
+          nDone);
 }
 
 /************************************************************************/
 /*>BOOL ParseCmdLine(int argc, char **argv, char *spoolDir, int *cluster,
-                     BOOL *totalOnly, BOOL *runningOnly)
+                     BOOL *totalOnly, BOOL *runningOnly, BOOL *lockStats)
    ----------------------------------------------------------------------
    Input:     int    argc          Argument count
               char   *argv         Arguments
@@ -320,14 +518,16 @@ void PrintJob(ULONG jobnum, char *jobfile, uid_t uid, gid_t gid,
               int    *cluster      Cluster number
               BOOL   *totalOnly    Report only the number of jobs
               BOOL   *runningOnly  Report only the running jobs
+              BOOL   *lockStats    Report the lock daemon statistics
    Returns:   BOOL                 Success
 
    Parses the command line
 
    18.09.00 Original  By: ACRM
+   18.10.26 Added -l
 */
 BOOL ParseCmdLine(int argc, char **argv, char *spoolDir, int *cluster,
-                  BOOL *totalOnly, BOOL *runningOnly)
+                  BOOL *totalOnly, BOOL *runningOnly, BOOL *lockStats)
 {
    argc--;
    argv++;
@@ -359,6 +559,9 @@ BOOL ParseCmdLine(int argc, char **argv, char *spoolDir, int *cluster,
          case 'r':
             *runningOnly = TRUE;
             break;
+         case 'l':
+            *lockStats = TRUE;
+            break;
          default:
             return(FALSE);
             break;
@@ -382,7 +585,8 @@ BOOL ParseCmdLine(int argc, char **argv, char *spoolDir, int *cluster,
 /************************************************************************/
 /*>BOOL GetJobDetails(char *spoolDir, ULONG jobnum, char *jobfile,
                       uid_t *uid, gid_t *gid, int *nice,
-                      char *username)
+                      char *username, int *priority, ULONG *firstTask,
+                      ULONG *lastTask)
    ---------------------------------------------------------------
    Input:     char  *spoolDir   The spool directory
               ULONG jobnum      A job number
@@ -391,80 +595,59 @@ BOOL ParseCmdLine(int argc, char **argv, char *spoolDir, int *cluster,
               gid_t *gid        The GID
               int   *nice       The requested nice level
               char  *username   Username derived from the UID
+              int   *priority   The dispatch priority
+              ULONG *firstTask  First task of a job array (0 if none)
+              ULONG *lastTask   Last task of a job array
    Returns:   BOOL              Success?
 
    Gets the info on the job (user who submitted it, nice level and
-   username:groupname) from a job control file in the spool directory
+   username:groupname) from a job record in the spool directory
 
    18.09.00 Original  By: ACRM
+   18.10.26 Added priority
+   18.10.26 Added firstTask and lastTask
+   18.10.26 Reads the header of a job record with ReadJobRecord()
 */
 BOOL GetJobDetails(char *spoolDir, ULONG jobnum, char *jobfile,
                    uid_t *uid, gid_t *gid, int *nice,
-                   char *username)
+                   char *username, int *priority, ULONG *firstTask,
+                   ULONG *lastTask)
 {
-   char  buffer[MAXBUFF],
-         jobname[PATH_MAX],
-         junk[16];
-   FILE  *fp;
-   ULONG tmp;
+   char  buffer[PATH_MAX+MAXBUFF];
+   JOBRECORD rec;
    struct stat statbuff;
-   struct passwd *pwd;
-   struct group  *grp;
    
    
-   /* Create the name of the control file                               */
-   sprintf(buffer,"%s/%ld.ctrl", spoolDir, jobnum);
+   /* Create the name of the job record                                 */
+   sprintf(buffer,"%s/%ld.job", spoolDir, jobnum);
 
-   /* Check that the control file is owned by root                      */
-   stat(buffer, &statbuff);
-   if((statbuff.st_uid != (uid_t)0) || (statbuff.st_gid != (gid_t)0))
+   /* Check that the job record is owned by root                        */
+   if(!stat(buffer, &statbuff) && (statbuff.st_uid != (uid_t)0))
    {
-      fprintf(stderr,"Warning: Control file not owned by root! %s\n",
+      fprintf(stderr,"Warning: Job record not owned by root! %s\n",
               buffer);
    }
 
-   /* Open it for reading                                               */
-   if((fp=fopen(buffer,"r"))==NULL)
+   if(!ReadJobRecord(buffer, &rec))
       return(FALSE);
 
-   while(fgets(buffer, MAXBUFF, fp))
-   {
-      TERMINATE(buffer);
-      if(buffer[0] == 'U')
-      {
-         sscanf(buffer,"%s %lu", junk, &tmp);
-         *uid = (uid_t)tmp;
-      }
-      else if(buffer[0] == 'G')
-      {
-         sscanf(buffer,"%s %lu", junk, &tmp);
-         *gid = (gid_t)tmp;
-      }
-      else if(buffer[0] == 'N')
-      {
-         sscanf(buffer,"%s %lu", junk, &tmp);
-         *nice = (int)tmp;
-      }
-      else if(buffer[0] == 'J')
-      {
-         sscanf(buffer,"%s %s", junk, jobfile);
-      }
-   }
-   fclose(fp);
-
+   strcpy(jobfile, rec.jobfile);
+   *uid       = rec.uid;
+   *gid       = rec.gid;
+   *nice      = rec.nice;
+   *priority  = rec.priority;
+   *firstTask = rec.firstTask;
+   *lastTask  = rec.lastTask;
 
    /* Make sure that we aren't trying to run anything as root           */
    if((*uid == (uid_t)0) || (*gid == (gid_t)0))
    {
-      sprintf(buffer,"%s/%s.ctrl", spoolDir, jobname);
       fprintf(stderr,"Warning: Attempt to run job as root! %s\n",
               buffer);
    }
 
    /* Get the username:groupname from the numeric versions              */
-   pwd = getpwuid(*uid);
-   grp = getgrgid(*gid);
-   sprintf(username,"%s:%s", pwd->pw_name, grp->gr_name);
+   UserGroupName(*uid, *gid, username);
       
    return(TRUE);
 }
@@ -548,15 +731,17 @@ void PrintRunningJobs(FILE *out, RUNFILE *runfiles)
 void Usage(void)
 {
 
-   fprintf(stderr,"\nqllist V1.0 (c) 2000 University of Reading, Dr. \
+   fprintf(stderr,"\nqllist V1.2 (c) 2000 University of Reading, Dr. \
 Andrew C.R. Martin\n");
 
-   fprintf(stderr,"\nUsage: qllist [-t] [-s spooldir] [-c cluster]\n");
+   fprintf(stderr,"\nUsage: qllist [-t] [-r] [-l] [-s spooldir] \
+[-c cluster]\n");
    fprintf(stderr,"              -t Print totals only\n");
    fprintf(stderr,"              -s Specify the spool directory\n");
    fprintf(stderr,"                 (Default: %s)\n", DEF_SPOOLDIR);
    fprintf(stderr,"              -c Specify the cluster number\n");
    fprintf(stderr,"              -r View only running jobs\n");
+   fprintf(stderr,"              -l Show the lock daemon statistics\n");
 
    fprintf(stderr,"\nqllist lists jobs in the QLite queues. By default \
 it will list jobs for\n");
@@ -0,0 +1,508 @@
+/*************************************************************************
+
+   Program:    qllockbench
+   File:       qllockbench.c
+
+   Version:    V1.1
+   Date:       18.10.26
+   Function:   Load generator for measuring the qllockd lock daemon
+
+   Copyright:  (c) University of Reading / Dr. Andrew C. R. Martin 2026
+   Author:     Dr. Andrew C. R. Martin
+   Address:    School of Animal and Microbial Sciences,
+               The University of Reading,
+               Whiteknights,
+               P.O. Box 228,
+               Reading RG6 6AJ.
+               England.
+   Phone:      +44 (0)118 987 5123 Extn. 7022
+   Fax:        +44 (0)118 931 0180
+   EMail:      andrew@bioinf.org.uk
+               andrew@stagleys.demon.co.uk
+
+**************************************************************************
+
+   This program is not in the public domain.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+   See the file COPYING.DOC for details of what you may and may not
+   do with this program.
+
+   In particular, you may not distribute this code without express
+   permission from the author; it must be obtained directly from the
+   author.
+
+**************************************************************************
+
+   Description:
+   ============
+   Forks a number of simulated clients which each repeatedly get and
+   release a lock from qllockd using the same client code as qlsubmit
+   and qlrun. The time taken by each GetLock() is recorded and the
+   overall throughput and latency percentiles are reported.
+
+**************************************************************************
+
+   Usage:
+   ======
+   Run qllockd on the local machine with 127.0.0.1 (or localhost)
+   listed in .machinelist and then run, for example,
+      qllockbench -n 16 -c 5000
+
+**************************************************************************
+
+   Revision History:
+   =================
+   V1.0  18.10.26  Original   By: ACRM
+   V1.1  18.10.26  A client which can't connect counts all its cycles as
+                   failed
+
+*************************************************************************/
+/* Includes
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#  include <linux/limits.h>
+#else
+#  include <limits.h>
+#endif
+
+#include "qlutil.h"
+
+/************************************************************************/
+/* Defines and macros
+*/
+#define DEF_CLIENTS 8         /* Default number of simulated clients    */
+#define DEF_CYCLES  1000      /* Default lock cycles per client         */
+#define DEF_HOST    "127.0.0.1"
+#define BENCH_LOCK  "bench"   /* Lock name so real clusters are left
+                                 alone                                  */
+
+/************************************************************************/
+/* Globals
+*/
+
+/************************************************************************/
+/* Prototypes
+*/
+int main(int argc, char **argv);
+BOOL ParseCmdLine(int argc, char **argv, int *nclients, int *ncycles,
+                  char *lockhost, int *port, char *lockName,
+                  int *mode);
+void RunClient(int id, int ncycles, int goPipe, int resultPipe,
+               char *lockhost, int port, char *lockName, int mode);
+ULONG ReadResults(int fd, ULONG *latencies, ULONG maxResults,
+                  ULONG *nfailed);
+ULONG Percentile(ULONG *latencies, ULONG n, double percent);
+double Now(void);
+int CompareLatencies(const void *a, const void *b);
+void Usage(void);
+
+
+/************************************************************************/
+/*>int main(int argc, char **argv)
+   -------------------------------
+   Main program for the lock daemon benchmark. Each client is started
+   and connects to qllockd before any of them begins, so the time
+   measured is only that taken getting and releasing the lock.
+
+   18.10.26 Original   By: ACRM
+*/
+int main(int argc, char **argv)
+{
+   int    nclients = DEF_CLIENTS,
+          ncycles  = DEF_CYCLES,
+          port     = 0,
+          mode     = LOCK_EXCLUSIVE,
+          goPipe[2],
+          *resultPipes,
+          i;
+   char   lockhost[MAXBUFF],
+          lockName[MAXLOCKNAME];
+   ULONG  *latencies,
+          nresults = 0,
+          nfailed  = 0,
+          total;
+   double start,
+          elapsed;
+
+   strcpy(lockhost, DEF_HOST);
+   strcpy(lockName, BENCH_LOCK);
+
+   if(!ParseCmdLine(argc, argv, &nclients, &ncycles, lockhost, &port,
+                    lockName, &mode))
+   {
+      Usage();
+      return(0);
+   }
+
+   total = (ULONG)nclients * ncycles;
+   if(((latencies = (ULONG *)malloc(total * sizeof(ULONG))) == NULL) ||
+      ((resultPipes = (int *)malloc(nclients * sizeof(int))) == NULL))
+   {
+      fprintf(stderr,"qllockbench: No memory for %lu results\n", total);
+      return(1);
+   }
+
+   /* The clients wait until this pipe is closed before starting        */
+   if(pipe(goPipe) < 0)
+   {
+      perror("qllockbench");
+      return(1);
+   }
+
+   for(i=0; i<nclients; i++)
+   {
+      int result[2];
+
+      if(pipe(result) < 0)
+      {
+         perror("qllockbench");
+         return(1);
+      }
+
+      switch(fork())
+      {
+      case -1:
+         perror("qllockbench");
+         return(1);
+      case 0:
+         close(goPipe[1]);
+         close(result[0]);
+         RunClient(i+1, ncycles, goPipe[0], result[1], lockhost, port,
+                   lockName, mode);
+         _exit(0);
+      default:
+         close(result[1]);
+         resultPipes[i] = result[0];
+         break;
+      }
+   }
+
+   /* Give the clients time to connect and then let them all go        */
+   close(goPipe[0]);
+   sleep(1);
+   start = Now();
+   close(goPipe[1]);
+
+   /* Each client sends its results when it has finished               */
+   for(i=0; i<nclients; i++)
+   {
+      nresults += ReadResults(resultPipes[i], latencies + nresults,
+                              total - nresults, &nfailed);
+      close(resultPipes[i]);
+   }
+   elapsed = Now() - start;
+
+   while(wait(NULL) > 0);
+
+   qsort(latencies, nresults, sizeof(ULONG), CompareLatencies);
+
+   printf("qllockbench: %d clients x %d cycles, %s lock %s on %s\n",
+          nclients, ncycles,
+          ((mode == LOCK_SHARED) ? "shared" : "exclusive"),
+          lockName, lockhost);
+   printf("Completed:   %lu cycles in %.3f s (%.0f cycles/s)\n",
+          nresults, elapsed,
+          ((elapsed > 0.0) ? (double)nresults / elapsed : 0.0));
+   printf("Failed:      %lu\n", nfailed);
+   if(nresults)
+   {
+      printf("Acquire latency (usec): p50 %lu  p99 %lu  p999 %lu  \
+max %lu\n",
+             Percentile(latencies, nresults, 50.0),
+             Percentile(latencies, nresults, 99.0),
+             Percentile(latencies, nresults, 99.9),
+             latencies[nresults-1]);
+   }
+
+   return((nfailed || (nresults == 0)) ? 1 : 0);
+}
+
+
+/************************************************************************/
+/*>void RunClient(int id, int ncycles, int goPipe, int resultPipe,
+                  char *lockhost, int port, char *lockName, int mode)
+   ------------------------------------------------------------------
+   Input:     int    id          Instance ID to use for the lock
+              int    ncycles     Number of times to get the lock
+              int    goPipe      Closed by the parent to start us
+              int    resultPipe  Where to send the results
+              char   *lockhost   Machine running qllockd
+              int    port        qllockd port (0 for the default)
+              char   *lockName   Lock to use
+              int    mode        LOCK_EXCLUSIVE or LOCK_SHARED
+
+   One simulated client. Gets and releases the lock ncycles times and
+   writes the time taken by each successful GetLock() in microseconds
+   down the pipe, with 0 marking a failure. A client which can't reach
+   qllockd still sends ncycles results so that all its cycles are
+   counted as failed.
+
+   18.10.26 Original   By: ACRM
+   18.10.26 Reports every cycle as failed if it can't connect
+*/
+void RunClient(int id, int ncycles, int goPipe, int resultPipe,
+               char *lockhost, int port, char *lockName, int mode)
+{
+   ULONG  *latencies,
+          failed    = 0;
+   double start;
+   char   c;
+   BOOL   connected = TRUE;
+   int    i;
+
+   if((latencies = (ULONG *)calloc(ncycles, sizeof(ULONG))) == NULL)
+   {
+      for(i=0; i<ncycles; i++)
+         write(resultPipe, &failed, sizeof(ULONG));
+      close(resultPipe);
+      return;
+   }
+
+   /* Connect now so that it is not counted in the first cycle         */
+   if(!InitLocks("qlite", lockhost, port, lockName) ||
+      (LockStatus() < 0))
+   {
+      fprintf(stderr,"qllockbench: Client %d can't talk to qllockd\n",
+              id);
+      connected = FALSE;
+   }
+
+   /* Wait to be started                                                */
+   read(goPipe, &c, 1);
+   close(goPipe);
+
+   for(i=0; connected && (i<ncycles); i++)
+   {
+      start = Now();
+      if(GetLock(id, LOCK_TIMEOUT, mode) != 0)
+         continue;
+      latencies[i] = (ULONG)((Now() - start) * 1000000.0) + 1;
+
+      if(!ReleaseLock(id))
+         latencies[i] = 0;
+   }
+   CloseLocks();
+
+   write(resultPipe, latencies, ncycles * sizeof(ULONG));
+   close(resultPipe);
+}
+
+
+/************************************************************************/
+/*>ULONG ReadResults(int fd, ULONG *latencies, ULONG maxResults,
+                     ULONG *nfailed)
+   -------------------------------------------------------------
+   Input:     int    fd          Pipe from a client
+              ULONG  maxResults  Space left in latencies
+   Output:    ULONG  *latencies  Successful latencies (usec)
+   I/O:       ULONG  *nfailed    Count of failed cycles
+   Returns:   ULONG              Number of successful latencies read
+
+   Reads the results sent by one client
+
+   18.10.26 Original   By: ACRM
+*/
+ULONG ReadResults(int fd, ULONG *latencies, ULONG maxResults,
+                  ULONG *nfailed)
+{
+   ULONG value,
+         n = 0;
+
+   while((n < maxResults) &&
+         (read(fd, &value, sizeof(ULONG)) == sizeof(ULONG)))
+   {
+      if(value)
+         latencies[n++] = value;
+      else
+         (*nfailed)++;
+   }
+   return(n);
+}
+
+
+/************************************************************************/
+/*>ULONG Percentile(ULONG *latencies, ULONG n, double percent)
+   -----------------------------------------------------------
+   Input:     ULONG  *latencies  Sorted latencies
+              ULONG  n           Number of latencies
+              double percent     Percentile required
+   Returns:   ULONG              Latency at that percentile
+
+   Nearest rank percentile
+
+   18.10.26 Original   By: ACRM
+*/
+ULONG Percentile(ULONG *latencies, ULONG n, double percent)
+{
+   ULONG rank;
+
+   rank = (ULONG)((percent / 100.0) * n + 0.999999);
+   if(rank < 1)
+      rank = 1;
+   if(rank > n)
+      rank = n;
+   return(latencies[rank-1]);
+}
+
+
+/************************************************************************/
+/*>double Now(void)
+   ----------------
+   Returns:   double           Seconds from an arbitrary start
+
+   18.10.26 Original   By: ACRM
+*/
+double Now(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return((double)ts.tv_sec + (double)ts.tv_nsec / 1.0e9);
+}
+
+
+/************************************************************************/
+/*>int CompareLatencies(const void *a, const void *b)
+   --------------------------------------------------
+   qsort() comparison function for latencies
+
+   18.10.26 Original   By: ACRM
+*/
+int CompareLatencies(const void *a, const void *b)
+{
+   ULONG la = *(const ULONG *)a,
+         lb = *(const ULONG *)b;
+
+   return((la < lb) ? -1 : ((la > lb) ? 1 : 0));
+}
+
+
+/************************************************************************/
+/*>BOOL ParseCmdLine(int argc, char **argv, int *nclients, int *ncycles,
+                     char *lockhost, int *port, char *lockName,
+                     int *mode)
+   ---------------------------------------------------------------------
+   Input:     int    argc        Argument count
+              char   **argv      Arguments
+   Output:    int    *nclients   Number of simulated clients
+              int    *ncycles    Lock cycles per client
+              char   *lockhost   Machine running qllockd
+              int    *port       qllockd port
+              char   *lockName   Lock to use
+              int    *mode       LOCK_EXCLUSIVE or LOCK_SHARED
+   Returns:   BOOL               Success?
+
+   Parses the command line
+
+   18.10.26 Original   By: ACRM
+*/
+BOOL ParseCmdLine(int argc, char **argv, int *nclients, int *ncycles,
+                  char *lockhost, int *port, char *lockName,
+                  int *mode)
+{
+   argc--;
+   argv++;
+
+   while(argc)
+   {
+      if(argv[0][0] == '-')
+      {
+         switch(argv[0][1])
+         {
+         case 'n':
+            argv++;
+            argc--;
+            if(!argc || !sscanf(argv[0],"%d", nclients) ||
+               (*nclients < 1))
+               return(FALSE);
+            break;
+         case 'c':
+            argv++;
+            argc--;
+            if(!argc || !sscanf(argv[0],"%d", ncycles) ||
+               (*ncycles < 1))
+               return(FALSE);
+            break;
+         case 'l':
+            argv++;
+            argc--;
+            if(!argc)
+               return(FALSE);
+            strncpy(lockhost, argv[0], MAXBUFF-1);
+            lockhost[MAXBUFF-1] = '\0';
+            break;
+         case 'p':
+            argv++;
+            argc--;
+            if(!argc || !sscanf(argv[0],"%d", port))
+               return(FALSE);
+            break;
+         case 'L':
+            argv++;
+            argc--;
+            if(!argc || (strlen(argv[0]) >= MAXLOCKNAME))
+               return(FALSE);
+            strcpy(lockName, argv[0]);
+            break;
+         case 'S':
+            *mode = LOCK_SHARED;
+            break;
+         default:
+            return(FALSE);
+            break;
+         }
+      }
+      else
+      {
+         return(FALSE);
+      }
+
+      argc--;
+      argv++;
+   }
+
+   return(TRUE);
+}
+
+
+/************************************************************************/
+void Usage(void)
+{
+   fprintf(stderr,"\nqllockbench V1.1 (c) Dr. Andrew C.R. Martin, \
+University of Reading\n");
+
+   fprintf(stderr,"\nUsage: qllockbench [-n clients] [-c cycles] \
+[-l lockhost] [-p port]\n");
+   fprintf(stderr,"                   [-L lockname] [-S]\n");
+   fprintf(stderr,"       -n Number of simulated clients (Default: %d)\n",
+           DEF_CLIENTS);
+   fprintf(stderr,"       -c Lock cycles for each client (Default: %d)\n",
+           DEF_CYCLES);
+   fprintf(stderr,"       -l Machine running qllockd (Default: %s)\n",
+           DEF_HOST);
+   fprintf(stderr,"       -p Port qllockd listens on\n");
+   fprintf(stderr,"       -L Name of the lock to use (Default: %s)\n",
+           BENCH_LOCK);
+   fprintf(stderr,"       -S Use shared rather than exclusive locks\n");
+
+   fprintf(stderr,"\nqllockbench measures how many lock round trips \
+qllockd can sustain.\n");
+   fprintf(stderr,"Each client repeatedly gets and releases the lock \
+and the throughput\n");
+   fprintf(stderr,"and the 50th, 99th and 99.9th percentile times to \
+get the lock are\n");
+   fprintf(stderr,"reported. The machine running qllockbench must be \
+listed in\n");
+   fprintf(stderr,".machinelist for the lock daemon.\n\n");
+}
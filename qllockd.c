@@ -3,8 +3,8 @@
    Program:    qllockd
    File:       qllockd.c
    
-   Version:    V1.1
-   Date:       25.11.02
+   Version:    V1.23
+   Date:       18.10.26
    Function:   Daemon to handle locking between machines in the cluster
    
    Copyright:  (c) University of Reading / Dr. Andrew C. R. Martin 2000-2
@@ -51,6 +51,47 @@
    =================
    V1.0  04.10.00  Original   By: ACRM
    V1.1  25.11.02  Added code to allow a SIGHUP to break a stuck lock
+   V1.2  18.10.26  Rewritten around an epoll() event loop so that a slow
+                   or stalled client can no longer block other clients
+   V1.3  18.10.26  Added WAITLOCK which queues clients in FIFO order and
+                   grants the lock down the open connection on release
+   V1.4  18.10.26  Added SESSION for persistent connections which may
+                   send any number of commands
+   V1.5  18.10.26  Locks are granted as leases which expire unless they
+                   are renewed with RENEW
+   V1.6  18.10.26  Keeps an index of queued jobs for each cluster and 
+                   hands them out with DEQUEUE. Added -s
+   V1.7  18.10.26  Machine list is resolved to addresses once into a hash
+                   table rather than doing a reverse lookup on every
+                   connection. SIGUSR1 re-reads it.
+   V1.8  18.10.26  Keeps a table of independently named locks so that
+                   one daemon can serve every cluster. Lock commands
+                   take LOCK name (default "0")
+   V1.9  18.10.26  Locks may be taken in shared (MODE SHARED) as well
+                   as exclusive mode
+   V1.10 18.10.26  Keeps counters and latency histograms which are 
+                   returned by STATS
+   V1.11 18.10.26  DEQUEUE WAIT parks an idle qlrun until a job is 
+                   enqueued for its cluster
+   V1.12 18.10.26  DEQUEUE MAX hands out a batch of jobs at once
+   V1.13 18.10.26  Job index is a heap so DEQUEUE always takes the
+                   lowest job number in O(log n)
+   V1.14 18.10.26  ENQUEUE takes a PRIORITY and DEQUEUE hands out the 
+                   highest priority job first
+   V1.15 18.10.26  Job arrays. ENQUEUE takes a range of TASKS which are
+                   handed out one at a time by DEQUEUE as job:task
+   V1.16 18.10.26  Added NEXTID and NEXTIDS which hand out job numbers
+                   from a counter for each cluster
+   V1.17 18.10.26  Reads the job index from single N.job records
+   V1.18 18.10.26  Reads a cluster's journal index if it has one
+   V1.19 18.10.26  Refuses to start if the machine lists give no hosts
+   V1.20 18.10.26  A job pushed by ENQUEUE is only taken from the queue if
+                   the reply reaches a live qlrun. Replies no longer raise
+                   SIGPIPE
+   V1.21 18.10.26  Rescans the spool every RESCAN_SECS seconds and on
+                   SIGUSR1 for jobs which were never enqueued
+   V1.22 18.10.26  IssueJobIds() refuses once job numbers would wrap round
+   V1.23 18.10.26  Signal handlers no longer leave signum unused
 
 *************************************************************************/
 /* Includes
@@ -61,11 +102,15 @@
 #include <ctype.h>
 #include <unistd.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <time.h>
 #define __STRICT_ANSI__
 #include <netdb.h>
 #undef __STRICT_ANSI__
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
 #include <arpa/inet.h>
 #ifdef __linux__
 #  include <linux/limits.h>
@@ -73,6 +118,7 @@
 #  include <limits.h>
 #endif
 #include <errno.h>
+#include <dirent.h>
 
 #include "qlutil.h"
 
@@ -83,15 +129,149 @@
 #define SERVICENAME "qlite"
 
 #define STATUS_UNLOCKED 0
-#define STATUS_LOCKED   1
+#define STATUS_LOCKED   1  /* Held exclusively                          */
+#define STATUS_SHARED   2  /* Held by one or more shared holders        */
+
+#define MAXEVENTS    64    /* Max events handled per epoll_wait()       */
+#define TICK_MSEC    1000  /* epoll_wait() timeout for housekeeping     */
+#define CONN_TIMEOUT 30    /* Seconds before an idle client is dropped  */
+#define HOSTHASHBITS 10   
+#define HOSTHASHSIZE (1 << HOSTHASHBITS) /* Buckets in allowed host table */
+#define MAX_LEASE    3600  /* Longest lease a client may ask for        */
+#define RESCAN_SECS  300   /* Seconds between rescans of the spool      */
+#define RESCAN_AGE   120   /* Age at which a record is surely submitted */
+#define JNL_SEGMENT  "seg.%lu" /* Journal segment, as named by qljournal*/
+#define LOCKHASHSIZE 64    /* Buckets in the lock table                 */
+#define DEFAULT_LOCK "0"   /* Lock used when a client names none        */
+#define NHIST        20    /* Buckets in the latency histograms         */
+#define RATEWINDOW   60    /* Seconds over which connection rate is
+                              averaged                                  */
+#define STATSBUFF    8192  /* Space for a STATS reply                   */
+#define MAX_IDLEWAIT 3600  /* Longest a DEQUEUE WAIT may be parked      */
+#define ID_BATCH     1000  /* Job numbers reserved on disk at a time    */
+#define MAX_IDS      1000000 /* Most job numbers taken by one NEXTIDS   */
+
+#define CONN_COMMAND 0     /* Waiting for a command                     */
+#define CONN_DRAIN   1     /* Command handled, mopping up until close   */
+#define CONN_DEAD    2     /* Closed, waiting to be freed               */
+#define CONN_WAITING 3     /* Queued in WAITLOCK for the lock           */
+#define CONN_IDLE    4     /* Parked in DEQUEUE WAIT for a job          */
+
+typedef struct _allowedhost
+{
+   struct _allowedhost *next;
+   in_addr_t addr;         /* Address in network byte order             */
+   char      name[MAXBUFF];
+}  ALLOWEDHOST;
+
+typedef struct
+{
+   ALLOWEDHOST *buckets[HOSTHASHSIZE];
+   int         nhosts;
+}  HOSTTABLE;
+
+typedef struct
+{
+   ULONG  jobnum,
+          task,            /* Next task of a job array (0 if not one)   */
+          lastTask;        /* Last task of a job array                  */
+   int    priority;
+}  QUEUEDJOB;
+
+typedef struct
+{
+   QUEUEDJOB *jobs;        /* Binary heap of queued jobs, CompareJobs() 
+                              order                                     */
+   struct _connection *idleHead,  /* FIFO of qlruns waiting for a job   */
+                      *idleTail;
+   ULONG  lastId,          /* Last job number handed out by NEXTIDS     */
+          idCeiling;       /* Value saved in .qllastjob (0 until read)  */
+   int    njobs,
+          size;
+}  JOBQUEUE;
+
+typedef struct _connection
+{
+   struct _connection *next;
+   struct _connection *nextWaiter; /* Next in lock or idle queue        */
+   struct _lock       *waitLock;   /* Lock we are queued for            */
+   ULONG  waitStart;               /* When we were queued (msec)        */
+   BOOL   session;
+   int    sock,
+          state,
+          nline,
+          waitID,
+          waitTTL,
+          waitMode,
+          idleCluster;             /* Cluster we are parked on          */
+   time_t lastActive,
+          idleUntil;               /* When to give up and reply NONE    */
+   char   line[MAXBUFF],
+          hostname[MAXBUFF];
+}  CONNECTION;
+
+typedef struct _holder
+{
+   struct _holder *next;
+   CONNECTION     *conn;         /* Session holding the lock, if any  */
+   ULONG  grantedAt;             /* When the lock was granted (msec)  */
+   int    clientID,
+          leaseTTL,
+          mode;
+   time_t leaseExpiry;
+   char   hostname[MAXBUFF];
+}  HOLDER;
+
+typedef struct _lock
+{
+   struct _lock *next;
+   CONNECTION   *waitHead,       /* FIFO queue of WAITLOCK clients    */
+                *waitTail;
+   HOLDER       *holders;        /* One if exclusive, any if shared   */
+   int          status;
+   char         name[MAXLOCKNAME];
+}  LOCK;
+
+typedef struct
+{
+   ULONG  count,
+          total,                 /* All times are in msec             */
+          max,
+          bucket[NHIST];         /* Bucket n counts times below 2^n   */
+}  HISTOGRAM;
+
+typedef struct
+{
+   time_t    started,
+             rateTime[RATEWINDOW];
+   ULONG     connections,
+             rejected,
+             grants,
+             denials,
+             queued,
+             cancels,
+             releases,
+             expiries,
+             closes,
+             breaks,
+             rateCount[RATEWINDOW];
+   HISTOGRAM hold,
+             wait;
+}  STATISTICS;
 
 /************************************************************************/
 /* Globals
 */
-char gLockholder[MAXBUFF];
-int  gClientID = 0,
-     gDebug    = 0,
-     gStatus   = STATUS_UNLOCKED;
+int  gDebug    = 0;
+LOCK *gLocks[LOCKHASHSIZE];
+JOBQUEUE gQueues[MAXCLUSTER+1];
+CONNECTION *gConnections = NULL;
+STATISTICS gStats;
+HOSTTABLE *gAllowedHosts = NULL;
+char gSpoolDir[PATH_MAX];
+volatile sig_atomic_t gBreakLock = 0,
+                      gReload    = 0,
+                      gRescan    = 0;
 
 
 /************************************************************************/
@@ -101,14 +281,63 @@ int main(int argc, char **argv);
 void error(void);
 BOOL ParseCmdLine(int argc, char **argv, char *spooldir, int *port);
 int CreateBoundListeningSocket(char *service, int port);
-BOOL ValidMachine(RUNFILE *runfiles, int socket, 
-                  struct sockaddr_in client, char *hostname);
-int AcceptConnections(RUNFILE *runfiles, int s);
-void HandleCommand(int sock, char *line, char *clientHostname);
-BOOL CorrectMachine(char *clientHostname, int clientID);
+BOOL ValidMachine(struct sockaddr_in client, char *hostname);
+int AcceptConnections(char *spoolDir, int s);
+void NewConnections(int epfd, int s);
+void ReadConnection(int epfd, CONNECTION *conn);
+void HandleChar(int epfd, CONNECTION *conn, char c);
+void CloseConnection(int epfd, CONNECTION *conn);
+void DropIdleConnections(int epfd);
+void FreeDeadConnections(void);
+BOOL SetNonBlocking(int sock);
+BOOL SendReply(CONNECTION *conn, char *reply);
+BOOL PeerAlive(CONNECTION *conn);
+void HandleCommand(int epfd, CONNECTION *conn, char *line);
+BOOL ParseLockArgs(char *line, int *id, int *ttl, int *mode, 
+                   char *lockName);
+BOOL ParseDequeueArgs(char *line, int *cluster, int *wait, int *maxjobs);
+BOOL ParseEnqueueArgs(char *line, int *cluster, ULONG *jobnum, 
+                      int *priority, ULONG *firstTask, ULONG *lastTask);
+LOCK *FindLock(char *name);
+int HashLockName(char *name);
+BOOL CanGrant(LOCK *lock, int mode);
+void GrantLock(LOCK *lock, CONNECTION *conn, int id, int ttl, int mode);
+void ReleaseHolder(LOCK *lock, HOLDER *holder);
+void ExpireLease(void);
+void GrantNextWaiter(LOCK *lock);
+BOOL RemoveWaiter(CONNECTION *conn);
+void BreakLock(void);
+HOLDER *FindHolder(LOCK *lock, CONNECTION *conn, int clientID);
+ULONG NowMsec(void);
+void AddToHistogram(HISTOGRAM *hist, ULONG msec);
+void CountConnection(void);
+void SendStats(CONNECTION *conn);
+char *FormatHistogram(char *buffer, char *name, HISTOGRAM *hist);
 void Usage(void);
-void WaitForOtherChars(int sock);
 void HandleHUP(int signum);
+void HandleUSR1(int signum);
+HOSTTABLE *BuildHostTable(char *spoolDir);
+BOOL AddMachineList(HOSTTABLE *table, char *spoolDir);
+void FreeHostTable(HOSTTABLE *table);
+BOOL AddHost(HOSTTABLE *table, in_addr_t addr, char *name);
+ALLOWEDHOST *FindHost(HOSTTABLE *table, in_addr_t addr);
+int HashAddress(in_addr_t addr);
+void ReloadMachineList(char *spoolDir);
+void ScanSpool(char *spoolDir, BOOL rescan);
+void IndexSpoolJob(int cluster, char *dirName, ULONG jobnum, 
+                   int priority, ULONG firstTask, ULONG lastTask,
+                   BOOL rescan);
+ULONG *IndexedJobs(int cluster, int *nknown);
+int CompareJobnums(const void *a, const void *b);
+BOOL Unindexed(ULONG jobnum, char *file, time_t before, ULONG *known, 
+               int nknown);
+BOOL AddToQueue(int cluster, ULONG jobnum, int priority, 
+                ULONG firstTask, ULONG lastTask);
+ULONG TakeFromQueue(int cluster, ULONG *task);
+void ParkConnection(CONNECTION *conn, int cluster, int wait);
+BOOL UnparkConnection(CONNECTION *conn);
+int CompareJobs(const void *a, const void *b);
+BOOL IssueJobIds(int cluster, ULONG njobs, ULONG *firstJob);
 
 
 /************************************************************************/
@@ -117,7 +346,6 @@ int main(int argc, char **argv)
    int port = 0, 
        s, err;
    char spoolDir[PATH_MAX];
-   RUNFILE *runfiles = NULL;
 
    strcpy(spoolDir, DEF_SPOOLDIR);
 
@@ -132,20 +360,33 @@ int main(int argc, char **argv)
       else
 #endif
       {
+         /* With no machines to serve, every client would be turned 
+            away
+         */
+         if((gAllowedHosts = BuildHostTable(spoolDir)) == NULL)
+         {
+            fprintf(stderr,"qllockd: No machines found in the machine \
+list(s) in %s\n", spoolDir);
+            return(1);
+         }
+
          if(!gDebug)
             DaemonInit();
          
-         runfiles = ReadMachineList(spoolDir);
+         ScanSpool(spoolDir, FALSE);
+         strcpy(gSpoolDir, spoolDir);
+         time(&(gStats.started));
          
          if((s = CreateBoundListeningSocket(SERVICENAME, port)) < 0)
             error();
 
-         /* Install signal handler */
-         signal(SIGHUP, HandleHUP);
+         /* Install signal handlers                                     */
+         signal(SIGHUP,  HandleHUP);
+         signal(SIGUSR1, HandleUSR1);
          
-         if((err=AcceptConnections(runfiles, s)) < 0)
+         if((err=AcceptConnections(spoolDir, s)) < 0)
          {
-            fprintf(stderr,"accept() failed!, Error %d\n", errno);
+            fprintf(stderr,"Event loop failed!, Error %d\n", errno);
             perror(NULL);
          }
       }
@@ -204,356 +445,2525 @@ int CreateBoundListeningSocket(char *service, int port)
 }
 
 /************************************************************************/
-int AcceptConnections(RUNFILE *runfiles, int s)
+/*>int AcceptConnections(char *spoolDir, int s)
+   --------------------------------------------
+   Input:     char     *spoolDir   Spool directory (for the machine list)
+              int      s           Listening socket
+   Returns:   int                  Only returns (<0) on failure
+
+   The main event loop. All sockets are non-blocking and are watched with
+   epoll() so that no single client can hold up the others. Once a
+   second (or whenever there is activity) clients which have been idle
+   for more than CONN_TIMEOUT seconds are dropped. Every RESCAN_SECS
+   seconds, or on SIGUSR1, the spool is rescanned for jobs which were
+   never enqueued.
+
+   04.10.00 Original   By: ACRM
+   18.10.26 Rewritten as an epoll() event loop
+   18.10.26 Rescans the spool
+*/
+int AcceptConnections(char *spoolDir, int s)
 {
-   struct sockaddr_in client;
-   unsigned int       len;
-   int                g, i;
-   char               c, 
-                      line[MAXBUFF],
-                      clientHostname[MAXBUFF];
+   struct epoll_event ev,
+                      events[MAXEVENTS];
+   int                epfd, 
+                      nev, 
+                      i;
+   CONNECTION         *conn;
+   time_t             nextScan = time(NULL) + RESCAN_SECS;
    
+   if((epfd = epoll_create(MAXEVENTS)) < 0)
+      return(epfd);
+
+   if(!SetNonBlocking(s))
+      return(-1);
+
+   /* The listening socket is flagged by a NULL data pointer            */
+   ev.events   = EPOLLIN;
+   ev.data.ptr = NULL;
+   if(epoll_ctl(epfd, EPOLL_CTL_ADD, s, &ev) < 0)
+      return(-1);
    
    for (;;) 
    {
-#ifdef __linux__
-      if ((g=accept(s,(__SOCKADDR_ARG)&client,&len)) < 0) 
-      {
-         return(g);
-      }
-#else
-      if ((g=accept(s,&client,&len)) < 0) 
+      if((nev = epoll_wait(epfd, events, MAXEVENTS, TICK_MSEC)) < 0)
       {
-         return(g);
+         if(errno != EINTR)
+            return(nev);
+         nev = 0;
       }
-#endif
-      
-      if(ValidMachine(runfiles, g, client, clientHostname))
+
+      for(i=0; i<nev; i++)
       {
-         i=0;
-         while(read(g, &c, 1)) 
+         if((conn = (CONNECTION *)events[i].data.ptr) == NULL)
          {
-            if(isalnum(c) || (c == '.') || (c == ' '))
-            {
-               line[i++] = c;
-            
-               if(c == '.')
-               {
-                  line[i-1] = '\0';
-                  
-                  if(gDebug)
-                     printf("Command: %s\n", line);
-                  
-                  HandleCommand(g, line, clientHostname);
-                  WaitForOtherChars(g);
-                  break;
-               }
-            }
+            NewConnections(epfd, s);
+         }
+         else if(conn->state != CONN_DEAD)
+         {
+            ReadConnection(epfd, conn);
          }
       }
 
-      /* Close the (parent) socket connection                           */
-      close(g);
+      if(gBreakLock)
+         BreakLock();
+      if(gReload)
+         ReloadMachineList(spoolDir);
+      if(gRescan || (time(NULL) >= nextScan))
+      {
+         ScanSpool(spoolDir, TRUE);
+         nextScan = time(NULL) + RESCAN_SECS;
+      }
+      ExpireLease();
+
+      DropIdleConnections(epfd);
+      FreeDeadConnections();
    }
 }
 
 
-
 /************************************************************************/
-BOOL GetClientID(int socket, struct sockaddr_in client, char *hostname)
+/*>void NewConnections(int epfd, int s)
+   -------------------------------------
+   Input:     int      epfd        epoll file descriptor
+              int      s           Listening socket
+
+   Accepts all pending connections from machines in the machine list
+   and adds them to the epoll set. Others are simply closed.
+
+   18.10.26 Original   By: ACRM
+*/
+void NewConnections(int epfd, int s)
 {
-   unsigned int   len;
-   struct hostent *host;
-   char           *chp;
+   struct sockaddr_in client;
+   struct epoll_event ev;
+   socklen_t          len;
+   int                g,
+                      on = 1;
+   char               clientHostname[MAXBUFF];
+   CONNECTION         *conn;
 
-   len = sizeof client;
-   
-   if (getpeername(socket, (struct sockaddr *) &client, &len) < 0)
-   {
-      return(FALSE);
-   }
-   else 
+   for(;;)
    {
-      if ((host = gethostbyaddr((char *) &client.sin_addr,
-                                sizeof client.sin_addr,
-                                AF_INET)) == NULL)
+      len = sizeof(client);
+#ifdef __linux__
+      if((g=accept(s,(__SOCKADDR_ARG)&client,&len)) < 0) 
+         return;
+#else
+      if((g=accept(s,&client,&len)) < 0) 
+         return;
+#endif
+
+      if(!ValidMachine(client, clientHostname))
       {
-         return(FALSE);
+         gStats.rejected++;
+         close(g);
+         continue;
       }
-      else 
+      CountConnection();
+      if(!SetNonBlocking(g))
       {
-         if(gDebug)
-            printf("Got connection from remote host is '%s'\n", 
-                   host->h_name);
+         close(g);
+         continue;
+      }
+
+      INIT(conn, CONNECTION);
+      if(conn == NULL)
+      {
+         close(g);
+         continue;
+      }
+      conn->sock       = g;
+      conn->state      = CONN_COMMAND;
+      conn->nline      = 0;
+      conn->session    = FALSE;
+      conn->nextWaiter = NULL;
 
-         strcpy(hostname, host->h_name);
-         if((chp=strchr(hostname,'.'))!=NULL)
-            *chp = '\0';
+      /* Let TCP notice if a long-lived session's machine goes away     */
+      setsockopt(g, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+      time(&(conn->lastActive));
+      strcpy(conn->hostname, clientHostname);
+
+      ev.events   = EPOLLIN;
+      ev.data.ptr = conn;
+      if(epoll_ctl(epfd, EPOLL_CTL_ADD, g, &ev) < 0)
+      {
+         close(g);
+         free(conn);
+         continue;
       }
+      
+      conn->next   = gConnections;
+      gConnections = conn;
    }
-   return(TRUE);
 }
 
 
 /************************************************************************/
-BOOL ValidMachine(RUNFILE *runfiles, int socket, 
-                  struct sockaddr_in client, char *hostname)
+/*>void ReadConnection(int epfd, CONNECTION *conn)
+   -----------------------------------------------
+   Input:     int         epfd     epoll file descriptor
+              CONNECTION  *conn    Client connection
+
+   Reads whatever is available from a client without blocking and
+   passes it on a character at a time to HandleChar(). The connection
+   is closed when the client closes its end.
+
+   18.10.26 Original   By: ACRM
+*/
+void ReadConnection(int epfd, CONNECTION *conn)
 {
-   RUNFILE *r;
-   
+   char buffer[MAXBUFF];
+   int  nread, 
+        i;
    
-   if(GetClientID(socket, client, hostname))
+   for(;;)
    {
-      for(r=runfiles; r!=NULL; NEXT(r))
+      if((nread = read(conn->sock, buffer, MAXBUFF)) < 0)
       {
-         char allowedhost[MAXBUFF];
-         int  hostid;
-         
-         sscanf(r->node,"%s %d", allowedhost, &hostid);
-         if(!strcmp(allowedhost, hostname))
-         {
-            if(gDebug)
-               printf("remote host is allowed to talk!\n");
-            return(TRUE);
-         }
+         if((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            return;
+         if(errno == EINTR)
+            continue;
+         CloseConnection(epfd, conn);
+         return;
+      }
+      else if(nread == 0)
+      {
+         CloseConnection(epfd, conn);
+         return;
       }
+
+      time(&(conn->lastActive));
+      for(i=0; i<nread && conn->state != CONN_DEAD; i++)
+         HandleChar(epfd, conn, buffer[i]);
+      if(conn->state == CONN_DEAD)
+         return;
    }
-   
-   return(FALSE);
 }
 
+
 /************************************************************************/
-void HandleCommand(int sock, char *line, char *clientHostname)
+/*>void HandleChar(int epfd, CONNECTION *conn, char c)
+   ---------------------------------------------------
+   Input:     int         epfd     epoll file descriptor
+              CONNECTION  *conn    Client connection
+              char        c        Character read from the client
+
+   Builds up the command line for a connection. A command is terminated
+   by a '.'. Once a command has been handled, any remaining characters
+   are simply mopped up until the client closes the connection (or, if
+   REQUIRE_ACK is defined, until it sends ACK or QUIT). A client queued
+   by WAITLOCK may still send CANCEL. Clients which have sent SESSION 
+   may carry on sending commands.
+
+   18.10.26 Original   By: ACRM (from code in AcceptConnections() and
+                                 WaitForOtherChars())
+   18.10.26 Accepts '-' for negative priorities
+*/
+void HandleChar(int epfd, CONNECTION *conn, char c)
 {
-   int id;
+#ifndef REQUIRE_ACK
+   if(conn->state == CONN_DRAIN)
+      return;
+#endif
+
+   if(!(isalnum(c) || (c == '.') || (c == ' ') || (c == '-')))
+      return;
+
+   /* Drop anyone sending garbage that will not fit in the buffer       */
+   if(conn->nline >= MAXBUFF-1)
+   {
+      if(gDebug)
+         printf("Command too long from %s\n", conn->hostname);
+      CloseConnection(epfd, conn);
+      return;
+   }
    
-   if(!strncmp(line,"STATUS",6))
+   conn->line[conn->nline++] = c;
+   if(c != '.')
+      return;
+
+   conn->line[conn->nline-1] = '\0';
+   conn->nline = 0;
+
+   if((conn->state == CONN_COMMAND) || (conn->state == CONN_WAITING))
    {
-      char buffer[80];
-      sprintf(buffer,"Status = %d\n", gStatus);
-      printf("%s",buffer);
-      write(sock,buffer,strlen(buffer)+1);
+      if(gDebug)
+         printf("Command: %s\n", conn->line);
+                  
+      HandleCommand(epfd, conn, conn->line);
+      if((conn->state == CONN_COMMAND) && !conn->session)
+         conn->state = CONN_DRAIN;
    }
-   else if(!strncmp(line,"GETLOCK",7))
+#ifdef REQUIRE_ACK
+   else
    {
-      if((sscanf(line,"%*s %d", &id))!=1)
-      {
-         if(gDebug)
-            printf("Error in command: %s\n",line);
-         write(sock,"ERROR.\n",8);
-      }
-      else
-      {
-         if(gStatus == STATUS_LOCKED)
-         {
-            if(gDebug)
-               printf("Already locked\n");
-            write(sock,"DENIED.\n",9);
-         }
-         else
-         {
-            gStatus = STATUS_LOCKED;
-            strcpy(gLockholder, clientHostname);
-            gClientID = id;
-            if(gDebug)
-               printf("Granted lock\n");
-            write(sock,"OK.\n",5);
-         }
-      }
+      if(gDebug)
+         printf("Waiting for ACK got: %s\n", conn->line);
+      
+      if(strstr(conn->line,"ACK") ||
+         strstr(conn->line,"QUIT"))
+         CloseConnection(epfd, conn);
    }
-   else if(!strncmp(line,"RELEASELOCK",11))
+#endif
+}
+
+
+/************************************************************************/
+/*>void CloseConnection(int epfd, CONNECTION *conn)
+   ------------------------------------------------
+   Input:     int         epfd     epoll file descriptor
+              CONNECTION  *conn    Client connection
+
+   Closes a client connection. The structure itself is freed later by
+   FreeDeadConnections() so that it is safe to call this while events
+   for the connection may still be pending. If a session closes while
+   holding locks, its owner has gone away so the locks are released.
+
+   18.10.26 Original   By: ACRM
+*/
+void CloseConnection(int epfd, CONNECTION *conn)
+{
+   LOCK   *lock;
+   HOLDER *h,
+          *next;
+   int    i;
+
+   if(conn->state == CONN_DEAD)
+      return;
+
+   if(conn->state == CONN_WAITING)
    {
-      if((sscanf(line,"%*s %d", &id))!=1)
-      {
-         if(gDebug)
-            printf("Error in command: %s\n",line);
-         write(sock,"ERROR.\n",8);
-      }
-      else
+      RemoveWaiter(conn);
+      gStats.cancels++;
+   }
+   else if(conn->state == CONN_IDLE)
+   {
+      UnparkConnection(conn);
+   }
+   
+   epoll_ctl(epfd, EPOLL_CTL_DEL, conn->sock, NULL);
+   close(conn->sock);
+   conn->state = CONN_DEAD;
+
+   /* A session may hold any number of locks                            */
+   for(i=0; i<LOCKHASHSIZE; i++)
+   {
+      for(lock=gLocks[i]; lock!=NULL; NEXT(lock))
       {
-         if(gStatus == STATUS_LOCKED)
+         for(h=lock->holders; h!=NULL; h=next)
          {
-            if(CorrectMachine(clientHostname, id))
-            {
-               gStatus = STATUS_UNLOCKED;
-               
-               if(gDebug)
-                  printf("Released lock\n");
-               write(sock,"OK.\n",5);
-            }
-            else
+            next = h->next;
+            if(h->conn == conn)
             {
                if(gDebug)
-                  printf("Lock release denied\n");
-               write(sock,"DENIED.\n",9);
+                  printf("Session holding lock %s closed by %s (%d)\n", 
+                         lock->name, h->hostname, h->clientID);
+               gStats.closes++;
+               ReleaseHolder(lock, h);
             }
          }
-         else
-         {
-            if(gDebug)
-               printf("Lock release requested, but no lock\n");
-            write(sock,"ERROR.\n",8);
-         }
       }
    }
 }
 
-/************************************************************************/
-BOOL CorrectMachine(char *clientHostname, int clientID)
-{
-   if(!strcmp(clientHostname, gLockholder) && (clientID == gClientID))
-      return(TRUE);
-   return(FALSE);
-}
 
 /************************************************************************/
-/*>BOOL ParseCmdLine(int argc, char **argv, char *spooldir, int *port)
-   -------------------------------------------------------------------
-   Input:     int   argc         Argument count
-              char  **argv       Arguments
-   Output:    char  *spooldir    Spool directory
-              int   *port        Cluster number
-   Returns:   BOOL               Success?
+/*>void DropIdleConnections(int epfd)
+   ----------------------------------
+   Input:     int         epfd     epoll file descriptor
 
-   Parses the command line
+   Closes any connections which have been idle for more than 
+   CONN_TIMEOUT seconds. Clients queued for the lock and sessions are
+   left alone. Also tells any qlrun parked in DEQUEUE WAIT whose wait 
+   is up that there is no job.
 
-   04.10.00 Original   By: ACRM
+   18.10.26 Original   By: ACRM
+   18.10.26 Handles parked DEQUEUE WAIT
 */
-BOOL ParseCmdLine(int argc, char **argv, char *spooldir, int *port)
+void DropIdleConnections(int epfd)
 {
-   argc--;
-   argv++;
-
-   *port = 0;
+   CONNECTION *conn;
+   time_t     now;
 
-   while(argc)
+   time(&now);
+   for(conn=gConnections; conn!=NULL; NEXT(conn))
    {
-      if(argv[0][0] == '-')
+      /* Nothing has arrived for a parked DEQUEUE WAIT                  */
+      if((conn->state == CONN_IDLE) && (now >= conn->idleUntil))
       {
-         switch(argv[0][1])
-         {
-         case 'd':
-            gDebug = 1;
-            break;
-         case 'p':
-            argv++;
-            argc--;
-            if(!argc)
-               return(FALSE);
-            if(!sscanf(argv[0],"%d", port))
-               return(FALSE);
-            break;
-         default:
-            return(FALSE);
-            break;
-         }
+         UnparkConnection(conn);
+         conn->state = (conn->session ? CONN_COMMAND : CONN_DRAIN);
+         SendReply(conn, "NONE.\n");
+         continue;
       }
-      else
+      
+      if((conn->state != CONN_DEAD) && (conn->state != CONN_WAITING) &&
+         (conn->state != CONN_IDLE) &&
+         !conn->session && ((now - conn->lastActive) > CONN_TIMEOUT))
       {
-         if(argc > 0)
-            return(FALSE);
+         if(gDebug)
+            printf("Dropping idle connection from %s\n", conn->hostname);
+         CloseConnection(epfd, conn);
       }
-      
-      argc--;
-      argv++;
    }
-   
-   return(TRUE);
 }
 
 
 /************************************************************************/
-void WaitForOtherChars(int sock)
+/*>void FreeDeadConnections(void)
+   ------------------------------
+   Removes closed connections from the connection list and frees them
+
+   18.10.26 Original   By: ACRM
+*/
+void FreeDeadConnections(void)
 {
-   char c;
-#ifdef REQUIRE_ACK
-   char line[MAXBUFF],
-   int  i=0;
-#endif
-   
-   while(read(sock, &c, 1))
+   CONNECTION *conn,
+              **prev;
+
+   prev = &gConnections;
+   while((conn = *prev) != NULL)
    {
-#ifdef REQUIRE_ACK
-      if(isalnum(c) || (c=='.') || (c == ' '))
+      if(conn->state == CONN_DEAD)
       {
-         line[i++] = c;
-         
-         if(c == '.')
-         {
-            line[i-1] = '\0';
-            
-            if(gDebug)
-               printf("WaitForOtherChars() got: %s\n", line);
-            
-            if(strstr(line,"ACK") ||
-               strstr(line,"QUIT"))
-               break;
-
-            i=0;
-         }
+         *prev = conn->next;
+         free(conn);
+      }
+      else
+      {
+         prev = &(conn->next);
       }
-#endif
    }
 }
 
+
 /************************************************************************/
-void error(void)
+/*>BOOL SetNonBlocking(int sock)
+   -----------------------------
+   Input:     int   sock     A socket
+   Returns:   BOOL           Success?
+
+   Puts a socket into non-blocking mode
+
+   18.10.26 Original   By: ACRM
+*/
+BOOL SetNonBlocking(int sock)
 {
-   fprintf(stderr,"Died!\n");
-   exit(1);
+   int flags;
+
+   if((flags = fcntl(sock, F_GETFL, 0)) < 0)
+      return(FALSE);
+   if(fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0)
+      return(FALSE);
+   return(TRUE);
 }
 
 
 /************************************************************************/
-void Usage(void)
+/*>BOOL SendReply(CONNECTION *conn, char *reply)
+   ---------------------------------------------
+   Input:     CONNECTION  *conn    Client connection
+              char        *reply   Text to send
+   Returns:   BOOL                 Was all of it sent?
+
+   Sends a reply (including the terminating '\0' as the clients have
+   always expected). Replies are short enough always to fit in the 
+   socket buffer so we do not queue partial writes. A client which has
+   gone must not take the daemon with it, so SIGPIPE is not raised.
+
+   18.10.26 Original   By: ACRM
+   18.10.26 Returns whether the whole reply was written. Uses send()
+            with MSG_NOSIGNAL
+*/
+BOOL SendReply(CONNECTION *conn, char *reply)
 {
-   fprintf(stderr,"\nqllockd V1.1 (c) Dr. Andrew C.R. Martin, University \
-of Reading\n");
+   size_t len = strlen(reply)+1;
 
-   fprintf(stderr,"\nUsage: qllockd [-p portnum] [-s spooldir]\n");
-   fprintf(stderr,"       -p Specify the port number to listen on\n");
-   fprintf(stderr,"       -s Specify the spool directory\n");
+   if(send(conn->sock, reply, len, MSG_NOSIGNAL) != (ssize_t)len)
+   {
+      if(gDebug)
+         printf("Unable to reply to %s\n", conn->hostname);
+      return(FALSE);
+   }
+   return(TRUE);
+}
 
-   fprintf(stderr,"\nqllockd listens on the specified port for requests \
-for locks by qlrun\n");
 
-   fprintf(stderr,"\nBy default, it listens on port %d. 'qlite' may be \
-specified as a service\n", DEFAULT_QLPORT);
-   fprintf(stderr,"in /etc/services and a different port may be \
-specified there. The port\n");
-   fprintf(stderr,"specified with -p takes priority over either of \
-those.\n");
+/************************************************************************/
+/*>BOOL PeerAlive(CONNECTION *conn)
+   --------------------------------
+   Input:     CONNECTION  *conn    Client connection
+   Returns:   BOOL                 Is the client still there?
 
-   fprintf(stderr,"\nqllockd only grants locks to machines listed in \
-.machinelist in the\n");
-   fprintf(stderr,"spool directory.\n");
+   Checks, without blocking or taking anything from the socket, that 
+   the client has not closed its end. A qlrun which dies while parked 
+   in DEQUEUE WAIT is otherwise only noticed once its connection is 
+   next read, which may be after a job has been pushed to it.
 
-   fprintf(stderr,"\nqllockd should only be run on one machine in a \
-cluster (in fact it\n");
-   fprintf(stderr,"may be run on a machine not in the cluster \
-itself)\n\n");
+   18.10.26 Original   By: ACRM
+*/
+BOOL PeerAlive(CONNECTION *conn)
+{
+   char    c;
+   ssize_t n;
+
+   if((n = recv(conn->sock, &c, 1, MSG_PEEK | MSG_DONTWAIT)) > 0)
+      return(TRUE);
+   if(n == 0)
+      return(FALSE);
+   return((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR));
 }
 
 
 /************************************************************************/
-void HandleHUP(int signum)
+/*>BOOL ValidMachine(struct sockaddr_in client, char *hostname)
+   ------------------------------------------------------------
+   Input:     struct sockaddr_in client    Address of the client
+   Output:    char               *hostname Its name from the machine list
+   Returns:   BOOL                         Is it allowed to talk to us?
+
+   Checks whether a client's address is one of those in the machine
+   list. This is just a hash lookup - the names were resolved when the
+   list was read.
+
+   04.10.00 Original   By: ACRM
+   18.10.26 Uses the pre-resolved address table instead of a reverse 
+            lookup and a scan of the machine list
+*/
+BOOL ValidMachine(struct sockaddr_in client, char *hostname)
 {
-   if(gStatus == STATUS_LOCKED)
+   ALLOWEDHOST *host;
+   
+   if((host = FindHost(gAllowedHosts, client.sin_addr.s_addr)) != NULL)
    {
+      strcpy(hostname, host->name);
       if(gDebug)
+         printf("Got connection from %s - allowed to talk!\n", hostname);
+      return(TRUE);
+   }
+
+   if(gDebug)
+      printf("Rejected connection from %s\n", inet_ntoa(client.sin_addr));
+   return(FALSE);
+}
+
+/************************************************************************/
+/*>void HandleCommand(int epfd, CONNECTION *conn, char *line)
+   ----------------------------------------------------------
+   Input:     int         epfd     epoll file descriptor
+              CONNECTION  *conn    Client connection
+              char        *line    The command (without the '.')
+
+   Handles a command from a client:
+      SESSION             Keep the connection open for further commands
+      QUIT                End a session
+      STATUS              Report whether the lock is held
+      GETLOCK id [TTL n]  Get the lock or be told DENIED
+      WAITLOCK id [TTL n] Queue for the lock. OK is sent as soon as it
+                          is granted
+      CANCEL id           Leave the WAITLOCK queue (reply CANCELLED)
+      RENEW id            Extend the lease on the lock we hold
+      RELEASELOCK id      Release the lock
+      ENQUEUE cluster job Add a newly submitted job to the index
+              [PRIORITY n]  Jobs with higher n are handed out first
+              [TASKS m-n]   Job array whose tasks m to n are handed
+                            out one by one (as JOB job:task)
+      DEQUEUE cluster     Take the next job (reply JOB n or NONE)
+              [WAIT n]    Wait up to n seconds for a job to arrive
+              [MAX n]     Take up to n jobs (reply JOB n1 n2 ...)
+      NEXTID cluster      Allocate a job number (reply ID n)
+      NEXTIDS cluster n   Allocate n consecutive job numbers (reply 
+                          IDS first-last)
+
+   The lock is granted as a lease of n seconds (default LEASE_TTL).
+
+   04.10.00 Original   By: ACRM
+   18.10.26 Added WAITLOCK and CANCEL
+   18.10.26 Added SESSION and QUIT
+   18.10.26 Added TTL and RENEW
+   18.10.26 Added ENQUEUE and DEQUEUE
+   18.10.26 Added WAIT and MAX to DEQUEUE
+   18.10.26 Added PRIORITY to ENQUEUE
+   18.10.26 Added TASKS to ENQUEUE
+   18.10.26 Added NEXTID and NEXTIDS
+   18.10.26 A job is only handed to a parked qlrun if the reply gets 
+            through. Added epfd so that a dead qlrun can be closed
+*/
+void HandleCommand(int epfd, CONNECTION *conn, char *line)
+{
+   int    id,
+          ttl,
+          mode,
+          cluster,
+          wait,
+          maxjobs,
+          njobs,
+          priority;
+   ULONG  jobnum,
+          task,
+          firstTask,
+          lastTask;
+   BOOL   pending;
+   char   buffer[MAXBUFF],
+          lockName[MAXLOCKNAME];
+   LOCK   *lock;
+   HOLDER *holder;
+   CONNECTION *idle;
+   
+   /* A parked qlrun just waits for its job                             */
+   if(conn->state == CONN_IDLE)
+      return;
+
+   /* A queued client may only cancel its request                       */
+   if(conn->state == CONN_WAITING)
+   {
+      if(!strncmp(line,"CANCEL",6))
+      {
+         RemoveWaiter(conn);
+         gStats.cancels++;
+         conn->state = (conn->session ? CONN_COMMAND : CONN_DRAIN);
+         if(gDebug)
+            printf("Lock request cancelled\n");
+         SendReply(conn, "CANCELLED.\n");
+      }
+      return;
+   }
+   if(!strncmp(line,"SESSION",7))
+   {
+      conn->session = TRUE;
+      SendReply(conn, "OK.\n");
+   }
+   else if(!strncmp(line,"QUIT",4))
+   {
+      conn->session = FALSE;
+   }
+   else if(!strncmp(line,"CANCEL",6))
+   {
+      /* Not queued - we must already have granted the lock             */
+      SendReply(conn, "CANCELLED.\n");
+   }
+   else if(!strncmp(line,"STATS",5))
+   {
+      SendStats(conn);
+   }
+   else if(!strncmp(line,"STATUS",6))
+   {
+      if(!ParseLockArgs(line, NULL, &ttl, &mode, lockName) ||
+         ((lock = FindLock(lockName)) == NULL))
+      {
+         if(gDebug)
+            printf("Error in command: %s\n",line);
+         SendReply(conn, "ERROR.\n");
+      }
+      else
+      {
+         sprintf(buffer,"Status = %d.\n", lock->status);
+         if(gDebug)
+            printf("%s",buffer);
+         SendReply(conn, buffer);
+      }
+   }
+   else if(!strncmp(line,"GETLOCK",7))
+   {
+      if(!ParseLockArgs(line, &id, &ttl, &mode, lockName) ||
+         ((lock = FindLock(lockName)) == NULL))
+      {
+         if(gDebug)
+            printf("Error in command: %s\n",line);
+         SendReply(conn, "ERROR.\n");
+      }
+      else
+      {
+         /* Queued clients get the lock first                           */
+         if(!CanGrant(lock, mode) || (lock->waitHead != NULL))
+         {
+            if(gDebug)
+               printf("Lock %s already locked\n", lock->name);
+            gStats.denials++;
+            SendReply(conn, "DENIED.\n");
+         }
+         else
+         {
+            GrantLock(lock, conn, id, ttl, mode);
+         }
+      }
+   }
+   else if(!strncmp(line,"WAITLOCK",8))
+   {
+      if(!ParseLockArgs(line, &id, &ttl, &mode, lockName) ||
+         ((lock = FindLock(lockName)) == NULL))
+      {
+         if(gDebug)
+            printf("Error in command: %s\n",line);
+         SendReply(conn, "ERROR.\n");
+      }
+      else if(!CanGrant(lock, mode) || (lock->waitHead != NULL))
+      {
+         if(gDebug)
+            printf("Lock %s already locked - queued\n", lock->name);
+         conn->waitID     = id;
+         conn->waitTTL    = ttl;
+         conn->waitMode   = mode;
+         conn->waitLock   = lock;
+         conn->waitStart  = NowMsec();
+         conn->state      = CONN_WAITING;
+         conn->nextWaiter = NULL;
+         if(lock->waitTail == NULL)
+            lock->waitHead = conn;
+         else
+            lock->waitTail->nextWaiter = conn;
+         lock->waitTail = conn;
+         gStats.queued++;
+      }
+      else
+      {
+         AddToHistogram(&(gStats.wait), 0);
+         GrantLock(lock, conn, id, ttl, mode);
+      }
+   }
+   else if(!strncmp(line,"RENEW",5))
+   {
+      if(!ParseLockArgs(line, &id, &ttl, &mode, lockName) ||
+         ((lock = FindLock(lockName)) == NULL))
+      {
+         if(gDebug)
+            printf("Error in command: %s\n",line);
+         SendReply(conn, "ERROR.\n");
+      }
+      else if((holder = FindHolder(lock, conn, id)) != NULL)
+      {
+         time(&(holder->leaseExpiry));
+         holder->leaseExpiry += holder->leaseTTL;
+         SendReply(conn, "OK.\n");
+      }
+      else
+      {
+         if(gDebug)
+            printf("Lease renewal denied\n");
+         SendReply(conn, "DENIED.\n");
+      }
+   }
+   else if(!strncmp(line,"ENQUEUE",7))
+   {
+      if(!ParseEnqueueArgs(line, &cluster, &jobnum, &priority,
+                           &firstTask, &lastTask))
+      {
+         if(gDebug)
+            printf("Error in command: %s\n",line);
+         SendReply(conn, "ERROR.\n");
+      }
+      else
+      {
+         /* Hand it straight to the qlrun which has waited longest. 
+            Each waiting qlrun can be given a task of a job array. A 
+            qlrun which has gone, or which the reply does not reach, is
+            dropped and the job offered to the next
+         */
+         pending = TRUE;
+         while(pending && ((idle = gQueues[cluster].idleHead) != NULL))
+         {
+            if(!PeerAlive(idle))
+            {
+               if(gDebug)
+                  printf("Parked qlrun on %s has gone\n", idle->hostname);
+               CloseConnection(epfd, idle);
+               continue;
+            }
+
+            UnparkConnection(idle);
+            idle->state = (idle->session ? CONN_COMMAND : CONN_DRAIN);
+            if(firstTask)
+               sprintf(buffer, "JOB %lu:%lu.\n", jobnum, firstTask);
+            else
+               sprintf(buffer, "JOB %lu.\n", jobnum);
+            if(!SendReply(idle, buffer))
+            {
+               CloseConnection(epfd, idle);
+               continue;
+            }
+            if(gDebug)
+               printf("Job %s on cluster %d pushed to %s", 
+                      buffer+4, cluster, idle->hostname);
+
+            if(firstTask && (firstTask < lastTask))
+               firstTask++;
+            else
+               pending = FALSE;
+         }
+
+         /* Anything left waits in the index                            */
+         if(!pending || 
+            AddToQueue(cluster, jobnum, priority, firstTask, lastTask))
+            SendReply(conn, "OK.\n");
+         else
+            SendReply(conn, "ERROR.\n");
+      }
+   }
+   else if(!strncmp(line,"NEXTIDS",7))
+   {
+      if((sscanf(line, "%*s %d %lu", &cluster, &jobnum) != 2) ||
+         (cluster < 0) || (cluster > MAXCLUSTER) ||
+         (jobnum == 0) || (jobnum > MAX_IDS) ||
+         !IssueJobIds(cluster, jobnum, &firstTask))
+      {
+         if(gDebug)
+            printf("Error in command: %s\n",line);
+         SendReply(conn, "ERROR.\n");
+      }
+      else
+      {
+         sprintf(buffer, "IDS %lu-%lu.\n", firstTask, 
+                 firstTask + jobnum - 1);
+         SendReply(conn, buffer);
+      }
+   }
+   else if(!strncmp(line,"NEXTID",6))
+   {
+      if((sscanf(line, "%*s %d", &cluster) != 1) ||
+         (cluster < 0) || (cluster > MAXCLUSTER) ||
+         !IssueJobIds(cluster, 1, &jobnum))
+      {
+         if(gDebug)
+            printf("Error in command: %s\n",line);
+         SendReply(conn, "ERROR.\n");
+      }
+      else
+      {
+         sprintf(buffer, "ID %lu.\n", jobnum);
+         SendReply(conn, buffer);
+      }
+   }
+   else if(!strncmp(line,"DEQUEUE",7))
+   {
+      /* DEQUEUE cluster [WAIT seconds] [MAX njobs]                     */
+      if(!ParseDequeueArgs(line, &cluster, &wait, &maxjobs))
+      {
+         if(gDebug)
+            printf("Error in command: %s\n",line);
+         SendReply(conn, "ERROR.\n");
+      }
+      else if((jobnum = TakeFromQueue(cluster, &task)) != 0)
+      {
+         /* Add further jobs while the reply still fits in the client's
+            line buffer. Tasks of a job array are sent as job:task
+         */
+         strcpy(buffer, "JOB");
+         for(njobs=0; jobnum != 0; )
+         {
+            sprintf(buffer+strlen(buffer), " %lu", jobnum);
+            if(task)
+               sprintf(buffer+strlen(buffer), ":%lu", task);
+            if((++njobs >= maxjobs) || (strlen(buffer) >= MAXBUFF-48))
+               break;
+            jobnum = TakeFromQueue(cluster, &task);
+         }
+         if(gDebug)
+            printf("%d job(s) on cluster %d given to %s: %s\n", 
+                   njobs, cluster, conn->hostname, buffer+4);
+         strcat(buffer, ".\n");
+         SendReply(conn, buffer);
+      }
+      else if(wait > 0)
+      {
+         ParkConnection(conn, cluster, wait);
+      }
+      else
+      {
+         SendReply(conn, "NONE.\n");
+      }
+   }
+   else if(!strncmp(line,"RELEASELOCK",11))
+   {
+      if(!ParseLockArgs(line, &id, &ttl, &mode, lockName) ||
+         ((lock = FindLock(lockName)) == NULL))
+      {
+         if(gDebug)
+            printf("Error in command: %s\n",line);
+         SendReply(conn, "ERROR.\n");
+      }
+      else
+      {
+         if(lock->status != STATUS_UNLOCKED)
+         {
+            if((holder = FindHolder(lock, conn, id)) != NULL)
+            {
+               if(gDebug)
+                  printf("Released lock %s\n", lock->name);
+               gStats.releases++;
+               SendReply(conn, "OK.\n");
+               ReleaseHolder(lock, holder);
+            }
+            else
+            {
+               if(gDebug)
+                  printf("Lock release denied\n");
+               SendReply(conn, "DENIED.\n");
+            }
+         }
+         else
+         {
+            if(gDebug)
+               printf("Lock release requested, but no lock\n");
+            SendReply(conn, "ERROR.\n");
+         }
+      }
+   }
+}
+
+
+/************************************************************************/
+/*>BOOL ParseLockArgs(char *line, int *id, int *ttl, int *mode,
+                      char *lockName)
+   -------------------------------------------------------------
+   Input:     char   *line     Command of the form COMMAND id 
+                               [TTL n] [MODE SHARED|EXCLUSIVE] 
+                               [LOCK name]
+   Output:    int    *id       Client's instance ID (NULL if the command
+                               takes no ID)
+              int    *ttl      Requested lease time (seconds)
+              int    *mode     LOCK_SHARED or LOCK_EXCLUSIVE
+              char   *lockName Name of the lock
+   Returns:   BOOL             Success?
+
+   Parses the arguments to the lock commands. The lease time defaults
+   to LEASE_TTL and is limited to MAX_LEASE. The mode defaults to
+   exclusive and the lock name to DEFAULT_LOCK.
+
+   18.10.26 Original   By: ACRM
+   18.10.26 Added LOCK and made the ID optional
+   18.10.26 Added MODE
+*/
+BOOL ParseLockArgs(char *line, int *id, int *ttl, int *mode, 
+                   char *lockName)
+{
+   char key[MAXBUFF],
+        value[MAXBUFF],
+        *chp;
+   int  offset = 0;
+   
+   *ttl  = LEASE_TTL;
+   *mode = LOCK_EXCLUSIVE;
+   strcpy(lockName, DEFAULT_LOCK);
+   
+   if(id == NULL)
+   {
+      if(sscanf(line,"%*s%n", &offset) != 0)
+         return(FALSE);
+   }
+   else if(sscanf(line,"%*s %d%n", id, &offset) != 1)
+   {
+      return(FALSE);
+   }
+   
+   for(chp=line+offset; 
+       sscanf(chp, "%s %s%n", key, value, &offset) == 2;
+       chp += offset)
+   {
+      if(!strcmp(key, "TTL"))
+      {
+         if(sscanf(value, "%d", ttl) != 1)
+            return(FALSE);
+      }
+      else if(!strcmp(key, "MODE"))
+      {
+         if(!strcmp(value, "SHARED"))
+            *mode = LOCK_SHARED;
+         else if(!strcmp(value, "EXCLUSIVE"))
+            *mode = LOCK_EXCLUSIVE;
+         else
+            return(FALSE);
+      }
+      else if(!strcmp(key, "LOCK"))
       {
-         fprintf(stderr,"Lock held by %s released by SIGHUP\n", 
-                 gLockholder);
+         if(strlen(value) >= MAXLOCKNAME)
+            return(FALSE);
+         strcpy(lockName, value);
+      }
+      else
+      {
+         return(FALSE);
       }
+   }
+   /* Anything left over is an error                                    */
+   while(*chp == ' ')
+      chp++;
+   if(*chp)
+      return(FALSE);
+   if(*ttl < 1)
+      *ttl = 1;
+   else if(*ttl > MAX_LEASE)
+      *ttl = MAX_LEASE;
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>BOOL ParseDequeueArgs(char *line, int *cluster, int *wait, 
+                         int *maxjobs)
+   ------------------------------------------------------------
+   Input:     char   *line     Command of the form DEQUEUE cluster
+                               [WAIT n] [MAX n]
+   Output:    int    *cluster  Cluster number
+              int    *wait     Time to wait for a job (seconds)
+              int    *maxjobs  Most jobs to hand out
+   Returns:   BOOL             Success?
+
+   Parses the arguments to DEQUEUE. The wait defaults to 0 (reply at
+   once) and the number of jobs to 1. More than MAXBATCH jobs are 
+   never handed out at once.
+
+   18.10.26 Original   By: ACRM
+*/
+BOOL ParseDequeueArgs(char *line, int *cluster, int *wait, int *maxjobs)
+{
+   char key[MAXBUFF];
+   int  value,
+        offset = 0;
+   char *chp;
+   
+   *wait    = 0;
+   *maxjobs = 1;
+   
+   if((sscanf(line,"%*s %d%n", cluster, &offset) != 1) ||
+      (*cluster < 0) || (*cluster > MAXCLUSTER))
+      return(FALSE);
+
+   for(chp=line+offset; 
+       sscanf(chp, "%s %d%n", key, &value, &offset) == 2;
+       chp += offset)
+   {
+      if(value < 0)
+         return(FALSE);
       
-      gStatus = STATUS_UNLOCKED;
-      signal(SIGHUP, HandleHUP);
+      if(!strcmp(key, "WAIT"))
+         *wait = value;
+      else if(!strcmp(key, "MAX"))
+         *maxjobs = value;
+      else
+         return(FALSE);
    }
-   else if(gDebug)
+   /* Anything left over is an error                                    */
+   while(*chp == ' ')
+      chp++;
+   if(*chp)
+      return(FALSE);
+   if(*maxjobs < 1)
+      *maxjobs = 1;
+   else if(*maxjobs > MAXBATCH)
+      *maxjobs = MAXBATCH;
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>BOOL ParseEnqueueArgs(char *line, int *cluster, ULONG *jobnum, 
+                         int *priority, ULONG *firstTask, 
+                         ULONG *lastTask)
+   -------------------------------------------------------------
+   Input:     char   *line      Command of the form ENQUEUE cluster job
+                                [PRIORITY n] [TASKS m-n]
+   Output:    int    *cluster   Cluster number
+              ULONG  *jobnum    Job number
+              int    *priority  Job priority
+              ULONG  *firstTask First task of a job array (0 if none)
+              ULONG  *lastTask  Last task of a job array
+   Returns:   BOOL              Success?
+
+   Parses the arguments to ENQUEUE. The priority defaults to 0 and may
+   be negative. Tasks are numbered from 1.
+
+   18.10.26 Original   By: ACRM
+   18.10.26 Added TASKS
+*/
+BOOL ParseEnqueueArgs(char *line, int *cluster, ULONG *jobnum, 
+                      int *priority, ULONG *firstTask, ULONG *lastTask)
+{
+   char key[MAXBUFF],
+        value[MAXBUFF];
+   int  offset = 0;
+   char *chp;
+   
+   *priority  = 0;
+   *firstTask = *lastTask = 0;
+   
+   if((sscanf(line,"%*s %d %lu%n", cluster, jobnum, &offset) != 2) ||
+      (*cluster < 0) || (*cluster > MAXCLUSTER) || (*jobnum == 0))
+      return(FALSE);
+
+   for(chp=line+offset; 
+       sscanf(chp, "%s %s%n", key, value, &offset) == 2;
+       chp += offset)
    {
-      fprintf(stderr,"No lock held\n");
+      if(!strcmp(key, "PRIORITY"))
+      {
+         if(sscanf(value, "%d", priority) != 1)
+            return(FALSE);
+      }
+      else if(!strcmp(key, "TASKS"))
+      {
+         if((sscanf(value, "%lu-%lu", firstTask, lastTask) != 2) ||
+            (*firstTask == 0) || (*lastTask < *firstTask))
+            return(FALSE);
+      }
+      else
+      {
+         return(FALSE);
+      }
    }
+   /* Anything left over is an error                                    */
+   while(*chp == ' ')
+      chp++;
+   if(*chp)
+      return(FALSE);
+   return(TRUE);
 }
 
 
+/************************************************************************/
+/*>LOCK *FindLock(char *name)
+   --------------------------
+   Input:     char   *name     Lock name
+   Returns:   LOCK   *         The lock (NULL if out of memory)
+
+   Looks up a lock in the lock table, creating it unlocked the first 
+   time it is used
+
+   18.10.26 Original   By: ACRM
+*/
+LOCK *FindLock(char *name)
+{
+   LOCK *lock;
+   int  bucket = HashLockName(name);
 
+   for(lock=gLocks[bucket]; lock!=NULL; NEXT(lock))
+   {
+      if(!strcmp(lock->name, name))
+         return(lock);
+   }
+
+   if((lock = (LOCK *)calloc(1, sizeof(LOCK))) == NULL)
+      return(NULL);
+   strcpy(lock->name, name);
+   lock->status   = STATUS_UNLOCKED;
+   lock->next     = gLocks[bucket];
+   gLocks[bucket] = lock;
+
+   if(gDebug)
+      printf("Created lock %s\n", name);
+   
+   return(lock);
+}
+
+
+/************************************************************************/
+/*>int HashLockName(char *name)
+   ----------------------------
+   Input:     char   *name     Lock name
+   Returns:   int              Bucket in the lock table
+
+   18.10.26 Original   By: ACRM
+*/
+int HashLockName(char *name)
+{
+   unsigned int hash = 0;
+
+   while(*name)
+      hash = (hash * 31) + (unsigned char)*(name++);
+   
+   return((int)(hash % LOCKHASHSIZE));
+}
+
+
+/************************************************************************/
+/*>BOOL CanGrant(LOCK *lock, int mode)
+   ------------------------------------
+   Input:     LOCK   *lock     The lock
+              int    mode      LOCK_SHARED or LOCK_EXCLUSIVE
+   Returns:   BOOL             Could the lock be granted in this mode?
+
+   A free lock may be granted in either mode; a shared lock may also be
+   granted to further shared holders
+
+   18.10.26 Original   By: ACRM
+*/
+BOOL CanGrant(LOCK *lock, int mode)
+{
+   if(lock->status == STATUS_UNLOCKED)
+      return(TRUE);
+   if((lock->status == STATUS_SHARED) && (mode == LOCK_SHARED))
+      return(TRUE);
+   return(FALSE);
+}
+
+
+/************************************************************************/
+/*>void GrantLock(LOCK *lock, CONNECTION *conn, int id, int ttl, 
+                  int mode)
+   ---------------------------------------------------------------
+   Input:     LOCK        *lock    The lock
+              CONNECTION  *conn    Client connection
+              int         id       Client's instance ID
+              int         ttl      Lease time (seconds)
+              int         mode     LOCK_SHARED or LOCK_EXCLUSIVE
+
+   Adds a client to the holders of the lock and tells it so
+
+   18.10.26 Original   By: ACRM (from code in HandleCommand())
+   18.10.26 Added mode. Holders are kept in a list
+*/
+void GrantLock(LOCK *lock, CONNECTION *conn, int id, int ttl, int mode)
+{
+   HOLDER *holder;
+
+   if((holder = (HOLDER *)malloc(sizeof(HOLDER))) == NULL)
+   {
+      SendReply(conn, "ERROR.\n");
+      return;
+   }
+   
+   holder->conn      = (conn->session ? conn : NULL);
+   holder->grantedAt = NowMsec();
+   holder->clientID  = id;
+   holder->leaseTTL  = ttl;
+   holder->mode      = mode;
+   time(&(holder->leaseExpiry));
+   holder->leaseExpiry += ttl;
+   strcpy(holder->hostname, conn->hostname);
+   holder->next     = lock->holders;
+   lock->holders    = holder;
+   lock->status     = ((mode == LOCK_SHARED) ? STATUS_SHARED : 
+                                               STATUS_LOCKED);
+   gStats.grants++;
+   if(gDebug)
+      printf("Granted %s lock %s to %s (%d)\n", 
+             ((mode == LOCK_SHARED) ? "shared" : "exclusive"),
+             lock->name, holder->hostname, holder->clientID);
+   SendReply(conn, "OK.\n");
+}
+
+
+/************************************************************************/
+/*>void ReleaseHolder(LOCK *lock, HOLDER *holder)
+   ----------------------------------------------
+   Input:     LOCK   *lock     The lock
+              HOLDER *holder   One of its holders
+
+   Removes a holder from a lock, recording how long it was held. If 
+   that was the last holder, the lock is freed and passed on to the 
+   clients at the head of its queue.
+
+   18.10.26 Original   By: ACRM
+*/
+void ReleaseHolder(LOCK *lock, HOLDER *holder)
+{
+   HOLDER *h,
+          *prev = NULL;
+
+   for(h=lock->holders; h!=NULL; NEXT(h))
+   {
+      if(h == holder)
+      {
+         if(prev == NULL)
+            lock->holders = h->next;
+         else
+            prev->next = h->next;
+         AddToHistogram(&(gStats.hold), NowMsec() - h->grantedAt);
+         free(h);
+         break;
+      }
+      prev = h;
+   }
+
+   if(lock->holders == NULL)
+   {
+      lock->status = STATUS_UNLOCKED;
+      GrantNextWaiter(lock);
+   }
+}
+
+
+/************************************************************************/
+/*>void GrantNextWaiter(LOCK *lock)
+   --------------------------------
+   Input:     LOCK   *lock     The lock
+
+   Hands the lock to the clients which have been waiting longest in its
+   WAITLOCK queue for as long as they can be granted. A run of shared
+   requests at the head of the queue is granted together; an exclusive
+   request at the head holds back everything behind it.
+
+   18.10.26 Original   By: ACRM
+   18.10.26 Grants runs of shared requests
+*/
+void GrantNextWaiter(LOCK *lock)
+{
+   CONNECTION *conn;
+   
+   while(((conn = lock->waitHead) != NULL) && 
+         CanGrant(lock, conn->waitMode))
+   {
+      RemoveWaiter(conn);
+      conn->state = (conn->session ? CONN_COMMAND : CONN_DRAIN);
+      AddToHistogram(&(gStats.wait), NowMsec() - conn->waitStart);
+      GrantLock(lock, conn, conn->waitID, conn->waitTTL, conn->waitMode);
+   }
+}
+
+
+/************************************************************************/
+/*>void ExpireLease(void)
+   ----------------------
+   Called from the event loop. If a holder of a lock has not renewed
+   its lease in time, it is assumed to have died so its hold on the
+   lock is dropped and the lock passed on if it is now free.
+
+   18.10.26 Original   By: ACRM
+*/
+void ExpireLease(void)
+{
+   time_t now;
+   LOCK   *lock;
+   HOLDER *h,
+          *next;
+   int    i;
+   
+   time(&now);
+   for(i=0; i<LOCKHASHSIZE; i++)
+   {
+      for(lock=gLocks[i]; lock!=NULL; NEXT(lock))
+      {
+         for(h=lock->holders; h!=NULL; h=next)
+         {
+            next = h->next;
+            if(now >= h->leaseExpiry)
+            {
+               fprintf(stderr,"qllockd: Lease on lock %s held by %s \
+(%d) expired\n", lock->name, h->hostname, h->clientID);
+               gStats.expiries++;
+               ReleaseHolder(lock, h);
+            }
+         }
+      }
+   }
+}
+
+
+/************************************************************************/
+/*>BOOL RemoveWaiter(CONNECTION *conn)
+   -----------------------------------
+   Input:     CONNECTION  *conn    Client connection
+   Returns:   BOOL                 Was it in the queue?
+
+   Removes a client from the WAITLOCK queue of the lock it is waiting
+   for
+
+   18.10.26 Original   By: ACRM
+*/
+BOOL RemoveWaiter(CONNECTION *conn)
+{
+   CONNECTION *w,
+              *prev = NULL;
+   LOCK       *lock;
+
+   if((lock = conn->waitLock) == NULL)
+      return(FALSE);
+   
+   for(w=lock->waitHead; w!=NULL; w=w->nextWaiter)
+   {
+      if(w == conn)
+      {
+         if(prev == NULL)
+            lock->waitHead = w->nextWaiter;
+         else
+            prev->nextWaiter = w->nextWaiter;
+         if(lock->waitTail == w)
+            lock->waitTail = prev;
+         w->nextWaiter = NULL;
+         w->waitLock   = NULL;
+         return(TRUE);
+      }
+      prev = w;
+   }
+   return(FALSE);
+}
+
+
+/************************************************************************/
+/*>HOLDER *FindHolder(LOCK *lock, CONNECTION *conn, int clientID)
+   --------------------------------------------------------------
+   Input:     LOCK        *lock      The lock
+              CONNECTION  *conn      Client connection
+              int         clientID   Client's instance ID
+   Returns:   HOLDER      *          The client's hold on the lock (NULL
+                                     if it doesn't hold it)
+
+   Finds the holder entry for a client. Several shared holders may come
+   from the same machine and instance, so a lock granted on a session
+   can only be renewed or released from that session. Locks granted on
+   one-off connections are matched by machine and instance.
+
+   18.10.26 Original   By: ACRM (replaces CorrectMachine())
+*/
+HOLDER *FindHolder(LOCK *lock, CONNECTION *conn, int clientID)
+{
+   HOLDER *h;
+
+   for(h=lock->holders; h!=NULL; NEXT(h))
+   {
+      if((h->clientID == clientID) &&
+         ((h->conn == conn) ||
+          ((h->conn == NULL) && !strcmp(h->hostname, conn->hostname))))
+         return(h);
+   }
+   return(NULL);
+}
+
+
+/************************************************************************/
+/*>ULONG NowMsec(void)
+   -------------------
+   Returns:   ULONG            Milliseconds from an arbitrary start
+
+   Monotonic clock used for the statistics so that they are not upset
+   by the system time being changed
+
+   18.10.26 Original   By: ACRM
+*/
+ULONG NowMsec(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return((ULONG)ts.tv_sec * 1000 + (ULONG)(ts.tv_nsec / 1000000));
+}
+
+
+/************************************************************************/
+/*>void AddToHistogram(HISTOGRAM *hist, ULONG msec)
+   ------------------------------------------------
+   Input:     HISTOGRAM  *hist     Histogram
+              ULONG      msec      Time to add
+
+   Counts a time into a histogram of power of two buckets. Bucket 0 
+   counts times under 1msec, bucket n times under 2^n msec and the 
+   last bucket everything longer.
+
+   18.10.26 Original   By: ACRM
+*/
+void AddToHistogram(HISTOGRAM *hist, ULONG msec)
+{
+   int   b = 0;
+   ULONG t;
+
+   for(t=msec; t && (b < NHIST-1); t >>= 1)
+      b++;
+
+   hist->bucket[b]++;
+   hist->count++;
+   hist->total += msec;
+   if(msec > hist->max)
+      hist->max = msec;
+}
+
+
+/************************************************************************/
+/*>void CountConnection(void)
+   --------------------------
+   Counts an accepted connection. One counter is kept for each second
+   of the last RATEWINDOW seconds to give the connection rate.
+
+   18.10.26 Original   By: ACRM
+*/
+void CountConnection(void)
+{
+   time_t now;
+   int    slot;
+
+   time(&now);
+   slot = (int)(now % RATEWINDOW);
+   if(gStats.rateTime[slot] != now)
+   {
+      gStats.rateTime[slot]  = now;
+      gStats.rateCount[slot] = 0;
+   }
+   gStats.rateCount[slot]++;
+   gStats.connections++;
+}
+
+
+/************************************************************************/
+/*>void SendStats(CONNECTION *conn)
+   --------------------------------
+   Input:     CONNECTION  *conn    Client connection
+
+   Replies to STATS with the counters, the hold and wait time 
+   histograms and the current holders of each lock. The reply runs to 
+   several lines (and host names contain dots) so, unlike the other 
+   replies, it is terminated only by the '\0' which SendReply() adds.
+
+   18.10.26 Original   By: ACRM
+*/
+void SendStats(CONNECTION *conn)
+{
+   static char buffer[STATSBUFF];
+   char        *chp = buffer;
+   time_t      now;
+   ULONG       nowMsec = NowMsec(),
+               recent  = 0;
+   LOCK        *lock;
+   HOLDER      *h;
+   CONNECTION  *w;
+   int         i, 
+               nwait,
+               nholders,
+               window;
+
+   time(&now);
+   for(i=0; i<RATEWINDOW; i++)
+   {
+      if(now - gStats.rateTime[i] < RATEWINDOW)
+         recent += gStats.rateCount[i];
+   }
+   window = (int)(now - gStats.started) + 1;
+   if(window > RATEWINDOW)
+      window = RATEWINDOW;
+
+   chp += sprintf(chp, "uptime %ld\n", (long)(now - gStats.started));
+   chp += sprintf(chp, "connections %lu rejected %lu per_sec %.2f\n",
+                  gStats.connections, gStats.rejected, 
+                  (double)recent / window);
+   chp += sprintf(chp, "grants %lu denials %lu queued %lu cancels %lu\n",
+                  gStats.grants, gStats.denials, gStats.queued, 
+                  gStats.cancels);
+   chp += sprintf(chp, "releases %lu expired %lu closed %lu broken %lu\n",
+                  gStats.releases, gStats.expiries, gStats.closes,
+                  gStats.breaks);
+   chp = FormatHistogram(chp, "hold_ms", &(gStats.hold));
+   chp = FormatHistogram(chp, "wait_ms", &(gStats.wait));
+
+   for(i=0; i<LOCKHASHSIZE; i++)
+   {
+      for(lock=gLocks[i]; lock!=NULL; NEXT(lock))
+      {
+         for(nwait=0, w=lock->waitHead; w!=NULL; w=w->nextWaiter)
+            nwait++;
+         for(nholders=0, h=lock->holders; h!=NULL; NEXT(h))
+            nholders++;
+
+         /* Leave room for the END line                                 */
+         if((chp - buffer) + (nholders + 2) * MAXBUFF > STATSBUFF)
+         {
+            chp += sprintf(chp, "truncated\n");
+            i = LOCKHASHSIZE;
+            break;
+         }
+
+         chp += sprintf(chp, "lock %s status %d holders %d waiting %d\n",
+                        lock->name, lock->status, nholders, nwait);
+         for(h=lock->holders; h!=NULL; NEXT(h))
+         {
+            chp += sprintf(chp, "holder %s %d %s held_ms %lu\n",
+                           h->hostname, h->clientID,
+                           ((h->mode == LOCK_SHARED) ? "shared" : 
+                                                       "exclusive"),
+                           nowMsec - h->grantedAt);
+         }
+      }
+   }
+   
+   sprintf(chp, "END.\n");
+   SendReply(conn, buffer);
+}
+
+
+/************************************************************************/
+/*>char *FormatHistogram(char *buffer, char *name, HISTOGRAM *hist)
+   ----------------------------------------------------------------
+   Input:     char       *buffer   Where to write
+              char       *name     Name of the histogram
+              HISTOGRAM  *hist     Histogram
+   Returns:   char       *         End of what was written
+
+   Writes a histogram as one line giving the count, mean and maximum 
+   and then upper_bound:count for each bucket which is not empty
+
+   18.10.26 Original   By: ACRM
+*/
+char *FormatHistogram(char *buffer, char *name, HISTOGRAM *hist)
+{
+   char *chp = buffer;
+   int  b;
+
+   chp += sprintf(chp, "%s count %lu mean %lu max %lu", name,
+                  hist->count,
+                  (hist->count ? (hist->total / hist->count) : 0UL),
+                  hist->max);
+   for(b=0; b<NHIST; b++)
+   {
+      if(hist->bucket[b])
+      {
+         if(b == NHIST-1)
+            chp += sprintf(chp, " inf:%lu", hist->bucket[b]);
+         else
+            chp += sprintf(chp, " %lu:%lu", 1UL << b, hist->bucket[b]);
+      }
+   }
+   chp += sprintf(chp, "\n");
+   
+   return(chp);
+}
+
+/************************************************************************/
+/*>BOOL ParseCmdLine(int argc, char **argv, char *spooldir, int *port)
+   -------------------------------------------------------------------
+   Input:     int   argc         Argument count
+              char  **argv       Arguments
+   Output:    char  *spooldir    Spool directory
+              int   *port        Cluster number
+   Returns:   BOOL               Success?
+
+   Parses the command line
+
+   04.10.00 Original   By: ACRM
+   18.10.26 Added -s which was documented but not handled
+*/
+BOOL ParseCmdLine(int argc, char **argv, char *spooldir, int *port)
+{
+   argc--;
+   argv++;
+
+   *port = 0;
+
+   while(argc)
+   {
+      if(argv[0][0] == '-')
+      {
+         switch(argv[0][1])
+         {
+         case 'd':
+            gDebug = 1;
+            break;
+         case 'p':
+            argv++;
+            argc--;
+            if(!argc)
+               return(FALSE);
+            if(!sscanf(argv[0],"%d", port))
+               return(FALSE);
+            break;
+         case 's':
+            argv++;
+            argc--;
+            if(!argc)
+               return(FALSE);
+            strncpy(spooldir,argv[0],PATH_MAX);
+            break;
+         default:
+            return(FALSE);
+            break;
+         }
+      }
+      else
+      {
+         if(argc > 0)
+            return(FALSE);
+      }
+      
+      argc--;
+      argv++;
+   }
+   
+   return(TRUE);
+}
+
+
+/************************************************************************/
+void error(void)
+{
+   fprintf(stderr,"Died!\n");
+   exit(1);
+}
+
+
+/************************************************************************/
+void Usage(void)
+{
+   fprintf(stderr,"\nqllockd V1.23 (c) Dr. Andrew C.R. Martin, University \
+of Reading\n");
+
+   fprintf(stderr,"\nUsage: qllockd [-p portnum] [-s spooldir]\n");
+   fprintf(stderr,"       -p Specify the port number to listen on\n");
+   fprintf(stderr,"       -s Specify the spool directory\n");
+
+   fprintf(stderr,"\nqllockd listens on the specified port for requests \
+for locks by qlrun\n");
+
+   fprintf(stderr,"\nBy default, it listens on port %d. 'qlite' may be \
+specified as a service\n", DEFAULT_QLPORT);
+   fprintf(stderr,"in /etc/services and a different port may be \
+specified there. The port\n");
+   fprintf(stderr,"specified with -p takes priority over either of \
+those.\n");
+
+   fprintf(stderr,"\nqllockd only grants locks to machines listed in \
+.machinelist in the\n");
+   fprintf(stderr,"spool directory or one of its cluster \
+subdirectories.\n");
+
+   fprintf(stderr,"\nqllockd should only be run on one machine in a \
+cluster (in fact it\n");
+   fprintf(stderr,"may be run on a machine not in the cluster \
+itself). One qllockd may\n");
+   fprintf(stderr,"serve all the clusters as each has its own \
+lock.\n\n");
+}
+
+
+/************************************************************************/
+/*>void HandleHUP(int signum)
+   --------------------------
+   Signal handler for SIGHUP. Just flags that the lock should be broken;
+   the work is done by BreakLock() from the event loop.
+
+   25.11.02 Original   By: ACRM
+   18.10.26 Now just sets a flag
+*/
+void HandleHUP(int signum)
+{
+   (void)signum;
+   gBreakLock = 1;
+   signal(SIGHUP, HandleHUP);
+}
+
+
+/************************************************************************/
+/*>void BreakLock(void)
+   --------------------
+   Releases stuck locks after a SIGHUP and passes each on to the next
+   client in its queue
+
+   18.10.26 Original   By: ACRM (from code in HandleHUP())
+   18.10.26 Breaks every lock in the table
+*/
+void BreakLock(void)
+{
+   LOCK   *lock;
+   HOLDER *h;
+   int    i;
+   BOOL   held = FALSE;
+   
+   gBreakLock = 0;
+   
+   for(i=0; i<LOCKHASHSIZE; i++)
+   {
+      for(lock=gLocks[i]; lock!=NULL; NEXT(lock))
+      {
+         if(lock->status == STATUS_UNLOCKED)
+            continue;
+
+         held = TRUE;
+         if(gDebug)
+            fprintf(stderr,"Lock %s released by SIGHUP\n", lock->name);
+
+         /* Drop every holder before passing the lock on                */
+         while((h = lock->holders) != NULL)
+         {
+            lock->holders = h->next;
+            AddToHistogram(&(gStats.hold), NowMsec() - h->grantedAt);
+            gStats.breaks++;
+            free(h);
+         }
+         lock->status = STATUS_UNLOCKED;
+         GrantNextWaiter(lock);
+      }
+   }
+   
+   if(!held && gDebug)
+      fprintf(stderr,"No lock held\n");
+}
+
+
+/************************************************************************/
+/*>void ScanSpool(char *spoolDir, BOOL rescan)
+   --------------------------------------------
+   Input:     char   *spoolDir     Top level spool directory
+              BOOL   rescan        Only add jobs missing from the index
+
+   Builds the job index at startup from the job records already waiting
+   in the default cluster and each cluster subdirectory. After this the
+   index is kept up to date by ENQUEUE and DEQUEUE.
+
+   A job whose ENQUEUE was lost (qlsubmit could not reach us) would
+   never be handed out, so the spool is also rescanned from time to 
+   time. Then only jobs which are not in the index and whose record has
+   been left alone for RESCAN_AGE seconds, so that their ENQUEUE can no
+   longer be on its way, are added. A job which has been handed out but
+   not yet claimed may come back this way; qlrun finds it has gone and
+   asks again.
+
+   18.10.26 Original   By: ACRM
+   18.10.26 readdir() order no longer matters since the index is a heap
+   18.10.26 Reads each job's priority from its control file
+   18.10.26 Job arrays are indexed from their next task
+   18.10.26 Reads single job records rather than control files
+   18.10.26 Reads a cluster's journal index rather than its directory
+            if it has one
+   18.10.26 Added rescan
+*/
+void ScanSpool(char *spoolDir, BOOL rescan)
+{
+   struct dirent *dirp;
+   DIR           *dp;
+   char          dirName[PATH_MAX],
+                 *chp;
+   ULONG         jobnum;
+   int           cluster,
+                 nknown = 0;
+   char          jobFile[2*PATH_MAX];
+   JOBRECORD     rec;
+   JNLENTRY      *jobs;
+   ULONG         njobs,
+                 i,
+                 *known = NULL;
+   time_t        before;
+
+   gRescan = 0;
+   before  = time(NULL) - RESCAN_AGE;
+
+   for(cluster=0; cluster<=MAXCLUSTER; cluster++)
+   {
+      strcpy(dirName, spoolDir);
+      UpdateSpoolDir(dirName, cluster);
+
+      if(rescan)
+      {
+         free(known);
+         if(((known = IndexedJobs(cluster, &nknown)) == NULL) &&
+            nknown)
+            continue;
+      }
+
+      if(JournalEnabled(dirName))
+      {
+         if((jobs = JournalWaitingJobs(dirName, &njobs)) != NULL)
+         {
+            for(i=0; i<njobs; i++)
+            {
+               if(rescan)
+               {
+                  sprintf(jobFile, "%s/%s/" JNL_SEGMENT, dirName, 
+                          JOURNAL_DIR, jobs[i].segment);
+                  if(!Unindexed(jobs[i].jobnum, jobFile, before, 
+                                known, nknown))
+                     continue;
+               }
+               IndexSpoolJob(cluster, dirName, jobs[i].jobnum, 
+                             jobs[i].priority, jobs[i].firstTask, 
+                             jobs[i].lastTask, rescan);
+            }
+            free(jobs);
+         }
+         if(gDebug && gQueues[cluster].njobs)
+            printf("%d jobs waiting on cluster %d\n", 
+                   gQueues[cluster].njobs, cluster);
+         continue;
+      }
+
+      if((dp=opendir(dirName)) == NULL)
+         continue;
+
+      while((dirp = readdir(dp)) != NULL)
+      {
+         if((dirp->d_name[0] != '.') &&
+            ((chp=strstr(dirp->d_name, ".job"))!=NULL) &&
+            !strcmp(chp, ".job") &&
+            (sscanf(dirp->d_name, "%lu", &jobnum) == 1))
+         {
+            sprintf(jobFile, "%s/%s", dirName, dirp->d_name);
+            if(rescan && 
+               !Unindexed(jobnum, jobFile, before, known, nknown))
+               continue;
+            if(ReadJobRecord(jobFile, &rec))
+               IndexSpoolJob(cluster, dirName, jobnum, rec.priority,
+                             rec.firstTask, rec.lastTask, rescan);
+         }
+      }
+      closedir(dp);
+
+      if(gDebug && gQueues[cluster].njobs)
+         printf("%d jobs waiting on cluster %d\n", 
+                gQueues[cluster].njobs, cluster);
+   }
+
+   free(known);
+}
+
+
+/************************************************************************/
+/*>ULONG *IndexedJobs(int cluster, int *nknown)
+   --------------------------------------------
+   Input:     int    cluster     Cluster number
+   Output:    int    *nknown     Number of jobs in its index
+   Returns:   ULONG  *           Sorted job numbers (NULL if there are
+                                 none or no memory)
+
+   Lists the jobs in a cluster's index so that ScanSpool() can look 
+   them up with bsearch()
+
+   18.10.26 Original   By: ACRM
+*/
+ULONG *IndexedJobs(int cluster, int *nknown)
+{
+   JOBQUEUE *q = &(gQueues[cluster]);
+   ULONG    *known;
+   int      i;
+
+   if(((*nknown = q->njobs) == 0) ||
+      ((known = (ULONG *)malloc(q->njobs * sizeof(ULONG))) == NULL))
+      return(NULL);
+
+   for(i=0; i<q->njobs; i++)
+      known[i] = q->jobs[i].jobnum;
+   qsort(known, q->njobs, sizeof(ULONG), CompareJobnums);
+
+   return(known);
+}
+
+
+/************************************************************************/
+/*>int CompareJobnums(const void *a, const void *b)
+   ------------------------------------------------
+   Input:     const void *a      A job number
+              const void *b      Another
+   Returns:   int                <0, 0 or >0 as a is below, equal to or
+                                 above b
+
+   Comparison for qsort() and bsearch() of job numbers
+
+   18.10.26 Original   By: ACRM
+*/
+int CompareJobnums(const void *a, const void *b)
+{
+   ULONG ja = *(const ULONG *)a,
+         jb = *(const ULONG *)b;
+
+   return((ja > jb) - (ja < jb));
+}
+
+
+/************************************************************************/
+/*>BOOL Unindexed(ULONG jobnum, char *file, time_t before, ULONG *known,
+                  int nknown)
+   ---------------------------------------------------------------------
+   Input:     ULONG  jobnum      Job number
+              char   *file       File holding its record
+              time_t before      Records changed since then are skipped
+              ULONG  *known      Sorted job numbers in the index
+              int    nknown      How many there are
+   Returns:   BOOL               Should a rescan add the job?
+
+   A job is added by a rescan if it is not in the index and its record
+   has not been written since before
+
+   18.10.26 Original   By: ACRM
+*/
+BOOL Unindexed(ULONG jobnum, char *file, time_t before, ULONG *known, 
+               int nknown)
+{
+   struct stat statbuff;
+
+   if(nknown &&
+      (bsearch(&jobnum, known, nknown, sizeof(ULONG), CompareJobnums)
+       != NULL))
+      return(FALSE);
+
+   return(!stat(file, &statbuff) && (statbuff.st_mtime < before));
+}
+
+
+/************************************************************************/
+/*>void IndexSpoolJob(int cluster, char *dirName, ULONG jobnum, 
+                      int priority, ULONG firstTask, ULONG lastTask,
+                      BOOL rescan)
+   -----------------------------------------------------------------
+   Input:     int    cluster     Cluster number
+              char   *dirName    The cluster's spool directory
+              ULONG  jobnum      Job number
+              int    priority    Job priority
+              ULONG  firstTask   First task of a job array (0 if none)
+              ULONG  lastTask    Last task of a job array
+              BOOL   rescan      From a rescan rather than at startup
+
+   Adds a job found by ScanSpool() to the index. A job array carries 
+   on from the first task which qlrun has not yet recorded as started.
+   On a rescan an array which has started is left alone; it was
+   enqueued, so the tasks it has left are already with a qlrun.
+
+   18.10.26 Original   By: ACRM (from ScanSpool())
+   18.10.26 Added rescan
+*/
+void IndexSpoolJob(int cluster, char *dirName, ULONG jobnum, 
+                   int priority, ULONG firstTask, ULONG lastTask,
+                   BOOL rescan)
+{
+   ULONG nextTask,
+         nDone;
+
+   if(firstTask &&
+      ReadTaskProgress(dirName, jobnum, &nextTask, &nDone))
+   {
+      if(rescan)
+         return;
+      if(nextTask > firstTask)
+         firstTask = nextTask;
+   }
+
+   if(firstTask <= lastTask)
+   {
+      if(gDebug && rescan)
+         printf("Rescan found job %lu on cluster %d\n", jobnum, cluster);
+      AddToQueue(cluster, jobnum, priority, firstTask, lastTask);
+   }
+}
+
+
+/************************************************************************/
+/*>BOOL AddToQueue(int cluster, ULONG jobnum, int priority, 
+                   ULONG firstTask, ULONG lastTask)
+   --------------------------------------------------------
+   Input:     int    cluster     Cluster number
+              ULONG  jobnum      Job number
+              int    priority    Job priority
+              ULONG  firstTask   First task of a job array (0 if none)
+              ULONG  lastTask    Last task of a job array
+   Returns:   BOOL               Success?
+
+   Adds a job to a cluster's queue, growing it as needed. The queue is a
+   binary heap ordered by CompareJobs() so a job which is re-enqueued 
+   (e.g. recovered after a node crashed) still goes out in job order
+   rather than behind everything submitted since. A job array takes a
+   single entry however many tasks it has.
+
+   18.10.26 Original   By: ACRM
+   18.10.26 Heap rather than circular buffer
+   18.10.26 Added priority
+   18.10.26 Added firstTask and lastTask
+*/
+BOOL AddToQueue(int cluster, ULONG jobnum, int priority, 
+                ULONG firstTask, ULONG lastTask)
+{
+   JOBQUEUE  *q = &(gQueues[cluster]);
+   QUEUEDJOB *jobs,
+             job;
+   int       i, 
+             parent,
+             newSize;
+
+   job.jobnum   = jobnum;
+   job.priority = priority;
+   job.task     = firstTask;
+   job.lastTask = lastTask;
+
+   if(q->njobs == q->size)
+   {
+      newSize = (q->size ? 2 * q->size : 64);
+      if((jobs = (QUEUEDJOB *)realloc(q->jobs, 
+                                      newSize * sizeof(QUEUEDJOB)))
+         == NULL)
+         return(FALSE);
+      q->jobs = jobs;
+      q->size = newSize;
+   }
+
+   /* Sift the new job up from the bottom of the heap                   */
+   for(i=q->njobs; i>0; i=parent)
+   {
+      parent = (i - 1) / 2;
+      if(CompareJobs(&(q->jobs[parent]), &job) <= 0)
+         break;
+      q->jobs[i] = q->jobs[parent];
+   }
+   q->jobs[i] = job;
+   q->njobs++;
+   
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>ULONG TakeFromQueue(int cluster, ULONG *task)
+   ---------------------------------------------
+   Input:     int    cluster     Cluster number
+   Output:    ULONG  *task       Task index if the job is an array (else
+                                 0)
+   Returns:   ULONG              Job number (0 if nothing waiting)
+
+   Removes the first job (highest priority, then lowest job number) 
+   from a cluster's queue. A job array hands out its next task and 
+   only leaves the queue once its last task has gone; it stays at the
+   top meanwhile, so that takes no reordering.
+
+   18.10.26 Original   By: ACRM
+   18.10.26 Heap rather than circular buffer
+   18.10.26 Added task
+*/
+ULONG TakeFromQueue(int cluster, ULONG *task)
+{
+   JOBQUEUE  *q = &(gQueues[cluster]);
+   QUEUEDJOB last;
+   ULONG     jobnum;
+   int       i, 
+             child;
+
+   *task = 0;
+   if(q->njobs == 0)
+      return(0);
+
+   jobnum = q->jobs[0].jobnum;
+   *task  = q->jobs[0].task;
+   if(*task && (*task < q->jobs[0].lastTask))
+   {
+      q->jobs[0].task++;
+      return(jobnum);
+   }
+
+   last   = q->jobs[--(q->njobs)];
+
+   /* Sift the last job down from the top to fill the gap               */
+   for(i=0; (child = 2*i + 1) < q->njobs; i=child)
+   {
+      if((child+1 < q->njobs) &&
+         (CompareJobs(&(q->jobs[child+1]), &(q->jobs[child])) < 0))
+         child++;
+      if(CompareJobs(&last, &(q->jobs[child])) <= 0)
+         break;
+      q->jobs[i] = q->jobs[child];
+   }
+   q->jobs[i] = last;
+
+   return(jobnum);
+}
+
+
+/************************************************************************/
+/*>void ParkConnection(CONNECTION *conn, int cluster, int wait)
+   ------------------------------------------------------------
+   Input:     CONNECTION  *conn     Client connection
+              int         cluster   Cluster number
+              int         wait      Max time to wait (seconds)
+
+   Parks an idle qlrun which has asked for a job when there is none. It
+   gets the next job enqueued for the cluster or, if none arrives in 
+   time, is sent NONE by DropIdleConnections().
+
+   18.10.26 Original   By: ACRM
+*/
+void ParkConnection(CONNECTION *conn, int cluster, int wait)
+{
+   JOBQUEUE *q = &(gQueues[cluster]);
+
+   if(wait > MAX_IDLEWAIT)
+      wait = MAX_IDLEWAIT;
+   
+   conn->state       = CONN_IDLE;
+   conn->idleCluster = cluster;
+   conn->nextWaiter  = NULL;
+   time(&(conn->idleUntil));
+   conn->idleUntil  += wait;
+
+   if(q->idleTail == NULL)
+      q->idleHead = conn;
+   else
+      q->idleTail->nextWaiter = conn;
+   q->idleTail = conn;
+
+   if(gDebug)
+      printf("%s waiting for a job on cluster %d\n", 
+             conn->hostname, cluster);
+}
+
+
+/************************************************************************/
+/*>BOOL UnparkConnection(CONNECTION *conn)
+   ---------------------------------------
+   Input:     CONNECTION  *conn    Client connection
+   Returns:   BOOL                 Was it parked?
+
+   Removes a qlrun from the list of those waiting for a job on its
+   cluster
+
+   18.10.26 Original   By: ACRM
+*/
+BOOL UnparkConnection(CONNECTION *conn)
+{
+   JOBQUEUE   *q = &(gQueues[conn->idleCluster]);
+   CONNECTION *w,
+              *prev = NULL;
+
+   for(w=q->idleHead; w!=NULL; w=w->nextWaiter)
+   {
+      if(w == conn)
+      {
+         if(prev == NULL)
+            q->idleHead = w->nextWaiter;
+         else
+            prev->nextWaiter = w->nextWaiter;
+         if(q->idleTail == w)
+            q->idleTail = prev;
+         w->nextWaiter = NULL;
+         return(TRUE);
+      }
+      prev = w;
+   }
+   return(FALSE);
+}
+
+
+/************************************************************************/
+/*>int CompareJobs(const void *a, const void *b)
+   ---------------------------------------------
+   Comparison function used to order the job index. Higher priority 
+   jobs come first and jobs of equal priority are in job number order.
+
+   18.10.26 Original   By: ACRM
+   18.10.26 Compares priority before job number
+*/
+int CompareJobs(const void *a, const void *b)
+{
+   const QUEUEDJOB *ja = (const QUEUEDJOB *)a,
+                   *jb = (const QUEUEDJOB *)b;
+
+   if(ja->priority != jb->priority)
+      return((ja->priority > jb->priority) ? -1 : 1);
+   return((ja->jobnum < jb->jobnum) ? -1 : 
+          ((ja->jobnum > jb->jobnum) ? 1 : 0));
+}
+
+
+/************************************************************************/
+/*>BOOL IssueJobIds(int cluster, ULONG njobs, ULONG *firstJob)
+   -----------------------------------------------------------
+   Input:     int    cluster     Cluster number
+              ULONG  njobs       Number of job numbers wanted
+   Output:    ULONG  *firstJob   First of njobs consecutive job numbers
+   Returns:   BOOL               Success?
+
+   Hands out job numbers from the counter for a cluster. The counter is
+   kept in memory and .qllastjob in the cluster's spool directory only
+   records a ceiling which is moved on ID_BATCH numbers beyond what is
+   needed whenever it is reached. A job number is never handed out 
+   until the ceiling covering it is safely on disk, so after a crash
+   counting carries on from the ceiling; the numbers skipped are simply
+   never used.
+
+   .qllastjob is read again whenever the ceiling is moved, so numbers
+   taken by a qlsubmit which updated it directly (as it does when using
+   an older qllockd) are not handed out again.
+
+   Counting never wraps round to 1, since that could hand out the 
+   number of a job which is still waiting. Once the numbers run out 
+   none are issued.
+
+   18.10.26 Original   By: ACRM
+   18.10.26 Refuses rather than wrapping round
+*/
+BOOL IssueJobIds(int cluster, ULONG njobs, ULONG *firstJob)
+{
+   JOBQUEUE *q = &(gQueues[cluster]);
+   char     dirName[PATH_MAX];
+   ULONG    onDisk,
+            ceiling;
+
+   if(njobs > (q->idCeiling - q->lastId))
+   {
+      strcpy(dirName, gSpoolDir);
+      UpdateSpoolDir(dirName, cluster);
+      if(!CheckForSpoolDir(dirName))
+         return(FALSE);
+
+      if((onDisk = ReadLastJob(dirName)) > q->idCeiling)
+         q->lastId = onDisk;
+
+      if(q->lastId > ((ULONG)(-1) - njobs - ID_BATCH))
+      {
+         fprintf(stderr,"qllockd: Job numbers on cluster %d have run \
+out\n", cluster);
+         return(FALSE);
+      }
+
+      ceiling = q->lastId + njobs + ID_BATCH;
+      if(!WriteLastJob(dirName, ceiling))
+         return(FALSE);
+      q->idCeiling = ceiling;
+
+      if(gDebug)
+         printf("Job numbers on cluster %d reserved up to %lu\n",
+                cluster, ceiling);
+   }
+
+   *firstJob  = q->lastId + 1;
+   q->lastId += njobs;
+
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>void HandleUSR1(int signum)
+   ---------------------------
+   Signal handler for SIGUSR1. Flags that the machine list should be
+   re-read by ReloadMachineList() and the spool rescanned by 
+   ScanSpool() from the event loop.
+
+   18.10.26 Original   By: ACRM
+   18.10.26 Also rescans the spool
+*/
+void HandleUSR1(int signum)
+{
+   (void)signum;
+   gReload = 1;
+   gRescan = 1;
+   signal(SIGUSR1, HandleUSR1);
+}
+
+
+/************************************************************************/
+/*>void ReloadMachineList(char *spoolDir)
+   --------------------------------------
+   Input:     char   *spoolDir     Spool directory
+
+   Re-reads the machine list. The new table is built completely before
+   it replaces the old one, which is kept if the list can't be read.
+
+   18.10.26 Original   By: ACRM
+*/
+void ReloadMachineList(char *spoolDir)
+{
+   HOSTTABLE *table;
+
+   gReload = 0;
+
+   if((table = BuildHostTable(spoolDir)) == NULL)
+   {
+      fprintf(stderr,"qllockd: Unable to re-read machine list - \
+keeping the old one\n");
+      return;
+   }
+
+   FreeHostTable(gAllowedHosts);
+   gAllowedHosts = table;
+   
+   if(gDebug)
+      printf("Machine list re-read: %d addresses\n", table->nhosts);
+}
+
+
+/************************************************************************/
+/*>HOSTTABLE *BuildHostTable(char *spoolDir)
+   -----------------------------------------
+   Input:     char       *spoolDir   Spool directory
+   Returns:   HOSTTABLE  *           Table of allowed addresses (NULL if
+                                     no machine list can be read)
+
+   Reads the machine lists for the default cluster and each cluster
+   subdirectory and looks up every address of each machine, storing 
+   them in a hash table keyed by address
+
+   18.10.26 Original   By: ACRM
+   18.10.26 Reads the machine list of every cluster
+*/
+HOSTTABLE *BuildHostTable(char *spoolDir)
+{
+   HOSTTABLE      *table;
+   char           dirName[PATH_MAX];
+   int            cluster;
+   
+   if((table = (HOSTTABLE *)calloc(1, sizeof(HOSTTABLE))) == NULL)
+      return(NULL);
+
+   for(cluster=0; cluster<=MAXCLUSTER; cluster++)
+   {
+      strcpy(dirName, spoolDir);
+      UpdateSpoolDir(dirName, cluster);
+      if(!AddMachineList(table, dirName))
+      {
+         FreeHostTable(table);
+         return(NULL);
+      }
+   }
+
+   if(table->nhosts == 0)
+   {
+      FreeHostTable(table);
+      return(NULL);
+   }
+   
+   return(table);
+}
+
+
+/************************************************************************/
+/*>BOOL AddMachineList(HOSTTABLE *table, char *spoolDir)
+   -----------------------------------------------------
+   Input:     HOSTTABLE  *table      Table of allowed addresses
+              char       *spoolDir   Spool directory for one cluster
+   Returns:   BOOL                   Success? (a missing machine list is
+                                     not an error)
+
+   Adds every address of each machine in a cluster's machine list to
+   the table
+
+   18.10.26 Original   By: ACRM (from code in BuildHostTable())
+*/
+BOOL AddMachineList(HOSTTABLE *table, char *spoolDir)
+{
+   RUNFILE        *runfiles,
+                  *r;
+   struct hostent *host;
+   char           machine[MAXBUFF],
+                  **addr;
+   BOOL           ok = TRUE;
+   
+   if((runfiles = ReadMachineList(spoolDir)) == NULL)
+      return(TRUE);
+
+   for(r=runfiles; ok && (r!=NULL); NEXT(r))
+   {
+      sscanf(r->node, "%s", machine);
+      if((host = gethostbyname(machine)) == NULL)
+      {
+         fprintf(stderr,"qllockd: Can't find address of %s\n", 
+                 machine);
+         continue;
+      }
+
+      for(addr=host->h_addr_list; *addr!=NULL; addr++)
+      {
+         if(!AddHost(table, ((struct in_addr *)*addr)->s_addr, 
+                     machine))
+         {
+            ok = FALSE;
+            break;
+         }
+      }
+   }
+
+   /* Free the machine list                                             */
+   while(runfiles != NULL)
+   {
+      r = runfiles;
+      NEXT(runfiles);
+      free(r);
+   }
+   
+   return(ok);
+}
+
+
+/************************************************************************/
+/*>BOOL AddHost(HOSTTABLE *table, in_addr_t addr, char *name)
+   ----------------------------------------------------------
+   Input:     HOSTTABLE  *table      Allowed host table
+              in_addr_t  addr        An address
+              char       *name       Machine name for that address
+   Returns:   BOOL                   Success?
+
+   Adds an address to the table unless it is already there (a machine
+   appears once for each qlrun instance in the machine list)
+
+   18.10.26 Original   By: ACRM
+*/
+BOOL AddHost(HOSTTABLE *table, in_addr_t addr, char *name)
+{
+   ALLOWEDHOST *host;
+   int         bucket;
+   
+   if(FindHost(table, addr) != NULL)
+      return(TRUE);
+
+   if((host = (ALLOWEDHOST *)malloc(sizeof(ALLOWEDHOST))) == NULL)
+      return(FALSE);
+
+   host->addr = addr;
+   strncpy(host->name, name, MAXBUFF-1);
+   host->name[MAXBUFF-1] = '\0';
+
+   bucket = HashAddress(addr);
+   host->next = table->buckets[bucket];
+   table->buckets[bucket] = host;
+   table->nhosts++;
+
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>ALLOWEDHOST *FindHost(HOSTTABLE *table, in_addr_t addr)
+   -------------------------------------------------------
+   Input:     HOSTTABLE    *table    Allowed host table
+              in_addr_t    addr      An address
+   Returns:   ALLOWEDHOST  *         The entry for the address (NULL if
+                                     it is not allowed)
+
+   18.10.26 Original   By: ACRM
+*/
+ALLOWEDHOST *FindHost(HOSTTABLE *table, in_addr_t addr)
+{
+   ALLOWEDHOST *host;
+
+   if(table == NULL)
+      return(NULL);
+   
+   for(host=table->buckets[HashAddress(addr)]; host!=NULL; NEXT(host))
+   {
+      if(host->addr == addr)
+         return(host);
+   }
+   return(NULL);
+}
+
+
+/************************************************************************/
+/*>void FreeHostTable(HOSTTABLE *table)
+   ------------------------------------
+   Input:     HOSTTABLE  *table      Allowed host table
+
+   18.10.26 Original   By: ACRM
+*/
+void FreeHostTable(HOSTTABLE *table)
+{
+   ALLOWEDHOST *host;
+   int         i;
+
+   if(table == NULL)
+      return;
+
+   for(i=0; i<HOSTHASHSIZE; i++)
+   {
+      while((host = table->buckets[i]) != NULL)
+      {
+         table->buckets[i] = host->next;
+         free(host);
+      }
+   }
+   free(table);
+}
+
+
+/************************************************************************/
+/*>int HashAddress(in_addr_t addr)
+   -------------------------------
+   Input:     in_addr_t  addr        An address
+   Returns:   int                    Hash bucket
+
+   Fibonacci hash of an IPv4 address
+
+   18.10.26 Original   By: ACRM
+*/
+int HashAddress(in_addr_t addr)
+{
+   return((int)((((ULONG)ntohl(addr) * 2654435761UL) & 0xffffffffUL) 
+                >> (32 - HOSTHASHBITS)));
+}
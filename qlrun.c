@@ -3,8 +3,8 @@
    Program:    qlrun
    File:       qlrun.c
    
-   Version:    V1.1
-   Date:       15.09.00
+   Version:    V1.6
+   Date:       18.10.26
    Function:   Run queued jobs on farm machines
    
    Copyright:  (c) University of Reading / Dr. Andrew C. R. Martin 2000
@@ -50,6 +50,13 @@
 
    Revision History:
    =================
+   V1.2  18.10.26  Added -j to run several jobs at once
+   V1.3  18.10.26  Added -b to take a batch of jobs at once
+   V1.4  18.10.26  Jobs are started directly. Added -L to run them through
+                   su -
+   V1.5  18.10.26  Jobs are supervised from one epoll() loop. Added -g
+   V1.6  18.10.26  Jobs are copied to /var/spool/qlrun rather than /tmp,
+                   and the copies are always created afresh
 
 *************************************************************************/
 /* Includes
@@ -70,8 +77,17 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/syscall.h>
+#include <sys/sysinfo.h>
+#include <stdint.h>
 
 #include <pwd.h>
+#include <grp.h>
 
 #include "qlutil.h"
 
@@ -81,30 +97,70 @@
 #define POLL_PAUSE 30
 #define JOB_PAUSE 1
 #define MAXBUFF 160
-#define JOB_DIR "/tmp"
+#define JOB_DIR "/var/spool/qlrun" /* Local copies of running jobs   */
 #define SHELL   "/bin/sh"
+#define SU      "/bin/su"
+#define JOB_PATH "/usr/local/bin:/usr/bin:/bin"
 #define SENDMAIL "/usr/lib/sendmail -t"
+#define BATCH_MSEC 10000   /* Aim for a batch of jobs to take this long */
+#define GRACE_TIME 30      /* Default time from SIGTERM to SIGKILL      */
+#define MAXEVENTS  32      /* Events handled per epoll_wait()           */
+#define EV_TIMER   1       /* Event is from a slot's timer not its job  */
+#define EV_LOCKSOCK ((uint64_t)(-1)) /* Event is from the qllockd socket */
+
+typedef struct
+{
+   struct timeval started;  /* When the batch was started               */
+   ULONG          jobids[MAXBATCH], /* Jobs in the batch                */
+                  tasks[MAXBATCH],  /* Their task indices (0 = not an 
+                                       array)                           */
+                  jobid,    /* Running job                              */
+                  task;     /* Its task index                           */
+   char           jobname[MAXBUFF], /* Unique name of the running job   */
+                  jobfile[PATH_MAX],/* File submitted as the job        */
+                  username[MAXBUFF];/* Owner of the running job         */
+   pid_t          pid;      /* Job's process group (0 = none running)   */
+   int            pidfd,    /* Readable when the job finishes           */
+                  timerfd,  /* Fires when the job runs out of time      */
+                  njobs,    /* Number of jobs in the batch              */
+                  next,     /* Next job in the batch to start           */
+                  instance; /* Run instance number for the slot         */
+   BOOL           termSent; /* Job has been sent SIGTERM                */
+}  SLOT;
 
 
 /************************************************************************/
 /* Globals
 */
-int gDebug = 0;
+int  gDebug      = 0,
+     gGraceTime  = GRACE_TIME;
+BOOL gLoginShell = FALSE;
 extern char **environ;
 
 /************************************************************************/
 /* Prototypes
 */
 int   main(int argc, char **argv);
-void  QLRun(char *spoolDir, int maxnice, int instance, int tlimit);
+void  QLRun(char *spoolDir, int cluster, int maxnice, int instance, 
+            int tlimit, int nslots, int maxbatch);
 BOOL  ParseCmdLine(int argc, char **argv, char *spoolDir, int *cluster,
                    int *nice, BOOL *asDaemon, int *instance, int *tlimit,
-                   char *lockhost, int *port);
+                   char *lockhost, int *port, int *nslots, int *maxbatch);
 void  Usage(void);
 char  *GetJob(ULONG jobid, char *spoolDir);
+char  *GetTask(ULONG jobid, ULONG task, char *spoolDir);
+BOOL  UpdateTasks(char *spoolDir, ULONG jobid, ULONG task, BOOL done);
+void  FinishTask(char *spoolDir, ULONG jobid, ULONG task);
+char  *ClaimDir(char *spoolDir);
+BOOL  ClaimJob(ULONG jobid, char *spoolDir, char *claimDir);
+BOOL  ReadSpoolRecord(char *file, JOBRECORD *rec);
+BOOL  FindSpoolJob(char *spoolDir, ULONG jobid, JOBRECORD *rec);
+void  RecoverClaimedJobs(char *spoolDir, int cluster);
+void  RecoverClaimDir(char *spoolDir, char *claimDir, int cluster);
 void  RunJob(char *spoolDir, char *jobname, int maxnice, int instance,
              int tlimit);
 ULONG JobWaiting(char *spoolDir);
+BOOL  MakeJobDir(void);
 void  DeleteJob(char *jobname);
 BOOL  GetJobInfo(char *jobname, uid_t *uid, gid_t *gid, int *nice,
                  char *jobfile);
@@ -115,7 +171,22 @@ void DeleteRunFile(char *spoolDir, int instance);
 void WriteRunFile(char *spoolDir, char *jobname, char *jobfile,
                   char *username, int nice, int instance);
 void Email(char *username, char *jobfile);
-int system_tlimit(char *command, int timelimit);
+pid_t LaunchJob(struct passwd *pwd, gid_t gid, int nice, char *jobname,
+                ULONG task);
+char *NodeName(void);
+SLOT *InitSlots(int epfd, int nslots, int instance);
+void FreeSlots(SLOT *slots, int nslots);
+int RunBatches(int epfd, SLOT *slots, int nslots, char *spoolDir, 
+               int maxnice, int tlimit, ULONG *jobMsec);
+BOOL StartJob(int epfd, SLOT *slot, int slotnum, char *spoolDir, 
+              char *jobname, int maxnice, int tlimit);
+void FinishJob(SLOT *slot, char *spoolDir);
+BOOL SuperviseSlots(int epfd, SLOT *slots, int nslots, char *spoolDir,
+                    int timeout);
+void TimeUp(SLOT *slot);
+void SetTimer(int timerfd, int secs);
+void WatchLockSocket(int epfd);
+int BatchSize(ULONG jobMsec, int maxbatch);
 
 
 /************************************************************************/
@@ -128,6 +199,7 @@ int system_tlimit(char *command, int timelimit);
    Main program for the qlrun daemon
 
    15.09.00 Original  By: ACRM
+   18.10.26 Checks JOB_DIR with MakeJobDir()
 */
 int main(int argc, char **argv)
 {
@@ -135,16 +207,20 @@ int main(int argc, char **argv)
        instance = 1,
        tlimit   = 0,
        maxnice  = 0,
-       port     = 0;
+       port     = 0,
+       nslots   = 1,
+       maxbatch = 1;
    char spoolDir[PATH_MAX],
-        lockhost[MAXBUFF];
+        lockhost[MAXBUFF],
+        lockName[MAXLOCKNAME];
    BOOL asDaemon = TRUE;
 
    /* Get the default spool directory                                   */
    strcpy(spoolDir, DEF_SPOOLDIR);
 
    if(ParseCmdLine(argc, argv, spoolDir, &cluster, &maxnice, &asDaemon,
-                   &instance, &tlimit, lockhost, &port))
+                   &instance, &tlimit, lockhost, &port, &nslots,
+                   &maxbatch))
    {
       if((!gDebug) && !RootUser())
       {
@@ -162,6 +238,13 @@ int main(int argc, char **argv)
          return(1);
       }
 
+      if(!MakeJobDir())
+      {
+         fprintf(stderr,"%s must be a directory owned by and only \
+writable by root\n", JOB_DIR);
+         return(1);
+      }
+
       /* If there is a shutdown file, remove it                         */
       RemoveShutdownFile(spoolDir);
          
@@ -191,9 +274,12 @@ the spool directory or the -l flag\n");
          }
       }
 
-      if(InitLocks("qlite", lockhost, port))
+      sprintf(lockName, "%d", cluster);
+      if(InitLocks("qlite", lockhost, port, lockName))
       {
-         QLRun(spoolDir, maxnice, instance, tlimit);
+         RecoverClaimedJobs(spoolDir, cluster);
+         QLRun(spoolDir, cluster, maxnice, instance, tlimit, nslots,
+               maxbatch);
       }
       else
       {
@@ -212,7 +298,8 @@ the spool directory or the -l flag\n");
 /************************************************************************/
 /*>BOOL ParseCmdLine(int argc, char **argv, char *spoolDir, int *cluster,
                      int *nice, BOOL *asDaemon, int *instance, 
-                     int *tlimit)
+                     int *tlimit, char *lockhost, int *port, int *nslots,
+                     int *maxbatch)
    ----------------------------------------------------------------------
    Input:     int    argc        Argument count
               char   *argv       Arguments
@@ -223,16 +310,24 @@ the spool directory or the -l flag\n");
               int    *instance   Run instance number
               int    *tlimit     Time limit for a job running under this
                                  daemon
+              char   *lockhost   Host running the lock daemon
+              int    *port       Port for the lock daemon
+              int    *nslots     Number of jobs to run at once
+              int    *maxbatch   Most jobs to take from the queue at once
    Returns:   BOOL               Success
 
    Parses the command line
 
    15.09.00 Original  By: ACRM
    02.10.00 Added instance and tlimit
+   18.10.26 Added nslots (-j)
+   18.10.26 Added maxbatch (-b)
+   18.10.26 Added -L and -g
 */
 BOOL ParseCmdLine(int argc, char **argv, char *spoolDir, int *cluster,
                   int *nice, BOOL *asDaemon, int *instance, int *tlimit,
-                  char *lockhost, int *port)
+                  char *lockhost, int *port, int *nslots, 
+                  int *maxbatch)
 {
    argc--;
    argv++;
@@ -281,6 +376,19 @@ BOOL ParseCmdLine(int argc, char **argv, char *spoolDir, int *cluster,
             *asDaemon = FALSE;
             gDebug = 1;
             break;
+         case 'L':
+            gLoginShell = TRUE;
+            break;
+         case 'g':
+            argv++;
+            argc--;
+            if(!argc)
+               return(FALSE);
+            if(!sscanf(argv[0],"%d", &gGraceTime))
+               return(FALSE);
+            if(gGraceTime < 0)
+               gGraceTime = 0;
+            break;
          case 'i':
             argv++;
             argc--;
@@ -306,6 +414,30 @@ BOOL ParseCmdLine(int argc, char **argv, char *spoolDir, int *cluster,
                return(FALSE);
             *tlimit *= 60;
             break;
+         case 'j':
+            argv++;
+            argc--;
+            if(!argc)
+               return(FALSE);
+            if(!strcmp(argv[0], "auto"))
+               *nslots = (int)sysconf(_SC_NPROCESSORS_ONLN);
+            else if(!sscanf(argv[0],"%d", nslots))
+               return(FALSE);
+            if(*nslots < 1)
+               *nslots = 1;
+            break;
+         case 'b':
+            argv++;
+            argc--;
+            if(!argc)
+               return(FALSE);
+            if(!sscanf(argv[0],"%d", maxbatch))
+               return(FALSE);
+            if(*maxbatch < 1)
+               *maxbatch = 1;
+            else if(*maxbatch > MAXBATCH)
+               *maxbatch = MAXBATCH;
+            break;
          default:
             return(FALSE);
             break;
@@ -314,199 +446,1347 @@ BOOL ParseCmdLine(int argc, char **argv, char *spoolDir, int *cluster,
       else
       {
          return(FALSE);
-      }
-      
-      argc--;
-      argv++;
+      }
+      
+      argc--;
+      argv++;
+   }
+   
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>void QLRun(char *spoolDir, int cluster, int maxnice, int instance, 
+              int tlimit, int nslots, int maxbatch)
+   ------------------------------------------------------------------
+   Input:     char  *spoolDir      Spool directory
+              int   cluster        Cluster number
+              int   maxnice        Max nice level to run a job at
+              int   instance       Run instance number
+              int   tlimit         Time limit for a job running under this
+                                   daemon
+              int   nslots         Number of jobs to run at once
+              int   maxbatch       Most jobs to take from the queue at
+                                   once for one slot
+
+   Main loop which looks for jobs and runs them. With the lock daemon,
+   qllockd hands out the jobs so no lock needs to be held while a job
+   is fetched from the spool directory.
+
+   With the lock daemon, jobs run in nslots slots. Slot n uses the 
+   instance number instance+n, so each has its own run file. One loop
+   talks to qllockd, checks for shutdown and suspend files and watches
+   every running job: it asks for a job whenever a slot is free and 
+   waits in epoll for the reply, for a job to finish or for a job to 
+   run out of time.
+
+   A free slot may be given a batch of up to maxbatch jobs which it runs
+   one after another. The batch size follows the average run time of
+   recent jobs so that a batch takes about BATCH_MSEC; long jobs are
+   taken one at a time.
+
+   15.09.00 Original  By: ACRM
+   02.10.00 Added instance and tlimit
+   03.10.00 Added check on GotSuspendFile()
+   18.10.26 Jobs are taken with DequeueJob() rather than under the lock
+   18.10.26 Added nslots
+   18.10.26 Added maxbatch
+   18.10.26 Jobs are supervised from one event loop rather than a
+            process per slot
+   18.10.26 File based locking no longer locks to take a job
+   18.10.26 Jobs may be tasks of a job array
+*/
+void QLRun(char *spoolDir, int cluster, int maxnice, int instance, 
+           int tlimit, int nslots, int maxbatch)
+{
+#ifdef FILE_BASED_LOCKING
+   ULONG jobid;
+   char  *jobname;
+
+   if(((nslots > 1) || (maxbatch > 1)) && gDebug)
+      fprintf(stderr,"-j and -b are ignored with file based locking\n");
+
+   /* No lock is needed to take a job since GetJob() claims it by 
+      renaming it. If another node gets there first, we just look again
+   */
+   for(;;)
+   {
+      if(GotShutdownFile(spoolDir))
+         break;
+      
+      if(GotSuspendFile(spoolDir))
+      {
+         sleep(POLL_PAUSE);
+      }
+      else if((jobid=JobWaiting(spoolDir))==0)
+      {
+         sleep(POLL_PAUSE);
+      }
+      else if((jobname = GetJob(jobid, spoolDir))==NULL)
+      {
+         sleep(JOB_PAUSE);
+      }
+      else
+      {
+         RunJob(spoolDir, jobname, maxnice, instance, tlimit);
+         sleep(JOB_PAUSE);
+      }
+   }
+#else
+   ULONG  jobids[MAXBATCH],
+          tasks[MAXBATCH],
+          jobMsec = BATCH_MSEC;
+   SLOT   *slots;
+   time_t retryAt = 0;
+   int    epfd,
+          slot,
+          njobs,
+          busy;
+   BOOL   shutdown  = FALSE,
+          requested = FALSE;
+
+   if(((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) ||
+      ((slots = InitSlots(epfd, nslots, instance)) == NULL))
+   {
+      if(gDebug)
+         fprintf(stderr,"Unable to set up %d job slots\n", nslots);
+      return;
+   }
+
+   for(;;)
+   {
+      busy = RunBatches(epfd, slots, nslots, spoolDir, maxnice, tlimit,
+                        &jobMsec);
+
+      /* Once asked to shut down we take no more jobs, but let the 
+         running ones finish
+      */
+      if(!shutdown && GotShutdownFile(spoolDir))
+         shutdown = TRUE;
+      if(shutdown && !busy && !requested)
+         break;
+
+      /* If a slot is free, ask qllockd for jobs. It sends them as soon
+         as they are submitted; otherwise it replies NONE after 
+         POLL_PAUSE seconds
+      */
+      if(!shutdown && !requested && (busy < nslots) && 
+         (time(NULL) >= retryAt) && !GotSuspendFile(spoolDir))
+      {
+         if(RequestJobs(cluster, POLL_PAUSE, 
+                        BatchSize(jobMsec, maxbatch)))
+         {
+            requested = TRUE;
+            WatchLockSocket(epfd);
+         }
+         else
+         {
+            if(gDebug)
+               fprintf(stderr,"Unable to talk to the lock daemon\n");
+            retryAt = time(NULL) + POLL_PAUSE;
+         }
+      }
+
+      /* Wait for jobs to arrive, finish or run out of time. We wake at
+         least every POLL_PAUSE seconds to look for shutdown and suspend
+         files
+      */
+      if(SuperviseSlots(epfd, slots, nslots, spoolDir, POLL_PAUSE*1000))
+      {
+         if(!requested)
+         {
+            /* Nothing is expected, so qllockd has closed the session   */
+            CloseLocks();
+            continue;
+         }
+
+         requested = FALSE;
+         switch(ReadJobs(maxbatch, jobids, tasks, &njobs))
+         {
+         case 0:
+            for(slot=0; slot<nslots; slot++)
+            {
+               if((slots[slot].pid == 0) && 
+                  (slots[slot].next >= slots[slot].njobs))
+                  break;
+            }
+            memcpy(slots[slot].jobids, jobids, njobs*sizeof(ULONG));
+            memcpy(slots[slot].tasks,  tasks,  njobs*sizeof(ULONG));
+            slots[slot].njobs = njobs;
+            slots[slot].next  = 0;
+            gettimeofday(&(slots[slot].started), NULL);
+            break;
+         case 1:
+            if(gDebug)
+               fprintf(stderr,"No job waiting\n");
+            break;
+         default:
+            if(gDebug)
+               fprintf(stderr,"Unable to talk to the lock daemon\n");
+            retryAt = time(NULL) + POLL_PAUSE;
+            break;
+         }
+      }
+   }
+
+   FreeSlots(slots, nslots);
+   close(epfd);
+#endif
+}
+
+
+/************************************************************************/
+/*>SLOT *InitSlots(int epfd, int nslots, int instance)
+   ---------------------------------------------------
+   Input:     int    epfd          epoll instance for the event loop
+              int    nslots        Number of slots
+              int    instance      Run instance number of the first slot
+   Returns:   SLOT *               Array of empty slots (NULL on failure)
+
+   Allocates the job slots and gives each a timer, watched by epfd, for
+   enforcing the time limit on its jobs.
+
+   18.10.26 Original   By: ACRM
+*/
+SLOT *InitSlots(int epfd, int nslots, int instance)
+{
+   SLOT  *slots;
+   struct epoll_event ev;
+   int   slot;
+
+   if((slots=(SLOT *)calloc(nslots, sizeof(SLOT)))==NULL)
+      return(NULL);
+
+   for(slot=0; slot<nslots; slot++)
+   {
+      slots[slot].instance = instance + slot;
+      slots[slot].pidfd    = (-1);
+      slots[slot].timerfd  = timerfd_create(CLOCK_MONOTONIC, 
+                                            TFD_NONBLOCK | TFD_CLOEXEC);
+      if(slots[slot].timerfd < 0)
+      {
+         FreeSlots(slots, slot);
+         return(NULL);
+      }
+
+      ev.events   = EPOLLIN;
+      ev.data.u64 = ((uint64_t)slot << 1) | EV_TIMER;
+      epoll_ctl(epfd, EPOLL_CTL_ADD, slots[slot].timerfd, &ev);
+   }
+
+   return(slots);
+}
+
+
+/************************************************************************/
+/*>void FreeSlots(SLOT *slots, int nslots)
+   ---------------------------------------
+   Input:     SLOT   *slots        Job slots
+              int    nslots        Number of slots
+
+   Closes the slots' timers and frees them. The slots must be idle.
+
+   18.10.26 Original   By: ACRM
+*/
+void FreeSlots(SLOT *slots, int nslots)
+{
+   int slot;
+
+   for(slot=0; slot<nslots; slot++)
+   {
+      if(slots[slot].timerfd >= 0)
+         close(slots[slot].timerfd);
+   }
+   free(slots);
+}
+
+
+/************************************************************************/
+/*>int RunBatches(int epfd, SLOT *slots, int nslots, char *spoolDir, 
+                  int maxnice, int tlimit, ULONG *jobMsec)
+   -----------------------------------------------------------------
+   Input:     int    epfd          epoll instance for the event loop
+              SLOT   *slots        Job slots
+              int    nslots        Number of slots
+              char   *spoolDir     Spool directory
+              int    maxnice       Max nice level to run a job at
+              int    tlimit        Time limit for each job
+   I/O:       ULONG  *jobMsec      Average time taken by a job
+   Returns:   int                  Number of slots still in use
+
+   Starts the next job of the batch in any slot whose last job has 
+   finished. When a batch is complete the time it took per job is 
+   folded into a running average used to size the next batch and the
+   slot is freed.
+
+   18.10.26 Original   By: ACRM
+   18.10.26 Runs tasks of job arrays
+*/
+int RunBatches(int epfd, SLOT *slots, int nslots, char *spoolDir, 
+               int maxnice, int tlimit, ULONG *jobMsec)
+{
+   struct timeval now;
+   SLOT  *s;
+   ULONG msec;
+   char  *jobname;
+   int   slot,
+         busy = 0;
+
+   for(slot=0; slot<nslots; slot++)
+   {
+      s = &(slots[slot]);
+
+      while((s->pid == 0) && (s->next < s->njobs))
+      {
+         s->jobid = s->jobids[s->next];
+         s->task  = s->tasks[s->next++];
+         if(s->task)
+            jobname = GetTask(s->jobid, s->task, spoolDir);
+         else
+            jobname = GetJob(s->jobid, spoolDir);
+
+         /* A task which can't be run still counts as finished          */
+         if((jobname != NULL) &&
+            !StartJob(epfd, s, slot, spoolDir, jobname, maxnice, tlimit) &&
+            s->task)
+            FinishTask(spoolDir, s->jobid, s->task);
+      }
+
+      if(s->pid)
+      {
+         busy++;
+      }
+      else if(s->njobs)
+      {
+         gettimeofday(&now, NULL);
+         msec = (ULONG)((now.tv_sec - s->started.tv_sec) * 1000 + 
+                        (now.tv_usec - s->started.tv_usec) / 1000);
+         msec /= s->njobs;
+         *jobMsec = (3 * (*jobMsec) + msec) / 4;
+         s->njobs = s->next = 0;
+      }
+   }
+
+   return(busy);
+}
+
+
+/************************************************************************/
+/*>BOOL StartJob(int epfd, SLOT *slot, int slotnum, char *spoolDir, 
+                 char *jobname, int maxnice, int tlimit)
+   ----------------------------------------------------------------
+   Input:     int    epfd          epoll instance for the event loop
+              SLOT   *slot         Slot in which to run the job
+              int    slotnum       Index of the slot
+              char   *spoolDir     Spool Directory
+              char   *jobname      The unique job name
+              int    maxnice       Maximum allowed nice level
+              int    tlimit        Time limit for the job (0 = none)
+   Returns:   BOOL                 Was the job started?
+
+   Starts a job using the maximum priority specified. A pidfd for the
+   job and the slot's timer are watched by epfd so that the event loop
+   can see the job finish or run out of time. If the job can't be 
+   started its files are removed.
+
+   15.09.00 Original  By: ACRM (as RunJob())
+   25.09.00 Added spoolDir
+   02.10.00 Added instance and tlimit
+   18.10.26 Uses LaunchJob() rather than su and system()
+   18.10.26 Just starts the job, which is watched by SuperviseSlots()
+*/
+BOOL StartJob(int epfd, SLOT *slot, int slotnum, char *spoolDir, 
+              char *jobname, int maxnice, int tlimit)
+{
+   uid_t uid;
+   gid_t gid;
+   int   nice;
+   pid_t pid;
+   struct passwd      *pwd;
+   struct epoll_event ev;
+
+   if(gDebug)
+   {
+      fprintf(stderr,"Running job %s\n", jobname);
+   }
+
+   if(!GetJobInfo(jobname, &uid, &gid, &nice, slot->jobfile))
+   {
+      DeleteJob(jobname);
+      return(FALSE);
+   }
+
+   /* qlrun can be run to specify a maximum nice value (0 being
+      highest priority, 19 lowest). We convert this to a -ve number
+      and if the -ve nice number from GetJobInfo() is higher then
+      we reduce the priority to maxnice
+   */
+   maxnice = (-maxnice);
+   if(nice > maxnice)
+      nice = maxnice;
+
+   /* Get the username from the UID                                     */
+   if((pwd = getpwuid(uid)) == NULL)
+   {
+      if(gDebug)
+         fprintf(stderr,"No user with UID %lu! Run aborted!\n",
+                 (ULONG)uid);
+      DeleteJob(jobname);
+      return(FALSE);
+   }
+   strncpy(slot->username, pwd->pw_name, MAXBUFF-1);
+   slot->username[MAXBUFF-1] = '\0';
+   strcpy(slot->jobname, jobname);
+      
+   /* Write the file to say that a job is running                       */
+   WriteRunFile(spoolDir, jobname, slot->jobfile, slot->username, nice,
+                slot->instance);
+
+   if(gDebug)
+   {
+      fprintf(stderr,"Running job: %s : %s\n", jobname, slot->jobfile);
+   }
+      
+   /* Run the job as the requested user                                 */
+   if((pid = LaunchJob(pwd, gid, nice, jobname, slot->task)) <= 0)
+   {
+      DeleteRunFile(spoolDir, slot->instance);
+      DeleteJob(jobname);
+      return(FALSE);
+   }
+   slot->pid      = pid;
+   slot->termSent = FALSE;
+
+   /* Watch for it finishing. Without pidfds (before Linux 5.3) 
+      SuperviseSlots() has to look for it with waitpid()
+   */
+#ifdef SYS_pidfd_open
+   slot->pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+   slot->pidfd = (-1);
+#endif
+   if(slot->pidfd >= 0)
+   {
+      ev.events   = EPOLLIN;
+      ev.data.u64 = (uint64_t)slotnum << 1;
+      epoll_ctl(epfd, EPOLL_CTL_ADD, slot->pidfd, &ev);
+   }
+
+   if(tlimit)
+      SetTimer(slot->timerfd, tlimit);
+
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>void FinishJob(SLOT *slot, char *spoolDir)
+   ------------------------------------------
+   Input:     SLOT   *slot         Slot whose job has been reaped
+              char   *spoolDir     Spool directory
+
+   Tidies up after a job: tells the user if it ran out of time and
+   removes the run file and the job's local files. A finished task of
+   a job array is counted with FinishTask().
+
+   18.10.26 Original   By: ACRM (from code in RunJob())
+   18.10.26 Added job arrays
+*/
+void FinishJob(SLOT *slot, char *spoolDir)
+{
+   if(slot->pidfd >= 0)
+   {
+      close(slot->pidfd);
+      slot->pidfd = (-1);
+   }
+   SetTimer(slot->timerfd, 0);
+
+   if(slot->termSent)
+   {
+      if(gDebug)
+         fprintf(stderr,"Job %s ran out of time\n", slot->jobname);
+      Email(slot->username, slot->jobfile);
+   }
+
+   /* Delete the file which says a job is running                       */
+   DeleteRunFile(spoolDir, slot->instance);
+   DeleteJob(slot->jobname);
+   if(slot->task)
+      FinishTask(spoolDir, slot->jobid, slot->task);
+
+   slot->pid      = 0;
+   slot->task     = 0;
+   slot->termSent = FALSE;
+}
+
+
+/************************************************************************/
+/*>BOOL SuperviseSlots(int epfd, SLOT *slots, int nslots, char *spoolDir,
+                       int timeout)
+   ---------------------------------------------------------------------
+   Input:     int    epfd          epoll instance for the event loop
+              SLOT   *slots        Job slots
+              int    nslots        Number of slots
+              char   *spoolDir     Spool directory
+              int    timeout       Longest to wait (msec, -1 = forever)
+   Returns:   BOOL                 Is there a reply from qllockd?
+
+   Waits for something to happen. Finished jobs are reaped and tidied
+   up; jobs which have run out of time are killed. 
+
+   18.10.26 Original   By: ACRM
+*/
+BOOL SuperviseSlots(int epfd, SLOT *slots, int nslots, char *spoolDir,
+                    int timeout)
+{
+   struct epoll_event events[MAXEVENTS];
+   uint64_t           expiries;
+   BOOL               lockReady = FALSE;
+   int                nevents,
+                      i,
+                      slot,
+                      status;
+
+   /* Jobs without a pidfd are looked for every second                  */
+   for(slot=0; slot<nslots; slot++)
+   {
+      if(slots[slot].pid && (slots[slot].pidfd < 0))
+      {
+         if(waitpid(slots[slot].pid, &status, WNOHANG) == slots[slot].pid)
+            FinishJob(&(slots[slot]), spoolDir);
+         else if((timeout < 0) || (timeout > 1000))
+            timeout = 1000;
+      }
+   }
+
+   if((nevents = epoll_wait(epfd, events, MAXEVENTS, timeout)) < 0)
+      return(FALSE);
+
+   for(i=0; i<nevents; i++)
+   {
+      if(events[i].data.u64 == EV_LOCKSOCK)
+      {
+         lockReady = TRUE;
+         continue;
+      }
+
+      slot = (int)(events[i].data.u64 >> 1);
+      if(events[i].data.u64 & EV_TIMER)
+      {
+         /* Clear the timer and deal with the job                       */
+         if(read(slots[slot].timerfd, &expiries, sizeof(expiries)) > 0)
+            TimeUp(&(slots[slot]));
+      }
+      else if(slots[slot].pid)
+      {
+         /* The job has finished. Anything it left running in its 
+            process group goes too if it has run out of time
+         */
+         if(slots[slot].termSent)
+            kill(-slots[slot].pid, SIGKILL);
+         waitpid(slots[slot].pid, &status, 0);
+         FinishJob(&(slots[slot]), spoolDir);
+      }
+   }
+
+   return(lockReady);
+}
+
+
+/************************************************************************/
+/*>void TimeUp(SLOT *slot)
+   -----------------------
+   Input:     SLOT   *slot         Slot whose timer has fired
+
+   Kills a job which has run out of time. The job's process group is 
+   sent SIGTERM and, if it is still running gGraceTime seconds later,
+   SIGKILL. The job is not reaped until its pidfd (or waitpid()) says 
+   it has finished, so its process group ID cannot have been reused.
+
+   18.10.26 Original   By: ACRM
+*/
+void TimeUp(SLOT *slot)
+{
+   if(slot->pid == 0)
+      return;
+
+   if(!slot->termSent && (gGraceTime > 0))
+   {
+      if(gDebug)
+         fprintf(stderr,"Job %s out of time - sending SIGTERM\n",
+                 slot->jobname);
+      slot->termSent = TRUE;
+      kill(-slot->pid, SIGTERM);
+      SetTimer(slot->timerfd, gGraceTime);
+   }
+   else
+   {
+      if(gDebug)
+         fprintf(stderr,"Job %s out of time - sending SIGKILL\n",
+                 slot->jobname);
+      slot->termSent = TRUE;
+      kill(-slot->pid, SIGKILL);
+   }
+}
+
+
+/************************************************************************/
+/*>void SetTimer(int timerfd, int secs)
+   ------------------------------------
+   Input:     int    timerfd       Timer
+              int    secs          Seconds until it fires (0 = stop it)
+
+   Starts or stops a slot's timer
+
+   18.10.26 Original   By: ACRM
+*/
+void SetTimer(int timerfd, int secs)
+{
+   struct itimerspec its;
+
+   memset(&its, 0, sizeof(its));
+   its.it_value.tv_sec = secs;
+   timerfd_settime(timerfd, 0, &its, NULL);
+}
+
+
+/************************************************************************/
+/*>void WatchLockSocket(int epfd)
+   ------------------------------
+   Input:     int    epfd          epoll instance for the event loop
+
+   Makes sure epfd is watching the current session with qllockd. The 
+   session may have been reopened (perhaps with the same descriptor 
+   number) by the last request, so it is always added afresh.
+
+   18.10.26 Original   By: ACRM
+*/
+void WatchLockSocket(int epfd)
+{
+   struct epoll_event ev;
+   int    sock;
+
+   if((sock = LockSocket()) < 0)
+      return;
+
+   epoll_ctl(epfd, EPOLL_CTL_DEL, sock, NULL);
+   ev.events   = EPOLLIN;
+   ev.data.u64 = EV_LOCKSOCK;
+   epoll_ctl(epfd, EPOLL_CTL_ADD, sock, &ev);
+}
+
+
+/************************************************************************/
+/*>int BatchSize(ULONG jobMsec, int maxbatch)
+   ------------------------------------------
+   Input:     ULONG  jobMsec       Average time taken by a job
+              int    maxbatch      Largest batch allowed
+   Returns:   int                  Number of jobs to ask for
+
+   Works out how many jobs to take at once so that a batch runs for 
+   about BATCH_MSEC. A slow job is never batched; very short ones are 
+   taken maxbatch at a time.
+
+   18.10.26 Original   By: ACRM
+*/
+int BatchSize(ULONG jobMsec, int maxbatch)
+{
+   int njobs;
+
+   if(jobMsec < (ULONG)(BATCH_MSEC / maxbatch))
+      return(maxbatch);
+
+   njobs = (int)(BATCH_MSEC / jobMsec);
+   if(njobs < 1)
+      njobs = 1;
+   else if(njobs > maxbatch)
+      njobs = maxbatch;
+
+   return(njobs);
+}
+
+
+/************************************************************************/
+/*>ULONG JobWaiting(char *spoolDir)
+   --------------------------------
+   Input:     char   *spoolDir     Spool directory
+   Returns:   ULONG                Job number (0 if nothing waiting)
+
+   Tests whether a job is waiting and returns its ID if there is.
+
+   15.09.00 Original  By: ACRM
+   18.10.26 Returns the lowest job number rather than the first found
+            so jobs run in the order submitted
+   18.10.26 Looks for job records rather than control files
+   18.10.26 Asks the journal if there is one
+*/
+ULONG JobWaiting(char *spoolDir)
+{
+   struct dirent *dirp;
+   DIR           *dp;
+   char          buffer[PATH_MAX],
+                 *chp;
+   ULONG         jobnum = 0,
+                 thisjob;
+
+   /* The journal's index knows the lowest waiting job                  */
+   if(JournalEnabled(spoolDir))
+   {
+      jobnum = JournalNextJob(spoolDir);
+      if(gDebug)
+         fprintf(stderr,"%s waiting\n", ((jobnum)?"Job":"No job"));
+      return(jobnum);
+   }
+
+   if((dp=opendir(spoolDir)) == NULL)
+   {
+      if(gDebug)
+      {
+         fprintf(stderr,"qlrun dies! Can't read directory: %s\n", 
+                 spoolDir);
+      }
+      exit(1);
+   }
+
+   while((dirp = readdir(dp)) != NULL)
+   {
+      /* Ignore files starting with a .                                 */
+      if(dirp->d_name[0] != '.')
+      {
+         /* See if it's a .job file                                     */
+         strcpy(buffer, dirp->d_name);
+         if(((chp=strstr(buffer, ".job"))!=NULL) && !strcmp(chp, ".job"))
+         {
+            /* Extract the job number from the name                     */
+            *chp = '\0';
+            if((sscanf(buffer,"%lu",&thisjob) == 1) &&
+               ((jobnum == 0) || (thisjob < jobnum)))
+               jobnum = thisjob;
+         }
+      }
+   }
+   
+   closedir(dp);
+
+   if(gDebug)
+   {
+      fprintf(stderr,"%s waiting\n", ((jobnum)?"Job":"No job"));
+   }
+   return(jobnum);
+}
+
+
+/************************************************************************/
+/*>char *GetJob(ULONG jobid, char *spoolDir)
+   -----------------------------------------
+   Input:     ULONG   jobid       Identifier for a job
+              char    *spoolDir   Spool directory
+   Returns:   char *              Jobname (NULL if another node has
+                                  taken the job or it can't be copied)
+
+   Claims a job with ClaimJob() and pulls it into JOB_DIR on the
+   local machine. The script goes into a .run file and the job 
+   record's header into a .stat file. Returns a unique name consisting
+   of the process ID+jobid
+
+   15.09.00 Original  By: ACRM
+   18.10.26 Claims the job before copying it
+   18.10.26 Copies with CopyFile() and unlink() rather than cp and rm
+   18.10.26 Splits a single job record rather than copying a job file
+            and a control file
+   18.10.26 Takes the job from the journal if there is one
+*/
+char *GetJob(ULONG jobid, char *spoolDir)
+{
+   static char jobname[MAXBUFF];
+   char        from[PATH_MAX],
+               to[PATH_MAX],
+               *claimDir;
+   pid_t       pid;
+   JOBRECORD   rec;
+
+   if(gDebug)
+   {
+      fprintf(stderr,"Getting job %ld from %s\n", jobid, spoolDir);
+   }
+
+   /* The journal makes sure only one node can take the job             */
+   if(JournalEnabled(spoolDir))
+   {
+      sprintf(jobname,"%ld.%ld",(ULONG)getpid(),jobid);
+      sprintf(from,"%s/%s.run",  JOB_DIR, jobname);
+      sprintf(to,  "%s/%s.stat", JOB_DIR, jobname);
+      if(JournalCopyJob(spoolDir, jobid, from, to, TRUE))
+         return(jobname);
+
+      if(gDebug)
+         fprintf(stderr,"Job %lu has already been taken\n", jobid);
+      return(NULL);
+   }
+
+   /* If we can't make a claim directory, copy straight from the spool 
+      as we used to
+   */
+   if((claimDir = ClaimDir(spoolDir)) == NULL)
+   {
+      claimDir = spoolDir;
+   }
+   else if(!ClaimJob(jobid, spoolDir, claimDir))
+   {
+      if(gDebug)
+         fprintf(stderr,"Job %lu has already been taken\n", jobid);
+      return(NULL);
+   }
+
+   /* Create a unique jobname by combining the process ID and jobid     */
+   pid = getpid();
+   sprintf(jobname,"%ld.%ld",(ULONG)pid,jobid);
+
+   /* Copy the job across to the working directory. If that fails the
+      claimed record is left to be recovered
+   */
+   sprintf(from,"%s/%ld.job", claimDir, jobid);
+   sprintf(to,  "%s/%s.run",  JOB_DIR, jobname);
+   if(!ReadSpoolRecord(from, &rec) || !CopyJobScript(from, &rec, to))
+   {
+      if(gDebug)
+         fprintf(stderr,"Unable to copy %s to %s\n", from, to);
+      return(NULL);
+   }
+   sprintf(to,  "%s/%s.stat",  JOB_DIR, jobname);
+   if(!WriteJobHeader(to, &rec))
+   {
+      if(gDebug)
+         fprintf(stderr,"Unable to write %s\n", to);
+      DeleteJob(jobname);
+      return(NULL);
+   }
+
+   /* Only now that we have a copy can the claimed record go            */
+   unlink(from);
+   
+   return(jobname);
+}
+
+
+/************************************************************************/
+/*>char *GetTask(ULONG jobid, ULONG task, char *spoolDir)
+   ------------------------------------------------------
+   Input:     ULONG   jobid       Job number of a job array
+              ULONG   task        Task index
+              char    *spoolDir   Spool directory
+   Returns:   char *              Jobname (NULL if the array has gone or
+                                  can't be copied)
+
+   Pulls a task of a job array into JOB_DIR. qllockd hands each task to
+   only one qlrun so, unlike an ordinary job, nothing is claimed and the
+   array's files stay in the spool directory for its other tasks. An
+   empty marker in our claim directory says that this process is 
+   running the task so that, if the node dies, RecoverClaimedJobs() can
+   put it back in the queue. The jobname is the process ID+jobid+task.
+
+   18.10.26 Original  By: ACRM
+   18.10.26 Splits a single job record
+   18.10.26 Copies from the journal if there is one
+*/
+char *GetTask(ULONG jobid, ULONG task, char *spoolDir)
+{
+   static char jobname[MAXBUFF];
+   char        from[PATH_MAX],
+               to[PATH_MAX],
+               *claimDir;
+   int         fd;
+   JOBRECORD   rec;
+
+   if(gDebug)
+   {
+      fprintf(stderr,"Getting task %lu of job %lu from %s\n", task, 
+              jobid, spoolDir);
+   }
+
+   if((claimDir = ClaimDir(spoolDir)) != NULL)
+   {
+      sprintf(to, "%s/%lu.%lu.%ld.task", claimDir, jobid, task, 
+              (ULONG)getpid());
+      if((fd = open(to, O_WRONLY | O_CREAT, 0644)) >= 0)
+         close(fd);
+   }
+   UpdateTasks(spoolDir, jobid, task, FALSE);
+
+   sprintf(jobname,"%ld.%lu.%lu",(ULONG)getpid(),jobid,task);
+
+   if(JournalEnabled(spoolDir))
+   {
+      sprintf(from,"%s/%s.run",  JOB_DIR, jobname);
+      sprintf(to,  "%s/%s.stat", JOB_DIR, jobname);
+      if(JournalCopyJob(spoolDir, jobid, from, to, FALSE))
+         return(jobname);
+   }
+   else
+   {
+      sprintf(from,"%s/%lu.job", spoolDir, jobid);
+      sprintf(to,  "%s/%s.run",  JOB_DIR, jobname);
+      if(ReadSpoolRecord(from, &rec) && CopyJobScript(from, &rec, to))
+      {
+         sprintf(to,  "%s/%s.stat",  JOB_DIR, jobname);
+         if(WriteJobHeader(to, &rec))
+            return(jobname);
+      }
+   }
+
+   if(gDebug)
+      fprintf(stderr,"Unable to copy %s to %s\n", from, to);
+   DeleteJob(jobname);
+   FinishTask(spoolDir, jobid, task);
+   return(NULL);
+}
+
+
+/************************************************************************/
+/*>BOOL UpdateTasks(char *spoolDir, ULONG jobid, ULONG task, BOOL done)
+   --------------------------------------------------------------------
+   Input:     char    *spoolDir   Spool directory
+              ULONG   jobid       Job number of a job array
+              ULONG   task        Task index
+              BOOL    done        Has the task finished (rather than 
+                                  started)?
+   Returns:   BOOL                Success?
+
+   Records the start or end of a task in the job array's .tasks file.
+   This holds the first task not yet started, from which qllockd 
+   carries on if it is restarted, and the number of tasks finished 
+   (read by ReadTaskProgress()). qlruns on every node update it under 
+   an fcntl() lock. Once every task has finished the array is removed
+   from the spool directory (or marked done in the journal).
+
+   18.10.26 Original  By: ACRM
+   18.10.26 Arrays may be in the journal
+*/
+BOOL UpdateTasks(char *spoolDir, ULONG jobid, ULONG task, BOOL done)
+{
+   struct flock lk;
+   char    file[PATH_MAX],
+           buffer[MAXBUFF];
+   ULONG   nextTask = 0,
+           nDone    = 0;
+   JOBRECORD rec;
+   ssize_t nread;
+   int     fd;
+   BOOL    ok = TRUE;
+
+   sprintf(file, "%s/%lu.tasks", spoolDir, jobid);
+   if((fd = open(file, O_RDWR | O_CREAT, 0644)) < 0)
+      return(FALSE);
+
+   memset(&lk, 0, sizeof(lk));
+   lk.l_type   = F_WRLCK;
+   lk.l_whence = SEEK_SET;
+   if(fcntl(fd, F_SETLKW, &lk) < 0)
+   {
+      close(fd);
+      return(FALSE);
+   }
+
+   /* If the array has gone, so does the progress file                  */
+   if(!FindSpoolJob(spoolDir, jobid, &rec) || (rec.firstTask == 0))
+   {
+      sprintf(file, "%s/%lu.tasks", spoolDir, jobid);
+      unlink(file);
+      close(fd);
+      return(FALSE);
+   }
+
+   if((nread = read(fd, buffer, MAXBUFF-1)) > 0)
+   {
+      buffer[nread] = '\0';
+      sscanf(buffer, "%lu %lu", &nextTask, &nDone);
+   }
+
+   if(done)
+      nDone++;
+   else if(task >= nextTask)
+      nextTask = task + 1;
+
+   if(nDone > rec.lastTask - rec.firstTask)
+   {
+      if(gDebug)
+         fprintf(stderr,"All tasks of job %lu have finished\n", jobid);
+      if(JournalEnabled(spoolDir))
+      {
+         JournalFinishJob(spoolDir, jobid);
+      }
+      else
+      {
+         sprintf(file, "%s/%lu.job", spoolDir, jobid);
+         unlink(file);
+      }
+      sprintf(file, "%s/%lu.tasks", spoolDir, jobid);
+      unlink(file);
+   }
+   else
+   {
+      sprintf(buffer, "%lu %lu\n", nextTask, nDone);
+      if((lseek(fd, 0, SEEK_SET) != 0) ||
+         (write(fd, buffer, strlen(buffer)) != (ssize_t)strlen(buffer)) ||
+         ftruncate(fd, (off_t)strlen(buffer)))
+         ok = FALSE;
+   }
+
+   /* Closing the file releases the lock                                */
+   if(close(fd))
+      ok = FALSE;
+
+   return(ok);
+}
+
+
+/************************************************************************/
+/*>void FinishTask(char *spoolDir, ULONG jobid, ULONG task)
+   --------------------------------------------------------
+   Input:     char    *spoolDir   Spool directory
+              ULONG   jobid       Job number of a job array
+              ULONG   task        Task index
+
+   Counts a task as finished and removes its marker from our claim 
+   directory
+
+   18.10.26 Original  By: ACRM
+*/
+void FinishTask(char *spoolDir, ULONG jobid, ULONG task)
+{
+   char *claimDir,
+        marker[PATH_MAX];
+
+   UpdateTasks(spoolDir, jobid, task, TRUE);
+
+   if((claimDir = ClaimDir(spoolDir)) != NULL)
+   {
+      sprintf(marker, "%s/%lu.%lu.%ld.task", claimDir, jobid, task, 
+              (ULONG)getpid());
+      unlink(marker);
+   }
+}
+
+
+/************************************************************************/
+/*>char *ClaimDir(char *spoolDir)
+   ------------------------------
+   Input:     char    *spoolDir   Spool directory
+   Returns:   char *              This node's claim directory (NULL if
+                                  it can't be created)
+
+   Gives the directory, spoolDir/.claimed/<node>.<pid>, into which this
+   qlrun moves the jobs it takes. It is created the first time it is 
+   needed. Each qlrun on a node has its own so that one starting up 
+   cannot recover the jobs another is still handling.
+
+   18.10.26 Original  By: ACRM
+   18.10.26 One directory per qlrun rather than per node
+*/
+char *ClaimDir(char *spoolDir)
+{
+   static char claimDir[PATH_MAX];
+   char        *node;
+
+   if(claimDir[0] == '\0')
+   {
+      if((node = NodeName()) == NULL)
+         return(NULL);
+
+      sprintf(claimDir, "%s/.claimed", spoolDir);
+      if(mkdir(claimDir, 0755) && (errno != EEXIST))
+      {
+         claimDir[0] = '\0';
+         return(NULL);
+      }
+
+      sprintf(claimDir+strlen(claimDir), "/%s.%lu", node, 
+              (ULONG)getpid());
+      if(mkdir(claimDir, 0755) && (errno != EEXIST))
+      {
+         claimDir[0] = '\0';
+         return(NULL);
+      }
+   }
+
+   return(claimDir);
+}
+
+
+/************************************************************************/
+/*>BOOL ClaimJob(ULONG jobid, char *spoolDir, char *claimDir)
+   ----------------------------------------------------------
+   Input:     ULONG   jobid       Identifier for a job
+              char    *spoolDir   Spool directory
+              char    *claimDir   This node's claim directory
+   Returns:   BOOL                Is the job ours?
+
+   Takes a job by renaming its job record into our claim directory.
+   rename() is atomic so only one node can succeed; after that nobody
+   else will look at the job. If we die before the job has been copied
+   out, RecoverClaimedJobs() puts it back in the queue.
+
+   18.10.26 Original  By: ACRM
+   18.10.26 A single rename of the job record
+*/
+BOOL ClaimJob(ULONG jobid, char *spoolDir, char *claimDir)
+{
+   char from[PATH_MAX],
+        to[PATH_MAX];
+
+   sprintf(from, "%s/%lu.job", spoolDir, jobid);
+   sprintf(to,   "%s/%lu.job", claimDir, jobid);
+   if(rename(from, to))
+   {
+      /* Over NFS a retransmitted rename() can fail with ENOENT when 
+         the first attempt worked
+      */
+      if((errno != ENOENT) || access(to, F_OK))
+         return(FALSE);
    }
-   
+
    return(TRUE);
 }
 
 
 /************************************************************************/
-/*>void QLRun(char *spoolDir, int maxnice, int instance, int tlimit)
-   -----------------------------------------------------------------
-   Input:     char  *spoolDir      Spool directory
-              int   maxnice        Max nice level to run a job at
-              int   instance       Run instance number
-              int   tlimit         Time limit for a job running under this
-                                   daemon
+/*>BOOL ReadSpoolRecord(char *file, JOBRECORD *rec)
+   ------------------------------------------------
+   Input:     char      *file     A job record from the spool directory
+   Output:    JOBRECORD *rec      Details of the job
+   Returns:   BOOL                Can the job be trusted?
 
-   Main loop which looks for jobs and runs them
+   Reads a job record with ReadJobRecord(). It must be owned by root,
+   as qlsubmit makes it, since otherwise anyone could have written it
+   and chosen who it runs as.
 
-   15.09.00 Original  By: ACRM
-   02.10.00 Added instance and tlimit
-   03.10.00 Added check on GotSuspendFile()
+   18.10.26 Original  By: ACRM
 */
-void QLRun(char *spoolDir, int maxnice, int instance, int tlimit)
+BOOL ReadSpoolRecord(char *file, JOBRECORD *rec)
 {
-   int   status;
-   ULONG jobid;
-   char  *jobname;
+   struct stat statbuff;
 
-   for(;;)
+   if(stat(file, &statbuff) || (statbuff.st_uid != (uid_t)0))
    {
-      if(GotShutdownFile(spoolDir))
-         break;
-      
-      if(GotSuspendFile(spoolDir))
-      {
-         sleep(POLL_PAUSE);
-      }
-      else
-      {
-#ifdef FILE_BASED_LOCKING
-         if((status=CreateLockFile(spoolDir))==0)
-#else
-         if((status=GetLock(instance, LOCK_TIMEOUT))==0)
-#endif
-         {
-            if((jobid=JobWaiting(spoolDir))!=0)
-            {
-               jobname = GetJob(jobid, spoolDir);
-#ifdef FILE_BASED_LOCKING
-               DeleteLockFile(spoolDir);
-#else
-               ReleaseLock(instance);
-#endif
-               RunJob(spoolDir, jobname, maxnice, instance, tlimit);
-               sleep(JOB_PAUSE);
-            }
-            else
-            {
-#ifdef FILE_BASED_LOCKING
-               DeleteLockFile(spoolDir);
-#else
-               ReleaseLock(instance);
-#endif
-               sleep(POLL_PAUSE);
-            }
-         }
-         else 
-         {
-            if(gDebug)
-            {
-               if(status==1)
-               {
-                  fprintf(stderr, "Timeout waiting for lock to clear \
-exceeded.\n");
-               }
-               else
-               {
-                  fprintf(stderr, "Unable to perform locking.\n");
-#ifndef FILE_BASED_LOCKING
-                  fprintf(stderr, "   Check the lock daemon is running \
-on the specified machine\n");
-#endif
-               }
-            }
-            
-            sleep(POLL_PAUSE);
-         }
-      }
+      if(gDebug)
+         fprintf(stderr,"Job record %s not owned by root! Run \
+aborted!\n", file);
+      return(FALSE);
    }
+
+   return(ReadJobRecord(file, rec));
 }
 
 
 /************************************************************************/
-/*>ULONG JobWaiting(char *spoolDir)
-   --------------------------------
-   Input:     char   *spoolDir     Spool directory
-   Returns:   ULONG                Job number (0 if nothing waiting)
+/*>BOOL FindSpoolJob(char *spoolDir, ULONG jobid, JOBRECORD *rec)
+   --------------------------------------------------------------
+   Input:     char      *spoolDir   Spool directory
+              ULONG     jobid       Job number
+   Output:    JOBRECORD *rec        Details of the job
+   Returns:   BOOL                  Is the job still waiting?
 
-   Tests whether a job is waiting and returns its ID if there is.
+   Looks up a job which has not been taken, in the journal if there is
+   one or otherwise from its job record
 
-   15.09.00 Original  By: ACRM
+   18.10.26 Original  By: ACRM
 */
-ULONG JobWaiting(char *spoolDir)
+BOOL FindSpoolJob(char *spoolDir, ULONG jobid, JOBRECORD *rec)
 {
-   struct dirent *dirp;
-   DIR           *dp;
-   char          buffer[PATH_MAX],
-                 *chp;
-   ULONG         jobnum = 0;
+   char file[PATH_MAX];
 
-   if((dp=opendir(spoolDir)) == NULL)
+   if(JournalEnabled(spoolDir))
+      return(JournalFindJob(spoolDir, jobid, rec));
+
+   sprintf(file, "%s/%lu.job", spoolDir, jobid);
+   return(ReadJobRecord(file, rec));
+}
+
+
+/************************************************************************/
+/*>void RecoverClaimedJobs(char *spoolDir, int cluster)
+   ----------------------------------------------------
+   Input:     char    *spoolDir   Spool directory
+              int     cluster     Cluster number
+
+   Recovers the jobs and tasks left in the claim directories of qlruns
+   on this node which are no longer running, or which were left from
+   before the node rebooted. Other qlruns on the node (see -i) may be
+   running alongside this one so their directories are left alone. A
+   directory with our own pid can only be left over since we have not
+   yet claimed anything. The single <node> directory used by earlier
+   versions is always recovered.
+
+   18.10.26 Original  By: ACRM
+   18.10.26 Recovers tasks of job arrays
+   18.10.26 Job records come back with a single rename
+   18.10.26 Tasks may be of arrays in the journal
+   18.10.26 Looks for the directories of dead qlruns on this node
+*/
+void RecoverClaimedJobs(char *spoolDir, int cluster)
+{
+   struct dirent  *dirp;
+   DIR            *dp;
+   struct stat    statbuff;
+   struct sysinfo si;
+   time_t         bootTime;
+   char           *node,
+                  *name,
+                  extra,
+                  dir[PATH_MAX];
+   size_t         nodeLen;
+   ULONG          pid;
+
+   if((node = NodeName()) == NULL)
+      return;
+   nodeLen = strlen(node);
+
+   sysinfo(&si);
+   bootTime = time(NULL) - si.uptime;
+
+   /* Each directory's name is added after the trailing /             */
+   sprintf(dir, "%s/.claimed/", spoolDir);
+   name = dir + strlen(dir);
+   if((dp = opendir(dir)) == NULL)
+      return;
+
+   while((dirp = readdir(dp)) != NULL)
    {
-      if(gDebug)
+      strcpy(name, dirp->d_name);
+
+      if(!strcmp(dirp->d_name, node))
       {
-         fprintf(stderr,"qlrun dies! Can't read directory: %s\n", 
-                 spoolDir);
+         RecoverClaimDir(spoolDir, dir, cluster);
+         continue;
       }
-      exit(1);
+
+      /* Only <node>.<pid> directories belong to this node              */
+      if(strncmp(dirp->d_name, node, nodeLen) ||
+         (dirp->d_name[nodeLen] != '.') ||
+         (sscanf(dirp->d_name+nodeLen+1, "%lu%c", &pid, &extra) != 1))
+         continue;
+
+      /* It is stale if it is from before the last boot or its qlrun 
+         has gone
+      */
+      if(stat(dir, &statbuff) || !S_ISDIR(statbuff.st_mode))
+         continue;
+      if(((pid_t)pid != getpid()) &&
+         (statbuff.st_mtime >= bootTime) && 
+         ((kill((pid_t)pid, 0) == 0) || (errno != ESRCH)))
+         continue;
+
+      RecoverClaimDir(spoolDir, dir, cluster);
    }
 
+   closedir(dp);
+}
+
+
+/************************************************************************/
+/*>void RecoverClaimDir(char *spoolDir, char *claimDir, int cluster)
+   -----------------------------------------------------------------
+   Input:     char    *spoolDir   Spool directory
+              char    *claimDir   Claim directory of a dead qlrun
+              int     cluster     Cluster number
+
+   Returns any jobs left in the claim directory, by a qlrun which died 
+   while copying them, to the spool directory. With the lock daemon 
+   they are also put back in its queue, as are the tasks of job arrays
+   which it was running. The directory is then removed.
+
+   18.10.26 Original (from RecoverClaimedJobs())  By: ACRM
+*/
+void RecoverClaimDir(char *spoolDir, char *claimDir, int cluster)
+{
+   struct dirent *dirp;
+   DIR           *dp;
+   char          from[PATH_MAX],
+                 to[PATH_MAX];
+   ULONG         jobnum;
+#ifndef FILE_BASED_LOCKING
+   ULONG         task,
+                 pid;
+   JOBRECORD     rec;
+#endif
+
+   if((dp = opendir(claimDir)) == NULL)
+      return;
+
    while((dirp = readdir(dp)) != NULL)
    {
-      /* Ignore files starting with a .                                 */
-      if(dirp->d_name[0] != '.')
+      if((dirp->d_name[0] == '.') ||
+         (sscanf(dirp->d_name, "%lu", &jobnum) != 1))
+         continue;
+
+      if(strstr(dirp->d_name, ".job") != NULL)
       {
-         /* See if it's a .ctrl file                                    */
-         strcpy(buffer, dirp->d_name);
-         if((chp=strstr(buffer, ".ctrl"))!=NULL)
+         sprintf(from, "%s/%lu.job", claimDir, jobnum);
+         sprintf(to,   "%s/%lu.job", spoolDir, jobnum);
+         if(rename(from, to) == 0)
          {
-            /* Extract the job number from the name                     */
-            *chp = '\0';
-            sscanf(buffer,"%lu",&jobnum);
-            break;
+            if(gDebug)
+               fprintf(stderr,"Returned claimed job %lu to the queue\n",
+                       jobnum);
+#ifndef FILE_BASED_LOCKING
+            if(ReadJobRecord(to, &rec))
+               EnqueueJob(cluster, jobnum, rec.priority, 0, 0);
+#endif
+         }
+      }
+#ifndef FILE_BASED_LOCKING
+      else if((strstr(dirp->d_name, ".task") != NULL) &&
+              (sscanf(dirp->d_name, "%lu.%lu.%lu", 
+                      &jobnum, &task, &pid) == 3))
+      {
+         /* Requeue it unless the array has since gone                  */
+         sprintf(from, "%s/%s", claimDir, dirp->d_name);
+         if(!FindSpoolJob(spoolDir, jobnum, &rec) ||
+            EnqueueJob(cluster, jobnum, rec.priority, task, task))
+         {
+            if(gDebug)
+               fprintf(stderr,"Returned task %lu of job %lu to the \
+queue\n", task, jobnum);
+            unlink(from);
          }
       }
+#endif
    }
-   
+
    closedir(dp);
 
-   if(gDebug)
-   {
-      fprintf(stderr,"%s waiting\n", ((jobnum)?"Job":"No job"));
-   }
-   return(jobnum);
+   /* Fails, leaving it for next time, if anything could not be put back*/
+   rmdir(claimDir);
 }
 
 
 /************************************************************************/
-/*>char *GetJob(ULONG jobid, char *spoolDir)
-   -----------------------------------------
-   Input:     ULONG   jobid       Identifier for a job
-              char    *spoolDir   Spool directory
-   Returns:   char *              Jobname
+/*>BOOL MakeJobDir(void)
+   ---------------------
+   Returns:   BOOL                Is JOB_DIR safe to use?
 
-   Pulls a job out of the spool directory into JOB_DIR (/tmp on the
-   local machine) and returns a unique name consisting of the process
-   ID+jobid
+   Creates JOB_DIR if need be. Jobs are copied there by root before 
+   they are run, so it must belong to root and nobody else may be able
+   to create files in it, or they could plant a link for root to write
+   through. Jobs can still reach their own scripts since it may be 
+   searched by everyone.
 
-   15.09.00 Original  By: ACRM
+   18.10.26 Original  By: ACRM
 */
-char *GetJob(ULONG jobid, char *spoolDir)
+BOOL MakeJobDir(void)
 {
-   static char jobname[MAXBUFF];
-   char        cmd[PATH_MAX+MAXBUFF];
-   pid_t       pid;
+   struct stat statbuff;
 
-   if(gDebug)
-   {
-      fprintf(stderr,"Getting job %ld from %s\n", jobid, spoolDir);
-   }
+   if(mkdir(JOB_DIR, 0711) && (errno != EEXIST))
+      return(FALSE);
 
-   /* Create a unique jobname by combining the process ID and jobid     */
-   pid = getpid();
-   sprintf(jobname,"%ld.%ld",(ULONG)pid,jobid);
+   if(lstat(JOB_DIR, &statbuff) || !S_ISDIR(statbuff.st_mode) ||
+      (statbuff.st_uid != (uid_t)0) ||
+      (statbuff.st_mode & (S_IWGRP | S_IWOTH)))
+      return(FALSE);
 
-   /* Copy the .job and .ctrl files across to the working directory     */
-   sprintf(cmd,"cp %s/%ld.job %s/%s.run", 
-           spoolDir, jobid, JOB_DIR, jobname);
-   system(cmd);
-   sprintf(cmd,"cp %s/%ld.ctrl %s/%s.stat", 
-           spoolDir, jobid, JOB_DIR, jobname);
-   system(cmd);
-
-   /* Delete the copies from the spool directory                        */
-   sprintf(cmd,"rm -f %s/%ld.job",  spoolDir, jobid);
-   system(cmd);
-   sprintf(cmd,"rm -f %s/%ld.ctrl", spoolDir, jobid);
-   system(cmd);
-   
-   return(jobname);
+   return(TRUE);
 }
 
 
@@ -518,16 +1798,17 @@ char *GetJob(ULONG jobid, char *spoolDir)
    Deletes a finished job file and control file from JOB_DIR
 
    15.09.00 Original  By: ACRM
+   18.10.26 Uses unlink() rather than rm
 */
 void DeleteJob(char *jobname)
 {
-   char cmd[MAXBUFF];
+   char file[MAXBUFF];
    
-   /* Delete the copies from the spool directory                        */
-   sprintf(cmd,"rm -f %s/%s.run",  JOB_DIR, jobname);
-   system(cmd);
-   sprintf(cmd,"rm -f %s/%s.stat", JOB_DIR, jobname);
-   system(cmd);
+   /* Delete the local copies                                           */
+   sprintf(file,"%s/%s.run",  JOB_DIR, jobname);
+   unlink(file);
+   sprintf(file,"%s/%s.stat", JOB_DIR, jobname);
+   unlink(file);
 }
 
 
@@ -547,14 +1828,13 @@ void DeleteJob(char *jobname)
 
    15.09.00 Original  By: ACRM
    25.09.00 Added jobfile
+   18.10.26 Parses the header with ReadJobRecord()
 */
 BOOL GetJobInfo(char *jobname, uid_t *uid, gid_t *gid, int *nice,
                 char *jobfile)
 {
-   char  buffer[MAXBUFF],
-         junk[16];
-   FILE  *fp;
-   ULONG tmp;
+   char  buffer[MAXBUFF];
+   JOBRECORD   rec;
    struct stat statbuff;
    
 
@@ -571,34 +1851,13 @@ BOOL GetJobInfo(char *jobname, uid_t *uid, gid_t *gid, int *nice,
       return(FALSE);
    }
 
-   /* Ppen it for reading                                               */
-   if((fp=fopen(buffer,"r"))==NULL)
+   /* Read the header                                                 */
+   if(!ReadJobRecord(buffer, &rec))
       return(FALSE);
-
-   while(fgets(buffer, MAXBUFF, fp))
-   {
-      TERMINATE(buffer);
-      if(buffer[0] == 'U')
-      {
-         sscanf(buffer,"%s %lu", junk, &tmp);
-         *uid = (uid_t)tmp;
-      }
-      else if(buffer[0] == 'G')
-      {
-         sscanf(buffer,"%s %lu", junk, &tmp);
-         *gid = (gid_t)tmp;
-      }
-      else if(buffer[0] == 'N')
-      {
-         sscanf(buffer,"%s %lu", junk, &tmp);
-         *nice = (int)tmp;
-      }
-      else if(buffer[0] == 'J')
-      {
-         sscanf(buffer,"%s %s", junk, jobfile);
-      }
-   }
-   fclose(fp);
+   *uid  = rec.uid;
+   *gid  = rec.gid;
+   *nice = rec.nice;
+   strcpy(jobfile, rec.jobfile);
 
 
    /* Make sure that we aren't trying to run anything as root           */
@@ -637,73 +1896,39 @@ BOOL GetJobInfo(char *jobname, uid_t *uid, gid_t *gid, int *nice,
               int    tlimit       Time limit for a job running under this
                                   daemon
 
-   Runs a specified job using the maximum priority specified
+   Runs a specified job using the maximum priority specified and waits
+   for it to finish
 
    15.09.00 Original  By: ACRM
    25.09.00 Added spoolDir
    02.10.00 Added instance and tlimit
+   18.10.26 Uses LaunchJob() and WaitJob() rather than su and system()
+   18.10.26 Runs the job in a single slot with StartJob() and 
+            SuperviseSlots()
 */
 void RunJob(char *spoolDir, char *jobname, int maxnice, int instance, 
             int tlimit)
 {
-   uid_t uid;
-   gid_t gid;
-   int   nice;
-   char  cmd[MAXBUFF],
-         jobfile[PATH_MAX];
-   struct passwd *pwd;
-   char          *username;
-
+   SLOT *slot;
+   int  epfd;
 
-   if(gDebug)
+   if(((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) ||
+      ((slot = InitSlots(epfd, 1, instance)) == NULL))
    {
-      fprintf(stderr,"Running job %s\n", jobname);
+      if(epfd >= 0)
+         close(epfd);
+      DeleteJob(jobname);
+      return;
    }
 
-   if(GetJobInfo(jobname, &uid, &gid, &nice, jobfile))
+   if(StartJob(epfd, slot, 0, spoolDir, jobname, maxnice, tlimit))
    {
-      /* qlrun can be run to specify a maximum nice value (0 being
-         highest priority, 19 lowest). We convert this to a -ve number
-         and if the -ve nice number from GetJobInfo() is higher then
-         we reduce the priority to maxnice
-      */
-      maxnice = (-maxnice);
-      if(nice > maxnice)
-         nice = maxnice;
-
-      /* Get the username from the UID                                  */
-      pwd = getpwuid(uid);
-      username = pwd->pw_name;
-      
-      /* Write the file to say that a job is running                    */
-      WriteRunFile(spoolDir, jobname, jobfile, username, nice, instance);
-
-      if(gDebug)
-      {
-         fprintf(stderr,"Running job: %s : %s\n", jobname, jobfile);
-      }
-      
-      /* Run the job as the requested user                              */
-      sprintf(cmd, "su - %s -c \"nice %d %s %s/%s.run\"",
-              username, nice, SHELL, JOB_DIR, jobname);
-
-      if(tlimit)
-      {
-         if((system_tlimit(cmd, tlimit))==9)
-         {
-            Email(username, jobfile);
-         }
-      }
-      else
-      {
-         system(cmd);
-      }
-
-      /* Delete the file which says a job is running                    */
-      DeleteRunFile(spoolDir, instance);
+      while(slot->pid)
+         SuperviseSlots(epfd, slot, 1, spoolDir, -1);
    }
 
-   DeleteJob(jobname);
+   FreeSlots(slot, 1);
+   close(epfd);
 }
 
 
@@ -718,21 +1943,19 @@ void RunJob(char *spoolDir, char *jobname, int maxnice, int instance,
    returns FALSE
 
    18.09.00 Original   By: ACRM
+   18.10.26 Uses NodeName()
+   18.10.26 Creates the .shutdown file itself rather than with touch
 */
 BOOL GotShutdownFile(char *spoolDir)
 {
-   char hname[MAXBUFF], 
-        *chp, 
+   char *hname, 
         buffer[PATH_MAX];
+   int  fd;
    
    /* Try to get the hostname - just return FALSE if we fail            */
-   if(gethostname(hname,MAXBUFF))
+   if((hname=NodeName())==NULL)
       return(FALSE);
    
-   /* Terminate the hostname at the first .                             */
-   if((chp=strchr(hname,'.'))!=NULL)
-      *chp = '\0';
-   
    /* Create the name of the file which indicates this daemon to be
       shutdown
    */
@@ -743,8 +1966,9 @@ BOOL GotShutdownFile(char *spoolDir)
    */
    if(!access(buffer,F_OK))
    {
-      sprintf(buffer,"touch %s/.shutdown%s", spoolDir, hname);
-      system(buffer);
+      sprintf(buffer,"%s/.shutdown%s", spoolDir, hname);
+      if((fd = open(buffer, O_WRONLY | O_CREAT, 0644)) >= 0)
+         close(fd);
       return(TRUE);
    }
    
@@ -752,6 +1976,39 @@ BOOL GotShutdownFile(char *spoolDir)
 }
 
 
+/************************************************************************/
+/*>char *NodeName(void)
+   --------------------
+   Returns: char *               Name of this node up to the first .
+                                 (NULL if it can't be found)
+
+   Looks up the host name once; the shutdown check and the run files
+   for every slot then share the saved copy.
+
+   18.10.26 Original   By: ACRM
+*/
+char *NodeName(void)
+{
+   static char nodename[MAXBUFF];
+   char        *chp;
+
+   if(nodename[0] == '\0')
+   {
+      if(gethostname(nodename, MAXBUFF))
+      {
+         nodename[0] = '\0';
+         return(NULL);
+      }
+      nodename[MAXBUFF-1] = '\0';
+
+      if((chp=strchr(nodename,'.'))!=NULL)
+         *chp = '\0';
+   }
+
+   return(nodename);
+}
+
+
 /************************************************************************/
 /*>void RemoveShutdownFile(char *spoolDir)
    ---------------------------------------
@@ -761,21 +2018,17 @@ BOOL GotShutdownFile(char *spoolDir)
    from the spool directory.
 
    18.09.00 Original   By: ACRM
+   18.10.26 Uses NodeName()
 */
 void RemoveShutdownFile(char *spoolDir)
 {
-   char hname[MAXBUFF], 
-        *chp, 
+   char *hname, 
         buffer[PATH_MAX];
    
-   /* Try to get the hostname - just return FALSE if we fail            */
-   if(gethostname(hname,MAXBUFF))
+   /* Try to get the hostname - just return if we fail                  */
+   if((hname=NodeName())==NULL)
       return;
    
-   /* Terminate the hostname at the first .                             */
-   if((chp=strchr(hname,'.'))!=NULL)
-      *chp = '\0';
-   
    /* Create the names of the file which indicates this daemon is to be
       shutdown and has been shutdown and remove them
    */
@@ -809,20 +2062,18 @@ void RemoveShutdownFile(char *spoolDir)
 
    22.09.00 Original   By: ACRM
    02.10.00 Added instance
+   18.10.26 Uses NodeName()
 */
 void WriteRunFile(char *spoolDir, char *jobname, char *jobfile, 
                   char *username, int nice, int instance)
 {
    char file[PATH_MAX];
-   char nodename[MAXBUFF], *chp;
+   char *nodename;
    FILE *fp;
    
-   if(gethostname(nodename, MAXBUFF))
+   if((nodename=NodeName())==NULL)
       return;
 
-   if((chp=strchr(nodename,'.'))!=NULL)
-      *chp = '\0';
-   
    sprintf(file,"%s/.%s.running.%d", spoolDir, nodename, instance);
    if((fp=fopen(file,"w"))!=NULL)
    {
@@ -850,18 +2101,16 @@ void WriteRunFile(char *spoolDir, char *jobname, char *jobfile,
    Called from RunJob() just after the job is executed.
 
    22.09.00 Original   By: ACRM
+   18.10.26 Uses NodeName()
 */
 void DeleteRunFile(char *spoolDir, int instance)
 {
    char file[PATH_MAX];
-   char nodename[MAXBUFF], *chp;
+   char *nodename;
    
-   if(gethostname(nodename, MAXBUFF))
+   if((nodename=NodeName())==NULL)
       return;
    
-   if((chp=strchr(nodename,'.'))!=NULL)
-      *chp = '\0';
-   
    sprintf(file,"%s/.%s.running.%d",spoolDir, nodename, instance);
    unlink(file);
 
@@ -928,103 +2177,119 @@ BOOL GotSuspendFile(char *spoolDir)
 
 
 /************************************************************************/
-/*>int system_tlimit(char *command, int timelimit) 
-   -----------------------------------------------
-   Input:   char    *command     Command to be executed
-            int     timelimit    Time limit (in seconds)
-   Returns: int                  Exit status. 9 if it ran out of time
-                                 otherwise, the exit status of the 
-                                 command run
-
-   Like system() but will only allow a process to run for at most
-   timelimit seconds
-
-   02.10.00 Original   By: ACRM
+/*>pid_t LaunchJob(struct passwd *pwd, gid_t gid, int nice, char *jobname,
+                   ULONG task)
+   -----------------------------------------------------------------------
+   Input:   struct passwd *pwd     Password entry for the job's owner
+            gid_t         gid      Group to run as
+            int           nice     Nice level (<= 0 as from GetJobInfo())
+            char          *jobname The unique job name
+            ULONG         task     Task index of a job array (0 if none)
+   Returns: pid_t                  PID of the job (-1 on failure)
+
+   Forks a process which becomes the user and runs the job script with 
+   SHELL. The priority is set directly and the job is given a minimal
+   environment and the user's home directory rather than going through
+   su, a login shell and nice. With -L (gLoginShell) the job is run 
+   through su - as before so that the user's profile is read.
+
+   The job runs in its own process group. A task of a job array is 
+   given its index in QLTASK.
+
+   18.10.26 Original   By: ACRM
+   18.10.26 Puts the job in its own process group
+   18.10.26 Added task
 */
-int system_tlimit(char *command, int timelimit) 
+pid_t LaunchJob(struct passwd *pwd, gid_t gid, int nice, char *jobname,
+                ULONG task)
 {
-   int pid, pidtimer, status, retval;
-
-   if (command == NULL)
-      return(1);
-
-   /* Fork off a new process                                            */
-   pid = fork();
-   if (pid == -1)
-      return(-1);
-   
-   /***                     SUBPROCESS 1 BEGINS                       ***/
-   /* If it's the new process, then run the command                     */
-   if (pid == 0) 
-   {
-      char *argv[4];
-      argv[0] = "sh";
-      argv[1] = "-c";
-      argv[2] = command;
-      argv[3] = 0;
-      
-      execve("/bin/sh", argv, environ);
-      
-      exit(127);
-   }
-   /***                     SUBPROCESS 1 ENDS                         ***/
-
-   /* It's the parent, so pid is the PID of the child                   */
-   if(timelimit != 0)
-   {
-      /* Fork off another process to wait for the specified timelimit   */
-      pidtimer = fork();
-      if (pidtimer == -1)
-         return(-1);
-      
-      /***                  SUBPROCESS 2 BEGINS                       ***/
-      /* If it's the child start the timer                              */
-      if(pidtimer == 0)
-      {
-         sleep(timelimit);
-         kill(pid, 9);
-         exit(0);
-      }
-      /***                  SUBPROCESS 2 ENDS                         ***/
-   }
-   
-   /* It's the parent, so wait for the children to finish               */
-   for(;;)
+   pid_t pid;
+   char  script[PATH_MAX],
+         cmd[PATH_MAX+2*MAXBUFF],
+         home[PATH_MAX+8],
+         user[MAXBUFF],
+         logname[MAXBUFF],
+         shell[PATH_MAX+8],
+         qltask[MAXBUFF],
+         *argv[6],
+         *envp[7];
+
+   sprintf(script, "%s/%s.run", JOB_DIR, jobname);
+
+   if((pid = fork()) != 0)
    {
-      if(waitpid(pid, &status, 0) == -1)  
+      if(pid == -1)
       {
-         if (errno != EINTR)
-            return(-1);
+         if(gDebug)
+            fprintf(stderr,"Unable to fork to run job %s\n", jobname);
       }
       else
       {
-         /* WIFEXITED() tells us whether the child exited normally.
-            If not then it was killed by our timer process, so
-            we return(9)
-
-            WEXITSTATUS() extracts the exit status as an unsigned
-            value, the cast to char and then to int turns it back
-            into a signed int < 256
-         */
-         if(WIFEXITED(status))
-         {
-            retval = ((int)(char)WEXITSTATUS(status));
-         }
-         else
-         {
-            retval = 9;
-         }
-         
-         /* Kill the timer in case SUBPROCESS-1 completed and then wait
-            for the timer to stop it from zombie-ing.
+         /* Done in both processes so it is in place whichever runs 
+            first
          */
-         kill(pidtimer, 9);
-         waitpid(pidtimer, &status, 0);
-         return(retval);
+         setpgid(pid, pid);
       }
+      return(pid);
    }
 
-   return(0);
+   /***                     CHILD PROCESS BEGINS                      ***/
+   /* Give the job its own process group so that it can be killed with
+      anything it has started
+   */
+   setpgid(0, 0);
+
+   /* Lower the priority while we are still root                        */
+   setpriority(PRIO_PROCESS, 0, -nice);
+
+   sprintf(qltask, "QLTASK=%lu", task);
+
+   if(gLoginShell)
+   {
+      /* su - clears the environment, so QLTASK is set in the command   */
+      if(task)
+         sprintf(cmd, "%s; export QLTASK; %s %s", qltask, SHELL, script);
+      else
+         sprintf(cmd, "%s %s", SHELL, script);
+      argv[0] = "su";
+      argv[1] = "-";
+      argv[2] = pwd->pw_name;
+      argv[3] = "-c";
+      argv[4] = cmd;
+      argv[5] = NULL;
+      execve(SU, argv, environ);
+      _exit(127);
+   }
+
+   /* Become the user                                                   */
+   if((initgroups(pwd->pw_name, gid) != 0) || 
+      (setgid(gid) != 0)                    ||
+      (setuid(pwd->pw_uid) != 0))
+   {
+      _exit(127);
+   }
+
+   if(chdir(pwd->pw_dir) != 0)
+      chdir("/");
+
+   sprintf(home,    "HOME=%s",    pwd->pw_dir);
+   sprintf(user,    "USER=%.*s",    MAXBUFF-6, pwd->pw_name);
+   sprintf(logname, "LOGNAME=%.*s", MAXBUFF-9, pwd->pw_name);
+   sprintf(shell,   "SHELL=%s",   pwd->pw_shell);
+   envp[0] = home;
+   envp[1] = user;
+   envp[2] = logname;
+   envp[3] = shell;
+   envp[4] = "PATH=" JOB_PATH;
+   envp[5] = (task ? qltask : NULL);
+   envp[6] = NULL;
+
+   argv[0] = "sh";
+   argv[1] = script;
+   argv[2] = NULL;
+   execve(SHELL, argv, envp);
+   _exit(127);
+   /***                     CHILD PROCESS ENDS                        ***/
 }
 
 
@@ -1037,13 +2302,14 @@ int system_tlimit(char *command, int timelimit)
 */
 void Usage(void)
 {
-   fprintf(stderr, "\nqlrun V1.0 (c) 2000 University of Reading, Dr. \
+   fprintf(stderr, "\nqlrun V1.6 (c) 2000 University of Reading, Dr. \
 Andrew C.R. Martin\n");
 
    fprintf(stderr, "\nUsage: qlrun [-d] [-s spooldir] [-c cluster] \
 [-i pinum] [-n maxnice] \n");
    fprintf(stderr,"             [-p port] [-l lockhost] \
-[-t timelimit]\n");
+[-t timelimit] [-j nslots|auto]\n");
+   fprintf(stderr,"             [-b maxbatch] [-g grace] [-L]\n");
    fprintf(stderr, "       -d Run in interactive debug mode rather than \
 as a daemon\n");
    fprintf(stderr, "       -s Specify the spool directory (Default: \
@@ -1055,6 +2321,19 @@ machine\n");
    fprintf(stderr, "       -t Maximum allowed time for a process in \
 minutes.\n");
    fprintf(stderr, "          (Default: 0 = unlimited)\n");
+   fprintf(stderr, "       -g Seconds between SIGTERM and SIGKILL when \
+a job runs out of\n");
+   fprintf(stderr, "          time (Default: %d)\n", GRACE_TIME);
+   fprintf(stderr, "       -L Run jobs through su - so that the user's \
+login profile is read\n");
+#ifndef FILE_BASED_LOCKING
+   fprintf(stderr, "       -j Number of jobs to run at once, or 'auto' \
+for one per CPU\n");
+   fprintf(stderr, "          (Default: 1)\n");
+   fprintf(stderr, "       -b Most jobs to take from the queue at once \
+for a slot\n");
+   fprintf(stderr, "          (Default: 1, Max: %d)\n", MAXBATCH);
+#endif
 
 #ifndef FILE_BASED_LOCKING
    fprintf(stderr, "       -l Specify the host name running the qllockd \
@@ -1069,8 +2348,8 @@ daemon\n");
 and runs jobs from the\n");
    fprintf(stderr, "queue created by qlsubmit. If you have more than \
 one processor on a\n");
-   fprintf(stderr, "machine, simply start the daemon once for each \
-processor.\n");
+   fprintf(stderr, "machine, either use -j or start the daemon once for \
+each processor.\n");
 
    fprintf(stderr, "\nThe cluster number simple lets sets of machines \
 share a common spool\n");
@@ -1088,6 +2367,10 @@ specified with -p\n");
 to list running\n");
    fprintf(stderr, "jobs correctly.) The default process instance \
 number is 1.\n");
+#ifndef FILE_BASED_LOCKING
+   fprintf(stderr, "With -j n, the slots use instance numbers pinum to \
+pinum+n-1.\n");
+#endif
 
    fprintf(stderr, "\nNice levels default to 10 (i.e. nice -10) when \
 jobs are submitted, but\n");
@@ -3,8 +3,8 @@
    Program:    qlsubmit
    File:       qlsubmit.c
    
-   Version:    V1.1
-   Date:       15.09.00
+   Version:    V1.8
+   Date:       18.10.26
    Function:   Submit jobs for farm processing
    
    Copyright:  (c) University of Reading / Dr. Andrew C. R. Martin 2000
@@ -50,6 +50,14 @@
 
    Revision History:
    =================
+   V1.2  18.10.26  Added -P to give a job a priority
+   V1.3  18.10.26  Added -a to submit a job array
+   V1.4  18.10.26  Added -m to submit several jobs at once
+   V1.5  18.10.26  Job numbers come from qllockd when it is running
+   V1.6  18.10.26  Rejects job file names containing a newline
+   V1.7  18.10.26  Keeps telling qllockd about later jobs after an ENQUEUE
+                   fails
+   V1.8  18.10.26  Fails rather than reusing job numbers from 1
 
 *************************************************************************/
 /* Includes
@@ -71,6 +79,11 @@
 /************************************************************************/
 /* Defines and macros
 */
+typedef struct _jobfile
+{
+   struct _jobfile *next;
+   char            *file;
+}  JOBFILE;
 
 /************************************************************************/
 /* Globals
@@ -80,37 +93,66 @@
 /* Prototypes
 */
 int main(int argc, char **argv);
-BOOL ParseCmdLine(int argc, char **argv, char *jobfile, BOOL *doDelete,
-                  char *spoolDir, BOOL *quiet, int *cluster, int *nice,
-                  char *lockhost, int *port);
-ULONG SubmitJob(char *jobfile, char *spoolDir, uid_t uid, gid_t gid, 
-                int nice);
+BOOL ParseCmdLine(int argc, char **argv, JOBFILE **jobfiles, 
+                  BOOL *manifest, BOOL *doDelete, char *spoolDir, 
+                  BOOL *quiet, int *cluster, int *nice, char *lockhost, 
+                  int *port, int *priority, ULONG *firstTask, 
+                  ULONG *lastTask);
+BOOL AddJobFile(JOBFILE **jobfiles, JOBFILE **last, char *file);
+BOOL ReadManifest(FILE *in, JOBFILE **jobfiles);
+ULONG ReserveJobNumbers(char *spoolDir, ULONG njobs);
+BOOL SubmitJob(char *jobfile, char *spoolDir, ULONG jobnum, uid_t uid, 
+               gid_t gid, int nice, int priority, ULONG firstTask, 
+               ULONG lastTask, int durability);
 void Usage(void);
-BOOL WriteControlFile(char *jobfile, char *spoolDir, ULONG jobnum, 
-                      uid_t uid, gid_t gid, int nice);
 
 /************************************************************************/
 /*>int main(int argc, char **argv)
    -------------------------------
    Main program for submitting jobs to a farm
 
+   Any number of jobs may be submitted at once. Their job numbers are
+   reserved with a single request to qllockd (or a single update of the
+   job counter under the lock), so a large batch costs little more than
+   a single job.
+
    14.09.00 Original   By: ACRM
+   18.10.26 Takes several job files or a manifest on stdin
+   18.10.26 Gets job numbers from qllockd before taking the lock
+   18.10.26 The lock is only taken to update the job counter
+   18.10.26 -d removes the job file as the real user
+   18.10.26 Rejects job file names containing a newline
+   18.10.26 Keeps telling qllockd about later jobs after one fails
 */
 int main(int argc, char **argv)
 {
-   uid_t uid;
-   gid_t gid;
-   char  jobfile[PATH_MAX],
-         *env;
-   BOOL  doDelete = FALSE,
-         quiet = FALSE;
-   int   status,
-         cluster = 0,
-         nice    = 10,
-         port    = 0;
-   ULONG jobnum;
-   char  spoolDir[PATH_MAX],
-         lockhost[MAXBUFF];
+   uid_t   uid;
+   gid_t   gid;
+   char    *env;
+   BOOL    doDelete  = FALSE,
+           quiet     = FALSE,
+           manifest  = FALSE;
+#ifndef FILE_BASED_LOCKING
+   ULONG   nunqueued = 0;
+#endif
+   int     status,
+           retval  = 0,
+           cluster = 0,
+           nice    = 10,
+           port    = 0,
+           priority = 0,
+           durability;
+   ULONG   jobnum,
+           firstJob  = 0,
+           njobs     = 0,
+           nqueued   = 0,
+           firstTask = 0,
+           lastTask  = 0;
+   JOBFILE *jobfiles = NULL,
+           *j;
+   char    spoolDir[PATH_MAX],
+           lockhost[MAXBUFF],
+           lockName[MAXLOCKNAME];
    
    /* Get the default spool directory from the environment variable if
       this has been set
@@ -126,10 +168,10 @@ int main(int argc, char **argv)
    if((env=getenv("QLCLUSTER"))!=NULL)
       sscanf(env,"%d", &cluster);
 
-   if(ParseCmdLine(argc, argv, jobfile, &doDelete, spoolDir, &quiet,
-                   &cluster, &nice, lockhost, &port))
+   if(ParseCmdLine(argc, argv, &jobfiles, &manifest, &doDelete, 
+                   spoolDir, &quiet, &cluster, &nice, lockhost, &port, 
+                   &priority, &firstTask, &lastTask))
    {
-      CreateFullPath(jobfile);
       if(cluster!=0)
          UpdateSpoolDir(spoolDir, cluster);
       
@@ -140,6 +182,44 @@ int main(int argc, char **argv)
          return(1);
       }
 
+      /* Find the IDs for the person running the submit command         */
+      uid = getuid();
+      gid = getgid();
+
+      /* Reject jobs submitted by root                                  */
+      if((uid == (uid_t)0) || (gid == (gid_t)0))
+      {
+         fprintf(stderr,"Jobs may not be submitted by root!\n");
+         return(1);
+      }
+
+      /* Read the whole manifest before taking the lock so that a slow
+         writer on stdin does not hold up everyone else
+      */
+      if(manifest && !ReadManifest(stdin, &jobfiles))
+      {
+         fprintf(stderr,"No memory for the list of job files\n");
+         return(1);
+      }
+      
+      /* The name goes into the job record's header, which is one line
+         per key, so a newline could be used to add keys of our own
+      */
+      for(j=jobfiles; j!=NULL; NEXT(j))
+      {
+         if(strchr(j->file, '\n') != NULL)
+         {
+            fprintf(stderr,"Job file names may not contain a newline\n");
+            return(1);
+         }
+         njobs++;
+      }
+      if(njobs == 0)
+      {
+         fprintf(stderr,"No job files to submit\n");
+         return(1);
+      }
+
       /* If either the port of host has not been specified get the values
          from a file
       */
@@ -156,104 +236,161 @@ the spool directory or the -l flag\n");
          }
       }
 
-      InitLocks("qlite", lockhost, port);
+      /* Each cluster has its own lock in qllockd                       */
+      sprintf(lockName, "%d", cluster);
+      InitLocks("qlite", lockhost, port, lockName);
+
+#ifndef FILE_BASED_LOCKING
+      /* qllockd keeps the job counter so this needs no lock            */
+      if(!AllocateJobIds(cluster, njobs, &firstJob))
+         firstJob = 0L;
+#endif
       
+      /* Otherwise the job counter is updated under the lock. Nothing
+         else needs it, since the jobs themselves appear atomically
+      */
+      if(firstJob == 0L)
+      {
 #ifdef FILE_BASED_LOCKING
-      if((status=CreateLockFile(spoolDir))==0)
+         if((status=CreateLockFile(spoolDir))==0)
 #else
-      if((status=GetLock(0,LOCK_TIMEOUT))==0)
+         if((status=GetLock(0,LOCK_TIMEOUT,LOCK_EXCLUSIVE))==0)
 #endif
-      {
-         /* Find the IDs for the person running the submit command      */
-         uid = getuid();
-         gid = getgid();
-
-         /* Reject jobs submitted by root                               */
-         if((uid == (uid_t)0) || (gid == (gid_t)0))
          {
-            fprintf(stderr,"Jobs may not be submitted by root!\n");
-            return(1);
-         }
-      
-         /* Actually queue the job                                      */
-         if((jobnum=SubmitJob(jobfile, spoolDir, uid, gid, nice))==0L)
-         {
-            fprintf(stderr,"Unable to queue the job\n");
+            firstJob = ReserveJobNumbers(spoolDir, njobs);
 #ifdef FILE_BASED_LOCKING
             DeleteLockFile(spoolDir);
 #else
             ReleaseLock(0);
 #endif
+         }
+         else if(status==1)
+         {
+            fprintf(stderr,
+                    "Timeout waiting for lock to clear exceeded. \
+Job not submitted\n");
+            return(1);
+         }
+         else
+         {
+            fprintf(stderr,
+                    "Unable to create lock. Job not submitted\n");
             return(1);
          }
-         else if(!quiet)
+
+         if(firstJob == 0L)
          {
-            printf("Submitted job number %ld\n", jobnum);
+            fprintf(stderr,"Unable to allocate job numbers\n");
+            return(1);
+         }
+      }
+
+      durability = ReadDurability(spoolDir);
+      
+      for(j=jobfiles, jobnum=firstJob; j!=NULL; NEXT(j), jobnum++)
+      {
+         /* Actually queue the job                                      */
+         if(!SubmitJob(j->file, spoolDir, jobnum, uid, gid, nice, 
+                       priority, firstTask, lastTask, durability))
+         {
+            fprintf(stderr,"Unable to queue the job %s\n", j->file);
+            retval = 1;
+            continue;
+         }
+
+         nqueued++;
+         if(!quiet)
+         {
+            if(firstTask)
+               printf("Submitted job array %ld (tasks %lu-%lu)\n", 
+                      jobnum, firstTask, lastTask);
+            else
+               printf("Submitted job number %ld\n", jobnum);
+            fflush(stdout);
          }
 
          /* Delete the job file if requested to do so                   */
          if(doDelete)
-            unlink(jobfile);
+            UnlinkUserFile(j->file);
 
-         /* ...and remove the lock file                                 */
-#ifdef FILE_BASED_LOCKING
-         DeleteLockFile(spoolDir);
-#else
-         ReleaseLock(0);
+#ifndef FILE_BASED_LOCKING
+         /* Tell the lock daemon the job is there to be run, so it may
+            start while we are still submitting the rest. One failure
+            need not mean the next will fail too
+         */
+         if(!EnqueueJob(cluster, jobnum, priority, firstTask, lastTask))
+         {
+            fprintf(stderr,"Warning: Unable to tell the lock daemon \
+about job %ld.\n", jobnum);
+            nunqueued++;
+         }
 #endif
       }
-      else if(status==1)
-      {
-         fprintf(stderr,
-                 "Timeout waiting for lock to clear exceeded. \
-Job not submitted\n");
-         return(1);
-      }
-      else
+
+#ifndef FILE_BASED_LOCKING
+      if(nunqueued)
       {
-         fprintf(stderr,
-                 "Unable to create lock. Job not submitted\n");
-         return(1);
+         fprintf(stderr,"Warning: %lu job(s) will not run until qllockd \
+next rescans the\n", nunqueued);
+         fprintf(stderr,"         spool (within a few minutes, or \
+at once on SIGUSR1).\n");
       }
+#endif
+
+      if(!quiet && (njobs > 1))
+         printf("Submitted %lu of %lu jobs\n", nqueued, njobs);
    }
    else
    {
       Usage();
    }
    
-   return(0);
+   return(retval);
 }
 
 
 /************************************************************************/
-/*>BOOL ParseCmdLine(int argc, char **argv, char *jobfile, BOOL *doDelete,
-                     char *spoolDir, BOOL *quiet, int *cluster, int *nice,
-                     char *lockhost, int *port)
+/*>BOOL ParseCmdLine(int argc, char **argv, JOBFILE **jobfiles, 
+                     BOOL *manifest, BOOL *doDelete, char *spoolDir, 
+                     BOOL *quiet, int *cluster, int *nice, char *lockhost,
+                     int *port, int *priority, ULONG *firstTask, 
+                     ULONG *lastTask)
    -----------------------------------------------------------------------
-   Input:     int   argc         Argument count
-              char  **argv       Arguments
-   Output:    char  *jobfile     The job file to be submitted
+   Input:     int     argc       Argument count
+              char    **argv     Arguments
+   Output:    JOBFILE **jobfiles The job files to be submitted
+              BOOL    *manifest  Read more job files from stdin?
               BOOL  *doDelete    Delete the job file when queued? 
               char  *spoolDir    Spool directory
               int   *cluster     Cluster number
               int   *nice        Requested nice level
               char  *lockhost    Lock host name
               int   *port        Port number for qllockd
+              int   *priority    Dispatch priority
+              ULONG *firstTask   First task of a job array (0 if none)
+              ULONG *lastTask    Last task of a job array
    Returns:   BOOL               Success?
 
    Parses the command line
 
    14.09.00 Original   By: ACRM
    04.10.00 Added lockhost and port
+   18.10.26 Added -P
+   18.10.26 Added -a
+   18.10.26 Takes any number of job files. Added -m
 */
-BOOL ParseCmdLine(int argc, char **argv, char *jobfile, BOOL *doDelete,
-                  char *spoolDir, BOOL *quiet, int *cluster, int *nice,
-                  char *lockhost, int *port)
+BOOL ParseCmdLine(int argc, char **argv, JOBFILE **jobfiles, 
+                  BOOL *manifest, BOOL *doDelete, char *spoolDir, 
+                  BOOL *quiet, int *cluster, int *nice, char *lockhost, 
+                  int *port, int *priority, ULONG *firstTask, 
+                  ULONG *lastTask)
 {
+   JOBFILE *last = NULL;
+   
    argc--;
    argv++;
 
-   jobfile[0]  = '\0';
+   *jobfiles   = NULL;
    lockhost[0] = '\0';
    
    while(argc)
@@ -268,6 +405,9 @@ BOOL ParseCmdLine(int argc, char **argv, char *jobfile, BOOL *doDelete,
          case 'q':
             *quiet = TRUE;
             break;
+         case 'm':
+            *manifest = TRUE;
+            break;
          case 's':
             argv++;
             argc--;
@@ -308,6 +448,25 @@ BOOL ParseCmdLine(int argc, char **argv, char *jobfile, BOOL *doDelete,
             if(*nice < 0)
                *nice = 0;
             break;
+         case 'P':
+            argv++;
+            argc--;
+            if(!argc)
+               return(FALSE);
+            if(!sscanf(argv[0],"%d", priority))
+               return(FALSE);
+            break;
+#ifndef FILE_BASED_LOCKING
+         case 'a':
+            argv++;
+            argc--;
+            if(!argc)
+               return(FALSE);
+            if((sscanf(argv[0],"%lu-%lu", firstTask, lastTask) != 2) ||
+               (*firstTask == 0) || (*lastTask < *firstTask))
+               return(FALSE);
+            break;
+#endif
          default:
             return(FALSE);
             break;
@@ -315,12 +474,14 @@ BOOL ParseCmdLine(int argc, char **argv, char *jobfile, BOOL *doDelete,
       }
       else
       {
-         /* Check that there is 1 argument left                         */
-         if(argc != 1)
-            return(FALSE);
-         
-         /* Copy the filename to jobfile                                */
-         strcpy(jobfile, argv[0]);
+         /* All remaining arguments are job files                       */
+         while(argc)
+         {
+            if(!AddJobFile(jobfiles, &last, argv[0]))
+               return(FALSE);
+            argc--;
+            argv++;
+         }
          
          return(TRUE);
       }
@@ -329,107 +490,175 @@ BOOL ParseCmdLine(int argc, char **argv, char *jobfile, BOOL *doDelete,
       argv++;
    }
    
-   return(FALSE);
+   /* No job files is fine if they are to be read from stdin            */
+   return(*manifest);
 }
 
 
 /************************************************************************/
-/*>ULONG SubmitJob(char *jobfile, char *spoolDir, uid_t uid, gid_t gid, 
-                   int nice)
-   -------------------------------------------------------------------
-   Input:     char    *jobfile    The job file to be queued
-              char    *spoolDir   The directory to queue it to
-              uid_t   uid         The UID of the submitter
-              gid_t   gid         The GID of the submitter
-              int     nice        Requested nice level
-   Returns:   ULONG               Job number
+/*>BOOL AddJobFile(JOBFILE **jobfiles, JOBFILE **last, char *file)
+   ---------------------------------------------------------------
+   I/O:       JOBFILE **jobfiles  The list of job files
+              JOBFILE **last      The last entry in the list
+   Input:     char    *file       Job file to add
+   Returns:   BOOL                Success?
 
-   Actually sends a job into the queue and creates a control file for it
+   Adds a job file to the end of the list, first turning it into a full
+   path name
 
-   14.09.00 Original   By: ACRM
+   18.10.26 Original   By: ACRM
 */
-ULONG SubmitJob(char *jobfile, char *spoolDir, uid_t uid, gid_t gid, 
-                int nice)
+BOOL AddJobFile(JOBFILE **jobfiles, JOBFILE **last, char *file)
 {
-   char cmd[PATH_MAX+MAXBUFF],
-        spoolfile[MAXBUFF],
-        infofile[MAXBUFF];
-   ULONG jobnum = 0L;
-   FILE  *fp;
-
-   /* Find a number for this job                                        */
-   sprintf(infofile,"%s/.qllastjob", spoolDir);
-   if((fp=fopen(infofile, "r"))!=NULL)
-   {
-      fscanf(fp,"%lu", &jobnum);
-      fclose(fp);
-   }
-   if(++jobnum == 0L)
-      jobnum = 1L;
+   char buffer[PATH_MAX];
 
-   if((fp=fopen(infofile, "w"))!=NULL)
+   strncpy(buffer, file, PATH_MAX-1);
+   buffer[PATH_MAX-1] = '\0';
+   CreateFullPath(buffer);
+   
+   if(*jobfiles == NULL)
    {
-      fprintf(fp,"%ld", jobnum);
-      fclose(fp);
-      chown(infofile, 0, 0);            /* Owned by root                */
+      INIT((*jobfiles), JOBFILE);
+      *last = *jobfiles;
    }
    else
    {
-      return(0);
+      ALLOCNEXT(*last, JOBFILE);
    }
-   
-   /* Copy the job file across to the spool directory                   */
-   sprintf(spoolfile,"%s/%ld.job", spoolDir, jobnum);
-   sprintf(cmd,"cp %s %s", jobfile, spoolfile);
-   if(system(cmd))
-      return(0);
-   chown(spoolfile, uid, gid);          /* Owned by submitting user     */
+   if(*last == NULL)
+      return(FALSE);
 
-   /* Create a control file                                             */
-   if(!WriteControlFile(jobfile, spoolDir, jobnum, uid, gid, nice))
-      return(0);
+   if(((*last)->file = (char *)malloc(strlen(buffer)+1)) == NULL)
+      return(FALSE);
+   strcpy((*last)->file, buffer);
    
-   return(jobnum);
+   return(TRUE);
 }
 
 
 /************************************************************************/
-/*>BOOL WriteControlFile(char *jobfile, char *spoolDir, ULONG jobnum, 
-                         uid_t uid, gid_t gid, int nice)
-   -------------------------------------------------------------
-   Input:     char  *jobfile     The original job file
-              chat  *spoolDir    The spool directory
-              ULONG jobnum       The job number
-              uid_t uid          The UID
-              gid_t gid          The GID
-              int   nice         The requested nice value
-   Returns:   BOOL               Success?
+/*>BOOL ReadManifest(FILE *in, JOBFILE **jobfiles)
+   -----------------------------------------------
+   Input:     FILE    *in         Manifest to read
+   I/O:       JOBFILE **jobfiles  The list of job files
+   Returns:   BOOL                Success?
 
-   Writes a control file for a job containing the UID/GID of the 
-   submitter, the name of the submitted file and the requested nice level
+   Reads job file names, one per line, and adds them to the end of the
+   list. Blank lines are skipped.
 
-   14.09.00 Original   By: ACRM
+   18.10.26 Original   By: ACRM
 */
-BOOL WriteControlFile(char *jobfile, char *spoolDir, ULONG jobnum, 
-                      uid_t uid, gid_t gid, int nice)
+BOOL ReadManifest(FILE *in, JOBFILE **jobfiles)
 {
-   char ctrlfile[MAXBUFF];
-   FILE *fp;
-   
-   sprintf(ctrlfile,"%s/%ld.ctrl", spoolDir, jobnum);
-   if((fp=fopen(ctrlfile,"w"))==NULL)
-      return(FALSE);
+   char    buffer[PATH_MAX],
+           *chp;
+   JOBFILE *last;
+
+   for(last=*jobfiles; (last!=NULL) && (last->next!=NULL); NEXT(last));
    
-   fprintf(fp,"J: %s\n", jobfile);
-   fprintf(fp,"U: %ld\n", (ULONG)uid);
-   fprintf(fp,"G: %ld\n", (ULONG)gid);
-   fprintf(fp,"N: %d\n", nice);
+   while(fgets(buffer, PATH_MAX, in))
+   {
+      TERMINATE(buffer);
+      KILLTRAILSPACES(buffer);
+      KILLLEADSPACES(chp, buffer);
+      if(*chp)
+      {
+         if(!AddJobFile(jobfiles, &last, chp))
+            return(FALSE);
+      }
+   }
    
-   fclose(fp);
+   return(TRUE);
+}
 
-   chown(ctrlfile, 0, 0);               /* Owned by root                */
 
-   return(TRUE);
+/************************************************************************/
+/*>ULONG ReserveJobNumbers(char *spoolDir, ULONG njobs)
+   -----------------------------------------------------
+   Input:     char    *spoolDir   The spool directory
+              ULONG   njobs       Number of job numbers wanted
+   Returns:   ULONG               First of njobs consecutive job numbers
+                                  (0 on failure)
+
+   Reserves a block of job numbers by reading and rewriting the job
+   counter just once. Must be called with the lock held. Only used with
+   file based locking or a qllockd which can't hand out job numbers 
+   itself. Like qllockd, it fails rather than wrapping round to 1,
+   which could reuse the number of a job still waiting.
+
+   18.10.26 Original   By: ACRM
+   18.10.26 Counter is replaced atomically by WriteLastJob()
+   18.10.26 Fails rather than wrapping round
+*/
+ULONG ReserveJobNumbers(char *spoolDir, ULONG njobs)
+{
+   ULONG jobnum;
+
+   jobnum = ReadLastJob(spoolDir);
+
+   /* Starting again from 1 could reuse a waiting job's number         */
+   if((++jobnum == 0L) || ((jobnum + njobs - 1) < jobnum))
+      return(0);
+
+   if(!WriteLastJob(spoolDir, jobnum + njobs - 1))
+      return(0);
+
+   return(jobnum);
+}
+
+
+/************************************************************************/
+/*>BOOL SubmitJob(char *jobfile, char *spoolDir, ULONG jobnum, uid_t uid,
+                  gid_t gid, int nice, int priority, ULONG firstTask, 
+                  ULONG lastTask, int durability)
+   -------------------------------------------------------------------
+   Input:     char    *jobfile    The job file to be queued
+              char    *spoolDir   The directory to queue it to
+              ULONG   jobnum      Job number from ReserveJobNumbers()
+              uid_t   uid         The UID of the submitter
+              gid_t   gid         The GID of the submitter
+              int     nice        Requested nice level
+              int     priority    Dispatch priority
+              ULONG   firstTask   First task of a job array (0 if none)
+              ULONG   lastTask    Last task of a job array
+              int     durability  From ReadDurability()
+   Returns:   BOOL                Success?
+
+   Actually sends a job into the queue as a single job record holding
+   the UID/GID of the submitter, the name of the submitted file, the
+   requested nice level and priority, and the script itself. A job 
+   array is queued just like a single job; its tasks are handed out 
+   one by one by qllockd. If the spool directory has a journal the
+   record is appended to that instead.
+
+   14.09.00 Original   By: ACRM
+   18.10.26 Copies the job with CopyFile() rather than cp
+   18.10.26 Added priority
+   18.10.26 Added firstTask and lastTask
+   18.10.26 Takes the job number rather than allocating it
+   18.10.26 Files are published atomically. Added durability
+   18.10.26 Writes a single job record with WriteJobRecord() rather 
+            than a job file and a control file
+   18.10.26 Appends to the journal with JournalAppend() if there is one
+*/
+BOOL SubmitJob(char *jobfile, char *spoolDir, ULONG jobnum, uid_t uid, 
+               gid_t gid, int nice, int priority, ULONG firstTask, 
+               ULONG lastTask, int durability)
+{
+   JOBRECORD rec;
+
+   strncpy(rec.jobfile, jobfile, PATH_MAX-1);
+   rec.jobfile[PATH_MAX-1] = '\0';
+   rec.uid       = uid;
+   rec.gid       = gid;
+   rec.nice      = nice;
+   rec.priority  = priority;
+   rec.firstTask = firstTask;
+   rec.lastTask  = lastTask;
+
+   if(JournalEnabled(spoolDir))
+      return(JournalAppend(spoolDir, jobnum, &rec, jobfile, durability));
+   return(WriteJobRecord(spoolDir, jobnum, &rec, jobfile, durability));
 }
 
 /************************************************************************/
@@ -441,21 +670,32 @@ BOOL WriteControlFile(char *jobfile, char *spoolDir, ULONG jobnum,
 */
 void Usage(void)
 {
-   fprintf(stderr,"\nqlsubmit V1.0 (c) 2000 University of Reading, \
+   fprintf(stderr,"\nqlsubmit V1.8 (c) 2000 University of Reading, \
 Dr. Andrew C.R. Martin\n");
 
-   fprintf(stderr,"\nUsage: qlsubmit [-d] [-q] [-s spooldir] \
+   fprintf(stderr,"\nUsage: qlsubmit [-d] [-q] [-m] [-s spooldir] \
 [-c cluster] [-n niceval]\n");
-   fprintf(stderr,"                [-p portnum] [-l lockhost] jobfile\n");
+   fprintf(stderr,"                [-P priority] [-a first-last] \
+[-p portnum] [-l lockhost]\n");
+   fprintf(stderr,"                [jobfile ...]\n");
    fprintf(stderr,"       -d Delete jobfile after submission\n");
    fprintf(stderr,"       -q Run quietly\n");
+   fprintf(stderr,"       -m Also read job file names, one per line, \
+from stdin\n");
    fprintf(stderr,"       -s Specify the directory for spooling\n");
    fprintf(stderr,"          (Default: %s)\n", DEF_SPOOLDIR);
    fprintf(stderr,"       -c Specify the cluster to process this job \
 (Default: 0) \n");
    fprintf(stderr,"       -n Nice level to run the job at \
 (Default: 10)\n");
+   fprintf(stderr,"       -P Priority. Waiting jobs with a higher \
+priority are started first\n");
+   fprintf(stderr,"          (Default: 0)\n");
 #ifndef FILE_BASED_LOCKING
+   fprintf(stderr,"       -a Submit a job array which runs jobfile once \
+for each task\n");
+   fprintf(stderr,"          from first to last with the task number \
+in $QLTASK\n");
    fprintf(stderr, "       -l Specify the host name running the qllockd \
 lock daemon\n");
    fprintf(stderr, "       -p Specify the port used for the lock \
@@ -466,7 +706,9 @@ daemon\n");
 
    fprintf(stderr,"\nqlsubmit submits a job for processing on a cluster \
 of machines using\n");
-   fprintf(stderr,"QLite.\n");
+   fprintf(stderr,"QLite. Any number of jobs may be submitted at once; \
+this is much\n");
+   fprintf(stderr,"quicker than running qlsubmit once for each.\n");
 
    fprintf(stderr,"\nThe cluster number simple lets sets of machines \
 share a common spool\n");
@@ -54,6 +54,9 @@
 *************************************************************************/
 /* Includes
 */
+#ifdef __linux__
+#  define _GNU_SOURCE             /* For O_TMPFILE                        */
+#endif
 #include <time.h>
 #include <string.h>
 #include <stdio.h>
@@ -70,6 +73,12 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <errno.h>
+#ifdef __linux__
+#  include <sys/sendfile.h>
+#  include <sys/syscall.h>
+#endif
 
 #include "qlutil.h"
 
@@ -78,6 +87,15 @@
 */
 #define TIMEOUT 10
 #define MAXBUFF 160
+#define COPYBUFF  65536       /* Buffer for copies done through read()  */
+#define COPYCHUNK 1073741824  /* Most asked of copy_file_range() at once*/
+#define HDR_JOBFILE 0x01    /* Keys seen by ReadJobHeader()            */
+#define HDR_UID     0x02
+#define HDR_GID     0x04
+#define HDR_NICE    0x08
+#define HDR_PRIO    0x10
+#define HDR_TASKS   0x20
+#define HDR_NEEDED  (HDR_JOBFILE|HDR_UID|HDR_GID|HDR_NICE)
 
 /************************************************************************/
 void UpdateSpoolDir(char *spoolDir, int cluster)
@@ -217,6 +235,80 @@ BOOL RootUser(void)
 }
 
 
+/************************************************************************/
+/*>int OpenUserFile(char *file)
+   ----------------------------
+   Input:   char   *file        A file named by the user
+   Returns: int                 Open file descriptor (-1 on failure)
+
+   qlsubmit is setuid root, so files the user names must be opened with
+   the user's own permissions or anyone could have any file spooled and
+   so read it. The effective UID is dropped to the real one for the
+   open() (checking with access() first would leave a race). Symbolic
+   links are not followed and anything but a regular file (a FIFO or a
+   device, say) is refused.
+
+   18.10.26 Original   By: ACRM
+*/
+int OpenUserFile(char *file)
+{
+   struct stat statbuff;
+   uid_t       euid = geteuid();
+   int         fd,
+               flags;
+
+   if(seteuid(getuid()))
+      return(-1);
+   fd = open(file, O_RDONLY | O_NOFOLLOW | O_NONBLOCK);
+   if(seteuid(euid))
+   {
+      /* Should never happen, but we mustn't carry on as the wrong user */
+      fprintf(stderr,"Unable to restore effective UID\n");
+      exit(1);
+   }
+   if(fd < 0)
+      return(-1);
+
+   if(fstat(fd, &statbuff) || !S_ISREG(statbuff.st_mode) ||
+      ((flags = fcntl(fd, F_GETFL)) < 0) ||
+      (fcntl(fd, F_SETFL, flags & ~O_NONBLOCK) < 0))
+   {
+      close(fd);
+      return(-1);
+   }
+
+   return(fd);
+}
+
+
+/************************************************************************/
+/*>BOOL UnlinkUserFile(char *file)
+   -------------------------------
+   Input:   char   *file        A file named by the user
+   Returns: BOOL                Success?
+
+   Removes a file with the real user's permissions rather than root's
+
+   18.10.26 Original   By: ACRM
+*/
+BOOL UnlinkUserFile(char *file)
+{
+   uid_t euid = geteuid();
+   BOOL  ok;
+
+   if(seteuid(getuid()))
+      return(FALSE);
+   ok = (unlink(file) == 0);
+   if(seteuid(euid))
+   {
+      fprintf(stderr,"Unable to restore effective UID\n");
+      exit(1);
+   }
+
+   return(ok);
+}
+
+
 /************************************************************************/
 /*>RUNFILE *ReadMachineList(char *spoolDir)
    ----------------------------------------
@@ -228,6 +320,7 @@ BOOL RootUser(void)
 
    22.09.00 Original   By: ACRM
    02.10.00 Modified to allow multiple instances 
+   18.10.26 Optional slot count for multi-slot qlrun daemons
 */
 RUNFILE *ReadMachineList(char *spoolDir)
 {
@@ -238,7 +331,9 @@ RUNFILE *ReadMachineList(char *spoolDir)
    RUNFILE *runfiles = NULL,
            *r;
    FILE    *fp;
-   int     instance;
+   int     instance,
+           nslots,
+           slot;
    
 
    sprintf(file,"%s/.machinelist", spoolDir);
@@ -251,26 +346,37 @@ RUNFILE *ReadMachineList(char *spoolDir)
             TERMINATE(buffer);
             KILLLEADSPACES(chp, buffer);
             KILLTRAILSPACES(chp);
-            if(runfiles==NULL)
-            {
-               INIT(runfiles, RUNFILE);
-               r = runfiles;
-            }
-            else
-            {
-               ALLOCNEXT(r, RUNFILE);
-            }
 
-            if((sscanf(chp, "%s %d", machine, &instance))!=2)
+            /* An optional third column gives the number of job slots
+               run by a qlrun -j daemon starting at this instance
+            */
+            nslots = 1;
+            if((sscanf(chp, "%s %d %d", machine, &instance, &nslots))<2)
             {
                fprintf(stderr,"Warning: Error in format of machine list \
 file: %s\n", file);
                return(NULL);
             }
-            
-            sprintf(r->file, "%s/.%s.running.%d", 
-                    spoolDir, machine, instance);
-            strncpy(r->node, chp, MAXBUFF);
+            if(nslots < 1)
+               nslots = 1;
+
+            for(slot=0; slot<nslots; slot++)
+            {
+               if(runfiles==NULL)
+               {
+                  INIT(runfiles, RUNFILE);
+                  r = runfiles;
+               }
+               else
+               {
+                  ALLOCNEXT(r, RUNFILE);
+               }
+
+               sprintf(r->file, "%s/.%s.running.%d", 
+                       spoolDir, machine, instance+slot);
+               strcpy(r->node, machine);
+               sprintf(r->node+strlen(machine), " %d", instance+slot);
+            }
          }
       }
    }
@@ -364,3 +470,670 @@ void GetPortAndLockHost(char *spoolDir, int *port, char *lockhost)
       fclose(fp);
    }
 }
+
+
+/************************************************************************/
+/*>BOOL CopyFile(char *from, char *to)
+   -----------------------------------
+   Input:   char   *from       File to copy
+            char   *to         File to create or overwrite
+   Returns: BOOL               Success?
+
+   Copies a file in-process rather than running cp. The new file gets
+   the permission bits of the original. A partial copy is removed.
+
+   18.10.26 Original   By: ACRM
+   18.10.26 Copying split out into CopyData()
+*/
+BOOL CopyFile(char *from, char *to)
+{
+   struct stat statbuff;
+   int         in,
+               out;
+   BOOL        ok;
+
+   if((in = open(from, O_RDONLY)) < 0)
+      return(FALSE);
+   if(fstat(in, &statbuff) ||
+      ((out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 
+                   statbuff.st_mode & 0777)) < 0))
+   {
+      close(in);
+      return(FALSE);
+   }
+
+   ok = CopyData(in, out);
+
+   close(in);
+   /* Errors writing to NFS may only be reported by close()             */
+   if(close(out))
+      ok = FALSE;
+   if(!ok)
+      unlink(to);
+
+   return(ok);
+}
+
+
+/************************************************************************/
+/*>BOOL CopyData(int in, int out)
+   ------------------------------
+   Input:   int    in          File to copy from
+            int    out         File to copy to
+   Returns: BOOL               Success?
+
+   Copies everything from the current position of one open file to 
+   another. On Linux, copy_file_range() lets the kernel (or an NFS 4.2
+   server) copy the data and sendfile() is tried if that is refused; 
+   anything left is copied through a buffer.
+
+   18.10.26 Original   By: ACRM (from CopyFile())
+*/
+BOOL CopyData(int in, int out)
+{
+   char        buffer[COPYBUFF];
+   ssize_t     nread = (-1);
+
+#ifdef __linux__
+   /* Each call carries on from where the last one stopped, so when one 
+      method fails the next picks up the rest of the file. A return of
+      0 means we have reached the end
+   */
+#  ifdef SYS_copy_file_range
+   while((nread = syscall(SYS_copy_file_range, in, NULL, out, NULL,
+                          (size_t)COPYCHUNK, 0)) > 0);
+#  endif
+   if(nread != 0)
+   {
+      while((nread = sendfile(out, in, NULL, (size_t)COPYCHUNK)) > 0);
+   }
+#endif
+
+   if(nread != 0)
+   {
+      while((nread = read(in, buffer, COPYBUFF)) > 0)
+      {
+         if(write(out, buffer, nread) != nread)
+            return(FALSE);
+      }
+      if(nread < 0)
+         return(FALSE);
+   }
+
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>int ReadDurability(char *spoolDir)
+   ----------------------------------
+   Input:   char   *spoolDir   Spool directory
+   Returns: int                DURABLE_NONE, DURABLE_DATA or DURABLE_FULL
+
+   Reads how hard new spool files should be pushed to disk from the
+   .qldurability file in the spool directory, which contains one of
+   the words none, data or full. The default is none: on NFS close() 
+   already sends the data to the server.
+
+   18.10.26 Original   By: ACRM
+*/
+int ReadDurability(char *spoolDir)
+{
+   FILE *fp;
+   char file[PATH_MAX],
+        word[MAXBUFF];
+   int  durability = DURABLE_NONE;
+
+   sprintf(file, "%s/.qldurability", spoolDir);
+   if((fp=fopen(file, "r"))!=NULL)
+   {
+      if(fscanf(fp, "%s", word) == 1)
+      {
+         if(!strcmp(word, "data"))
+            durability = DURABLE_DATA;
+         else if(!strcmp(word, "full"))
+            durability = DURABLE_FULL;
+      }
+      fclose(fp);
+   }
+
+   return(durability);
+}
+
+
+/************************************************************************/
+/*>int CreateSpoolFile(char *spoolDir, char *tmpName)
+   --------------------------------------------------
+   Input:   char   *spoolDir   Spool directory
+   Output:  char   *tmpName    Name of the temporary file (empty if it
+                               has none). PATH_MAX+MAXBUFF chars.
+   Returns: int                File descriptor (-1 on failure)
+
+   Creates a file in the spool directory which nobody else can see 
+   until it is given its real name by PublishSpoolFile(). On Linux it
+   is created with O_TMPFILE so it has no name at all and vanishes if
+   we die. Where that is not supported (e.g. NFS) a temporary name 
+   starting with a '.' is used, which everything reading the spool 
+   directory ignores.
+
+   18.10.26 Original   By: ACRM
+*/
+int CreateSpoolFile(char *spoolDir, char *tmpName)
+{
+   static int count = 0;
+   int        fd;
+
+   tmpName[0] = '\0';
+#ifdef O_TMPFILE
+   if((fd = open(spoolDir, O_TMPFILE | O_WRONLY, 0600)) >= 0)
+      return(fd);
+#endif
+
+   sprintf(tmpName, "%s/.qltmp.%ld.%d", spoolDir, (long)getpid(), 
+           count++);
+   return(open(tmpName, O_WRONLY | O_CREAT | O_EXCL, 0600));
+}
+
+
+/************************************************************************/
+/*>BOOL PublishSpoolFile(int fd, char *tmpName, char *file, 
+                         int durability)
+   -----------------------------------------------------------
+   Input:   int    fd          File from CreateSpoolFile()
+            char   *tmpName    Its temporary name
+            char   *file       Name to publish it as
+            int    durability  DURABLE_NONE, DURABLE_DATA or DURABLE_FULL
+   Returns: BOOL               Success?
+
+   Gives a file made by CreateSpoolFile() its real name in a single 
+   step, with linkat() or rename(), so anyone looking for it sees all
+   of it or nothing. With DURABLE_DATA the contents are flushed to disk
+   first; with DURABLE_FULL the directory entry is flushed as well.
+   The file is closed and on failure removed.
+
+   18.10.26 Original   By: ACRM
+*/
+BOOL PublishSpoolFile(int fd, char *tmpName, char *file, int durability)
+{
+   char procName[MAXBUFF],
+        dirName[PATH_MAX],
+        *chp;
+   BOOL ok = TRUE;
+   int  dirfd;
+
+   if((durability >= DURABLE_DATA) && fsync(fd))
+      ok = FALSE;
+
+   if(ok)
+   {
+      if(tmpName[0])
+      {
+         /* Errors writing to NFS may only be reported by close()       */
+         if(close(fd))
+            ok = FALSE;
+         fd = (-1);
+         if(ok && rename(tmpName, file))
+            ok = FALSE;
+      }
+      else
+      {
+         sprintf(procName, "/proc/self/fd/%d", fd);
+         if(linkat(AT_FDCWD, procName, AT_FDCWD, file, 
+                   AT_SYMLINK_FOLLOW))
+            ok = FALSE;
+      }
+   }
+
+   if(fd >= 0)
+      close(fd);
+   if(!ok)
+   {
+      if(tmpName[0])
+         unlink(tmpName);
+      return(FALSE);
+   }
+
+   if(durability >= DURABLE_FULL)
+   {
+      strcpy(dirName, file);
+      if((chp = strrchr(dirName, '/')) != NULL)
+         *chp = '\0';
+      if((dirfd = open(dirName, O_RDONLY)) >= 0)
+      {
+         fsync(dirfd);
+         close(dirfd);
+      }
+   }
+
+   return(TRUE);
+}
+
+
+/************************************************************************/
+/*>int FormatJobHeader(char *buffer, JOBRECORD *rec)
+   -------------------------------------------------
+   Input:   JOBRECORD *rec     Details of a job
+   Output:  char      *buffer  The header (MAXJOBHEADER chars)
+   Returns: int                Length of the header
+
+   Builds the header of a job record. This is the JOBMAGIC line 
+   followed by one line for each detail of the job, key first, and
+   ends with a blank line. The priority (P:) is only given if it is not
+   0 and the task range (A:) only for a job array. The script follows
+   the blank line.
+
+   The job file name (J:) comes last, after the user and group, so that
+   a name holding newlines can only repeat keys, which ReadJobHeader()
+   refuses, rather than supply them before the real ones.
+
+   18.10.26 Original   By: ACRM (from WriteControlFile() in qlsubmit.c)
+   18.10.26 Job file name is the last key
+*/
+int FormatJobHeader(char *buffer, JOBRECORD *rec)
+{
+   char *chp = buffer;
+
+   chp += sprintf(chp, "%s\n", JOBMAGIC);
+   chp += sprintf(chp, "U: %lu\n", (ULONG)rec->uid);
+   chp += sprintf(chp, "G: %lu\n", (ULONG)rec->gid);
+   chp += sprintf(chp, "N: %d\n", rec->nice);
+   if(rec->priority)
+      chp += sprintf(chp, "P: %d\n", rec->priority);
+   if(rec->firstTask)
+      chp += sprintf(chp, "A: %lu %lu\n", rec->firstTask, rec->lastTask);
+   chp += sprintf(chp, "J: %s\n", rec->jobfile);
+   chp += sprintf(chp, "\n");
+
+   return((int)(chp - buffer));
+}
+
+
+/************************************************************************/
+/*>BOOL ReadJobRecord(char *file, JOBRECORD *rec)
+   ----------------------------------------------
+   Input:   char      *file    A job record (or just its header)
+   Output:  JOBRECORD *rec     Details of the job
+   Returns: BOOL               Was it a complete header?
+
+   Reads the header of a job record written by WriteJobRecord(). Keys
+   which are missing take their defaults (priority 0, not an array).
+   rec->bodyOffset is set to where the script starts.
+
+   18.10.26 Original   By: ACRM
+   18.10.26 Parsing moved to ReadJobHeader()
+*/
+BOOL ReadJobRecord(char *file, JOBRECORD *rec)
+{
+   FILE  *fp;
+   BOOL  ok;
+
+   memset(rec, 0, sizeof(JOBRECORD));
+   if((fp=fopen(file, "r"))==NULL)
+      return(FALSE);
+
+   ok = ReadJobHeader(fp, rec);
+   fclose(fp);
+
+   return(ok);
+}
+
+
+/************************************************************************/
+/*>BOOL ReadJobHeader(FILE *fp, JOBRECORD *rec)
+   --------------------------------------------
+   Input:   FILE      *fp      Positioned at the start of a job record
+   Output:  JOBRECORD *rec     Details of the job
+   Returns: BOOL               Was it a complete header?
+
+   Parses the header of a job record from the current position in fp,
+   so that a record need not be a file of its own. rec->bodyOffset is
+   set to the file position at which the script starts.
+
+   The job is run as the user given by the header, so it is refused if
+   any key is repeated or cannot be read, or if any of J:, U:, G: and 
+   N: is missing.
+
+   18.10.26 Original   By: ACRM (from ReadJobRecord())
+   18.10.26 Rejects repeated, unreadable and missing keys
+*/
+BOOL ReadJobHeader(FILE *fp, JOBRECORD *rec)
+{
+   char  buffer[PATH_MAX+MAXBUFF];
+   ULONG value;
+   int   key,
+         seen = 0;
+   BOOL  ok = TRUE;
+
+   memset(rec, 0, sizeof(JOBRECORD));
+   if(!fgets(buffer, PATH_MAX+MAXBUFF, fp) ||
+      strncmp(buffer, JOBMAGIC, strlen(JOBMAGIC)))
+      return(FALSE);
+
+   while(ok && fgets(buffer, PATH_MAX+MAXBUFF, fp))
+   {
+      /* A blank line ends the header                                   */
+      if(buffer[0] == '\n')
+      {
+         rec->bodyOffset = ftell(fp);
+         return((seen & HDR_NEEDED) == HDR_NEEDED);
+      }
+
+      TERMINATE(buffer);
+      key = 0;
+      if(!strncmp(buffer, "J: ", 3))
+      {
+         key = HDR_JOBFILE;
+         strncpy(rec->jobfile, buffer+3, PATH_MAX-1);
+      }
+      else if(!strncmp(buffer, "U:", 2))
+      {
+         key = HDR_UID;
+         if((ok = (sscanf(buffer+2, "%lu", &value) == 1)))
+            rec->uid = (uid_t)value;
+      }
+      else if(!strncmp(buffer, "G:", 2))
+      {
+         key = HDR_GID;
+         if((ok = (sscanf(buffer+2, "%lu", &value) == 1)))
+            rec->gid = (gid_t)value;
+      }
+      else if(!strncmp(buffer, "N:", 2))
+      {
+         key = HDR_NICE;
+         ok  = (sscanf(buffer+2, "%d", &(rec->nice)) == 1);
+      }
+      else if(!strncmp(buffer, "P:", 2))
+      {
+         key = HDR_PRIO;
+         ok  = (sscanf(buffer+2, "%d", &(rec->priority)) == 1);
+      }
+      else if(!strncmp(buffer, "A:", 2))
+      {
+         key = HDR_TASKS;
+         ok  = (sscanf(buffer+2, "%lu %lu", &(rec->firstTask), 
+                       &(rec->lastTask)) == 2);
+      }
+
+      if(seen & key)
+         ok = FALSE;
+      seen |= key;
+   }
+
+   return(FALSE);
+}
+
+
+/************************************************************************/
+/*>BOOL WriteJobRecord(char *spoolDir, ULONG jobnum, JOBRECORD *rec,
+                       char *script, int durability)
+   ------------------------------------------------------------------
+   Input:   char      *spoolDir   Spool directory
+            ULONG     jobnum      Job number
+            JOBRECORD *rec        Details of the job
+            char      *script     Script to be run
+            int       durability  From ReadDurability()
+   Returns: BOOL                  Success?
+
+   Queues a job as a single file, N.job, holding a header made by
+   FormatJobHeader() followed by the script. It is written with 
+   CreateSpoolFile() and appears in the spool directory in one step.
+
+   The record is owned by root so that nobody can change who the job
+   runs as. It is readable by everyone (so that qllist can show it) if
+   the script was; otherwise only by root and the submitter's group.
+   The script is opened with the submitter's permissions by
+   OpenUserFile().
+
+   18.10.26 Original   By: ACRM
+   18.10.26 Opens the script with OpenUserFile()
+*/
+BOOL WriteJobRecord(char *spoolDir, ULONG jobnum, JOBRECORD *rec,
+                    char *script, int durability)
+{
+   struct stat statbuff;
+   char        header[MAXJOBHEADER],
+               file[PATH_MAX+MAXBUFF],
+               tmpName[PATH_MAX+MAXBUFF];
+   int         in,
+               out,
+               len;
+   BOOL        ok;
+
+   if((in = OpenUserFile(script)) < 0)
+      return(FALSE);
+   if(fstat(in, &statbuff) ||
+      ((out = CreateSpoolFile(spoolDir, tmpName)) < 0))
+   {
+      close(in);
+      return(FALSE);
+   }
+
+   if(statbuff.st_mode & S_IROTH)
+   {
+      fchown(out, 0, 0);
+      fchmod(out, 0644);
+   }
+   else
+   {
+      fchown(out, 0, rec->gid);
+      fchmod(out, 0640);
+   }
+
+   len = FormatJobHeader(header, rec);
+   ok  = ((write(out, header, len) == len) && CopyData(in, out));
+   close(in);
+
+   if(!ok)
+   {
+      close(out);
+      if(tmpName[0])
+         unlink(tmpName);
+      return(FALSE);
+   }
+
+   sprintf(file, "%s/%lu.job", spoolDir, jobnum);
+   return(PublishSpoolFile(out, tmpName, file, durability));
+}
+
+
+/************************************************************************/
+/*>BOOL CopyJobScript(char *file, JOBRECORD *rec, char *to)
+   --------------------------------------------------------
+   Input:   char      *file    A job record
+            JOBRECORD *rec     Its header from ReadJobRecord()
+            char      *to      File to create for the script
+   Returns: BOOL               Success?
+
+   Copies the script out of a job record. The copy is readable by the
+   job's group (which it runs as) but can't be changed by the job. Any
+   old file of that name is removed and the copy is always created 
+   afresh, so a planted file or symbolic link is never written through.
+
+   18.10.26 Original   By: ACRM
+   18.10.26 Creates the copy with O_EXCL and O_NOFOLLOW
+*/
+BOOL CopyJobScript(char *file, JOBRECORD *rec, char *to)
+{
+   int  in,
+        out;
+   BOOL ok;
+
+   if((in = open(file, O_RDONLY)) < 0)
+      return(FALSE);
+   unlink(to);
+   if((lseek(in, (off_t)rec->bodyOffset, SEEK_SET) < 0) ||
+      ((out = open(to, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 
+                   0640)) < 0))
+   {
+      close(in);
+      return(FALSE);
+   }
+   fchown(out, (uid_t)(-1), rec->gid);
+   fchmod(out, 0640);
+
+   ok = CopyData(in, out);
+
+   close(in);
+   if(close(out))
+      ok = FALSE;
+   if(!ok)
+      unlink(to);
+
+   return(ok);
+}
+
+
+/************************************************************************/
+/*>BOOL WriteJobHeader(char *file, JOBRECORD *rec)
+   -----------------------------------------------
+   Input:   char      *file    File to create
+            JOBRECORD *rec     Details of a job
+   Returns: BOOL               Success?
+
+   Writes just the header of a job record, which ReadJobRecord() can
+   read back. As in CopyJobScript(), the file is always created afresh.
+
+   18.10.26 Original   By: ACRM
+   18.10.26 Creates the file with O_EXCL and O_NOFOLLOW
+*/
+BOOL WriteJobHeader(char *file, JOBRECORD *rec)
+{
+   char header[MAXJOBHEADER];
+   int  fd,
+        len;
+   BOOL ok;
+
+   unlink(file);
+   if((fd = open(file, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0644))
+      < 0)
+      return(FALSE);
+
+   len = FormatJobHeader(header, rec);
+   ok  = (write(fd, header, len) == len);
+   if(close(fd))
+      ok = FALSE;
+   if(!ok)
+      unlink(file);
+
+   return(ok);
+}
+
+
+/************************************************************************/
+/*>BOOL ReadTaskProgress(char *spoolDir, ULONG jobnum, ULONG *nextTask,
+                         ULONG *nDone)
+   --------------------------------------------------------------------
+   Input:   char   *spoolDir   Spool directory
+            ULONG  jobnum      Job number of a job array
+   Output:  ULONG  *nextTask   First task not yet handed out (0 if none
+                               has been)
+            ULONG  *nDone      Number of tasks finished
+   Returns: BOOL               Was there a progress file?
+
+   Reads the progress of a job array from its .tasks file, which qlrun
+   updates as it starts and finishes the tasks.
+
+   18.10.26 Original   By: ACRM
+*/
+BOOL ReadTaskProgress(char *spoolDir, ULONG jobnum, ULONG *nextTask,
+                      ULONG *nDone)
+{
+   FILE *fp;
+   char file[PATH_MAX];
+   BOOL ok = FALSE;
+
+   *nextTask = *nDone = 0;
+   sprintf(file, "%s/%lu.tasks", spoolDir, jobnum);
+   if((fp=fopen(file, "r"))!=NULL)
+   {
+      ok = (fscanf(fp, "%lu %lu", nextTask, nDone) == 2);
+      fclose(fp);
+   }
+
+   return(ok);
+}
+
+
+/************************************************************************/
+/*>ULONG ReadLastJob(char *spoolDir)
+   ---------------------------------
+   Input:   char   *spoolDir   Spool directory
+   Returns: ULONG              Highest job number given out (0 if none)
+
+   Reads the job counter, .qllastjob, from a spool directory
+
+   18.10.26 Original   By: ACRM
+*/
+ULONG ReadLastJob(char *spoolDir)
+{
+   FILE  *fp;
+   char  file[PATH_MAX];
+   ULONG jobnum = 0L;
+
+   sprintf(file, "%s/.qllastjob", spoolDir);
+   if((fp=fopen(file, "r"))!=NULL)
+   {
+      if(fscanf(fp, "%lu", &jobnum) != 1)
+         jobnum = 0L;
+      fclose(fp);
+   }
+
+   return(jobnum);
+}
+
+
+/************************************************************************/
+/*>BOOL WriteLastJob(char *spoolDir, ULONG jobnum)
+   -----------------------------------------------
+   Input:   char   *spoolDir   Spool directory
+            ULONG  jobnum      Highest job number given out
+   Returns: BOOL               Success?
+
+   Updates the job counter. The new value is written to a temporary 
+   file, flushed to disk and renamed over .qllastjob, so a crash leaves
+   either the old or the new value and never a half-written one. The
+   file is owned by root.
+
+   18.10.26 Original   By: ACRM
+*/
+BOOL WriteLastJob(char *spoolDir, ULONG jobnum)
+{
+   char file[PATH_MAX],
+        tmpfile[PATH_MAX+MAXBUFF],
+        buffer[MAXBUFF];
+   int  fd,
+        len;
+   BOOL ok = TRUE;
+
+   sprintf(file, "%s/.qllastjob", spoolDir);
+   sprintf(tmpfile, "%s.%ld", file, (long)getpid());
+   if((fd = open(tmpfile, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+      return(FALSE);
+
+   len = sprintf(buffer, "%lu", jobnum);
+   if((write(fd, buffer, len) != len) || fsync(fd))
+      ok = FALSE;
+   if(close(fd))
+      ok = FALSE;
+
+   if(ok)
+   {
+      chown(tmpfile, 0, 0);
+      if(rename(tmpfile, file))
+         ok = FALSE;
+   }
+   if(!ok)
+   {
+      unlink(tmpfile);
+      return(FALSE);
+   }
+
+   /* Make the rename itself durable                                    */
+   if((fd = open(spoolDir, O_RDONLY)) >= 0)
+   {
+      fsync(fd);
+      close(fd);
+   }
+
+   return(TRUE);
+}
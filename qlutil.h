@@ -3,8 +3,8 @@
    Program:    QLite
    File:       qlutil.h
    
-   Version:    V1.0
-   Date:       04.10.00
+   Version:    V1.17
+   Date:       18.10.26
    Function:   Header file for all QLite programs
    
    Copyright:  (c) University of Reading / Dr. Andrew C. R. Martin 2000
@@ -50,6 +50,34 @@
    Revision History:
    =================
    V1.0  04.10.00  Original   By: ACRM
+   V1.1  18.10.26  Added LockStatus() and CloseLocks() for lock sessions
+   V1.2  18.10.26  Added LEASE_TTL and RenewLock()
+   V1.3  18.10.26  Added EnqueueJob() and DequeueJob()
+   V1.4  18.10.26  Added MAXLOCKNAME. InitLocks() takes the name of the
+                   lock to use
+   V1.5  18.10.26  Added LOCK_EXCLUSIVE and LOCK_SHARED. GetLock() takes a
+                   mode
+   V1.6  18.10.26  Added LockStats()
+   V1.7  18.10.26  DequeueJob() can wait for a job to be submitted
+   V1.8  18.10.26  Added MAXBATCH. DequeueJob() replaced by DequeueJobs()
+                   which can take a batch
+   V1.9  18.10.26  Added RequestJobs(), ReadJobs() and LockSocket()
+   V1.10 18.10.26  Added CopyFile()
+   V1.11 18.10.26  Added ReadJobPriority(). EnqueueJob() takes a priority
+   V1.12 18.10.26  Added ReadJobTasks() and ReadTaskProgress().
+                   EnqueueJob(), DequeueJobs() and ReadJobs() carry task
+                   numbers
+   V1.13 18.10.26  Added ReadLastJob(), WriteLastJob() and AllocateJobIds()
+   V1.14 18.10.26  Added the DURABLE_ settings, CopyData(),
+                   ReadDurability(), CreateSpoolFile() and
+                   PublishSpoolFile()
+   V1.15 18.10.26  Added JOBMAGIC, MAXJOBHEADER and JOBRECORD with
+                   FormatJobHeader(), ReadJobRecord(), WriteJobRecord(),
+                   CopyJobScript() and WriteJobHeader(). Removed
+                   ReadJobPriority() and ReadJobTasks()
+   V1.16 18.10.26  Added JOURNAL_DIR, the JNL_ defines, JNLENTRY,
+                   ReadJobHeader() and the routines in qljournal.c
+   V1.17 18.10.26  Added OpenUserFile() and UnlinkUserFile()
 
 *************************************************************************/
 /* Includes
@@ -62,6 +90,21 @@
 #define MAXCLUSTER      100   /* Max number of clusters (not machines!) */
 #define DEFAULT_QLPORT  5468  /* Default port for qlockd                */
 #define LOCK_TIMEOUT    30    /* Timeout on trying to get a lock        */
+#define LEASE_TTL       60    /* Lock lease time unless renewed         */
+#define MAXLOCKNAME     32    /* Max length of a qllockd lock name      */
+#define LOCK_EXCLUSIVE  0     /* GetLock() modes                        */
+#define LOCK_SHARED     1
+#define MAXBATCH        16    /* Most jobs handed out by one DEQUEUE    */
+#define DURABLE_NONE    0     /* ReadDurability() settings              */
+#define DURABLE_DATA    1
+#define DURABLE_FULL    2
+#define JOBMAGIC        "QLJOB 1" /* First line of a job record         */
+#define MAXJOBHEADER    (PATH_MAX+8*MAXBUFF)
+#define JOURNAL_DIR     ".journal" /* Spool subdirectory for a journal  */
+#define JNL_NAMELEN     128   /* Job file name kept in a journal index  */
+#define JNL_WAITING     0     /* JNLENTRY states                        */
+#define JNL_DONE        1
+#define JNL_PRIVATE     1     /* JNLENTRY flags                         */
 
 #ifndef SYS_TYPES_H     /* Unix: <sys/types.h>, MS-DOS: <sys\types.h>   */
 #ifndef _TYPES_         /* Ditto                                        */
@@ -117,6 +160,35 @@ do {  int _kts_macro_i;                                                  \
                      }  }  }  while(0)
 
 
+typedef struct
+{
+   char  jobfile[PATH_MAX];   /* The file which was submitted           */
+   uid_t uid;                 /* Who it runs as                         */
+   gid_t gid;
+   int   nice,
+         priority;
+   ULONG firstTask,           /* Task range of a job array (0 if not)   */
+         lastTask;
+   long  bodyOffset;          /* Where the script starts in the record  */
+}  JOBRECORD;
+
+typedef struct
+{
+   ULONG jobnum,
+         segment,             /* Segment file holding the job record    */
+         offset,              /* Where the record starts in it          */
+         length,              /* and its length                         */
+         firstTask,           /* Task range of a job array (0 if not)   */
+         lastTask;
+   uid_t uid;
+   gid_t gid;
+   int   nice,
+         priority,
+         state,               /* JNL_WAITING or JNL_DONE                */
+         flags;               /* JNL_PRIVATE if the script was private  */
+   char  jobfile[JNL_NAMELEN];/* Empty if private                       */
+}  JNLENTRY;
+
 typedef struct _runfile
 {
    struct _runfile *next;
@@ -140,12 +212,53 @@ int CreateLockFile(char *spoolDir);
 void DeleteLockFile(char *spoolDir);
 BOOL CheckForSpoolDir(char *spoolDir);
 BOOL RootUser(void);
+int  OpenUserFile(char *file);
+BOOL UnlinkUserFile(char *file);
 RUNFILE *ReadMachineList(char *spoolDir);
 BOOL  DaemonInit(void);
 int atoport(char *service, char *proto);
 void GetPortAndLockHost(char *spoolDir, int *port, char *lockhost);
+BOOL CopyFile(char *from, char *to);
+BOOL CopyData(int in, int out);
+int  ReadDurability(char *spoolDir);
+int  CreateSpoolFile(char *spoolDir, char *tmpName);
+BOOL PublishSpoolFile(int fd, char *tmpName, char *file, int durability);
+int  FormatJobHeader(char *buffer, JOBRECORD *rec);
+BOOL ReadJobRecord(char *file, JOBRECORD *rec);
+BOOL ReadJobHeader(FILE *fp, JOBRECORD *rec);
+BOOL WriteJobRecord(char *spoolDir, ULONG jobnum, JOBRECORD *rec,
+                    char *script, int durability);
+BOOL CopyJobScript(char *file, JOBRECORD *rec, char *to);
+BOOL WriteJobHeader(char *file, JOBRECORD *rec);
+BOOL ReadTaskProgress(char *spoolDir, ULONG jobnum, ULONG *nextTask,
+                      ULONG *nDone);
+ULONG ReadLastJob(char *spoolDir);
+BOOL WriteLastJob(char *spoolDir, ULONG jobnum);
+
+/* Routines in qljournal.c                                              */
+BOOL JournalEnabled(char *spoolDir);
+BOOL JournalAppend(char *spoolDir, ULONG jobnum, JOBRECORD *rec,
+                   char *script, int durability);
+BOOL JournalFindJob(char *spoolDir, ULONG jobnum, JOBRECORD *rec);
+ULONG JournalNextJob(char *spoolDir);
+JNLENTRY *JournalWaitingJobs(char *spoolDir, ULONG *njobs);
+BOOL JournalCopyJob(char *spoolDir, ULONG jobnum, char *runFile,
+                    char *statFile, BOOL take);
+BOOL JournalFinishJob(char *spoolDir, ULONG jobnum);
 
 /* Routines in qlclient.c                                               */
-BOOL InitLocks(char *service, char *host, int port);
-int  GetLock(int id, int timeout);
+BOOL InitLocks(char *service, char *host, int port, char *lockName);
+int  GetLock(int id, int timeout, int mode);
 BOOL ReleaseLock(int id);
+BOOL RenewLock(int id);
+int  LockStatus(void);
+BOOL EnqueueJob(int cluster, ULONG jobnum, int priority, 
+                ULONG firstTask, ULONG lastTask);
+BOOL AllocateJobIds(int cluster, ULONG njobs, ULONG *firstJob);
+int  DequeueJobs(int cluster, int wait, int maxjobs, ULONG *jobnums,
+                 ULONG *tasks, int *njobs);
+BOOL RequestJobs(int cluster, int wait, int maxjobs);
+int  ReadJobs(int maxjobs, ULONG *jobnums, ULONG *tasks, int *njobs);
+int  LockSocket(void);
+BOOL LockStats(FILE *out);
+void CloseLocks(void);